@@ -0,0 +1,178 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Connection storm, i.e. many connections arrive at once and wait in the
+ * backlog of listening socket. Each operation is one connection accepted and
+ * closed by EM_listener. It's measured with budget of one connection per
+ * event, which is what accepting one connection per epoll_wait() does, and
+ * with EM_LISTENER_DEFAULT_BUDGET.
+ *
+ * Connections are opened in rounds of STORM_SIZE and only time spent
+ * accepting them is measured. Number of wait calls is taken from event
+ * machine metrics.
+ *
+ * Usage: accept-storm [ITERATIONS]
+ */
+
+#include "bench.h"
+#include "event-listener.h"
+#include "event-machine.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define STORM_SIZE  512
+
+struct storm
+{
+    uint64_t accepted;
+    uint64_t target;
+};
+
+static void accept_handler(EM *em, int fd, const struct sockaddr *address,
+    socklen_t address_len, void *data)
+{
+    struct storm *storm = data;
+
+    close(fd);
+    if (++storm->accepted == storm->target)
+    {
+        event_machine_terminate(em);
+    }
+}
+
+static void connect_storm(const struct sockaddr_in *address, int clients[],
+    size_t n)
+{
+    const struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+
+    for (size_t i = 0; i < n; i++)
+    {
+        clients[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+        // Reset instead of FIN, so that no connection ends up in TIME_WAIT.
+        if (clients[i] < 0
+            || setsockopt(clients[i], SOL_SOCKET, SO_LINGER, &linger,
+                sizeof(linger)) != 0
+            || (connect(clients[i], (const struct sockaddr *)address,
+                sizeof(*address)) != 0 && errno != EINPROGRESS))
+        {
+            perror("connect");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void storm(const char *name, size_t budget, uint64_t iterations)
+{
+    EM em = EM_STATIC_DEFAULT;
+    EM_listener listener;
+    EM_metrics metrics;
+    struct storm storm = { .accepted = 0, .target = 0 };
+    int clients[STORM_SIZE];
+
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in address =
+        { .sin_family = AF_INET
+        , .sin_port = 0
+        , .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+        };
+    socklen_t address_len = sizeof(address);
+
+    if (fd < 0
+        || bind(fd, (struct sockaddr *)&address, address_len) != 0
+        || listen(fd, 2 * STORM_SIZE) != 0
+        || getsockname(fd, (struct sockaddr *)&address, &address_len) != 0)
+    {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+
+    if (event_machine_init(&em) != EM_SUCCESS
+        || event_machine_enable_metrics(&em, NULL) != EM_SUCCESS
+        || event_listener_create(&em, &listener, fd, budget, 0,
+            accept_handler, &storm) != EM_SUCCESS)
+    {
+        perror("event_machine_init");
+        exit(EXIT_FAILURE);
+    }
+    event_machine_metrics(&em, &metrics);
+    const uint64_t wait_calls = metrics.wait_calls;
+
+    uint64_t elapsed = 0;
+    while (storm.accepted < iterations)
+    {
+        const size_t n = iterations - storm.accepted < STORM_SIZE
+            ? (size_t)(iterations - storm.accepted) : STORM_SIZE;
+
+        connect_storm(&address, clients, n);
+        storm.target = storm.accepted + n;
+
+        const uint64_t start = bench_now_ns();
+        if (event_machine_run(&em) != EM_SUCCESS)
+        {
+            perror("event_machine_run");
+            exit(EXIT_FAILURE);
+        }
+        elapsed += bench_now_ns() - start;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            close(clients[i]);
+        }
+    }
+    event_machine_metrics(&em, &metrics);
+
+    bench_report_begin(name, storm.accepted, elapsed);
+    bench_report_field("wait_calls", (double)(metrics.wait_calls - wait_calls));
+    bench_report_field("accepts_per_wait",
+        (double)storm.accepted / (double)(metrics.wait_calls - wait_calls));
+    bench_report_end();
+
+    event_listener_destroy(&listener);
+    event_machine_destroy(&em);
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t iterations = bench_iterations(argc, argv, 100000);
+
+    storm("accept-storm/budget-1", 1, iterations);
+    storm("accept-storm/budget-default", 0, iterations);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Registration churn, i.e. what event machine does when connections are
+ * accepted and closed at high rate. Each operation is one event_machine_add()
+ * followed by one event_machine_delete() of a socket. It's measured with
+ * EM_VALIDATE_ALWAYS and EM_VALIDATE_TRUSTED validation policy.
+ *
+ * Calls to fcntl() and epoll_ctl() made by the library are taken from event
+ * machine metrics.
+ *
+ * Usage: add-delete-churn [ITERATIONS]
+ */
+
+#include "bench.h"
+#include "event-machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define NUM_SOCKETS 1024
+
+static void handler(EM *em, event_filter_t events, int fd, void *data)
+{
+}
+
+static void churn(const char *name, EM_validation validation,
+    EM_event_descriptor eds[], uint64_t iterations)
+{
+    EM em = EM_STATIC_DEFAULT;
+
+    EM_metrics metrics;
+
+    if (event_machine_init(&em) != EM_SUCCESS
+        || event_machine_set_validation(&em, validation) != EM_SUCCESS
+        || event_machine_enable_metrics(&em, NULL) != EM_SUCCESS)
+    {
+        perror("event_machine_init");
+        exit(EXIT_FAILURE);
+    }
+
+    const uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        EM_event_descriptor *ed = &eds[i % NUM_SOCKETS];
+
+        if (event_machine_add(&em, ed) != EM_SUCCESS
+            || event_machine_delete(&em, ed->fd, NULL) != EM_SUCCESS)
+        {
+            perror("event_machine_add/delete");
+            exit(EXIT_FAILURE);
+        }
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    event_machine_metrics(&em, &metrics);
+    bench_report_begin(name, iterations, elapsed);
+    bench_report_field("fcntl_per_op",
+        (double)metrics.fcntl_calls / iterations);
+    bench_report_field("ctl_per_op", (double)metrics.ctl_calls / iterations);
+    bench_report_end();
+
+    event_machine_destroy(&em);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t iterations = bench_iterations(argc, argv, 1000000);
+    static int sockets[NUM_SOCKETS];
+    static EM_event_descriptor eds[NUM_SOCKETS];
+
+    if (iterations == 0)
+    {
+        fprintf(stderr, "Number of iterations has to be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < NUM_SOCKETS; i += 2)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, &sockets[i])
+            < 0)
+        {
+            perror("socketpair");
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < NUM_SOCKETS; i++)
+    {
+        eds[i].events = EVENT_READ;
+        eds[i].fd = sockets[i];
+        eds[i].data = NULL;
+        eds[i].handler = handler;
+    }
+
+    churn("add-delete-churn/validate-always", EM_VALIDATE_ALWAYS,
+        eds, iterations);
+    churn("add-delete-churn/validate-trusted", EM_VALIDATE_TRUSTED,
+        eds, iterations);
+
+    for (int i = 0; i < NUM_SOCKETS; i++)
+    {
+        close(sockets[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Helpers shared by benchmarks. Each benchmark prints one line per result in
+ * JSON format, so that results can be collected and compared by scripts.
+ */
+
+#ifndef BENCH_H_101543215896417205447935167330718463125
+#define BENCH_H_101543215896417205447935167330718463125
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/* Number of iterations taken from first command line argument, or default
+ * value if it wasn't specified.
+ */
+static inline uint64_t bench_iterations(int argc, char *argv[],
+    uint64_t default_iterations)
+{
+    if (argc > 1)
+    {
+        return strtoull(argv[1], NULL, 10);
+    }
+
+    return default_iterations;
+}
+
+/* Start result line. Additional fields can be added using
+ * bench_report_field() and the line has to be terminated using
+ * bench_report_end().
+ */
+static inline void bench_report_begin(const char *name, uint64_t ops,
+    uint64_t elapsed_ns)
+{
+    printf("{\"name\": \"%s\", \"ops\": %" PRIu64 ", \"ns_per_op\": %.2f"
+        ", \"ops_per_sec\": %.0f", name, ops,
+        ops == 0 ? 0.0 : (double)elapsed_ns / (double)ops,
+        elapsed_ns == 0 ? 0.0 : (double)ops * 1e9 / (double)elapsed_ns);
+}
+
+static inline void bench_report_field(const char *key, double value)
+{
+    printf(", \"%s\": %.2f", key, value);
+}
+
+static inline void bench_report_end(void)
+{
+    printf("}\n");
+    fflush(stdout);
+}
+
+/* Durations of individual operations, reported as percentiles. Samples
+ * exceeding size of the buffer are dropped.
+ */
+typedef struct
+{
+    uint64_t *samples;
+    size_t count;
+    size_t size;
+} bench_samples;
+
+static inline void bench_samples_init(bench_samples *samples, size_t size)
+{
+    samples->samples = malloc(size * sizeof(uint64_t));
+    samples->count = 0;
+    samples->size = size;
+
+    if (samples->samples == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline void bench_samples_add(bench_samples *samples, uint64_t ns)
+{
+    if (samples->count < samples->size)
+    {
+        samples->samples[samples->count++] = ns;
+    }
+}
+
+static inline void bench_samples_free(bench_samples *samples)
+{
+    free(samples->samples);
+    samples->samples = NULL;
+    samples->count = 0;
+    samples->size = 0;
+}
+
+static int bench_compare_samples(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Add p50_ns, p90_ns, p99_ns, p999_ns and max_ns fields to current result
+ * line. Samples are sorted in place.
+ */
+static inline void bench_report_percentiles(bench_samples *samples)
+{
+    static const struct { const char *key; double rank; } percentiles[] =
+    {
+        {"p50_ns", 0.50}, {"p90_ns", 0.90}, {"p99_ns", 0.99},
+        {"p999_ns", 0.999}
+    };
+    const size_t n = samples->count;
+
+    if (n == 0)
+    {
+        return;
+    }
+    qsort(samples->samples, n, sizeof(uint64_t), bench_compare_samples);
+
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        const size_t index = (size_t)(percentiles[i].rank * (double)(n - 1));
+
+        bench_report_field(percentiles[i].key,
+            (double)samples->samples[index]);
+    }
+    bench_report_field("max_ns", (double)samples->samples[n - 1]);
+}
+
+#endif /* BENCH_H_101543215896417205447935167330718463125 */
@@ -0,0 +1,204 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Memory usage and cost of insert, lookup and remove of descriptor storages
+ * from event-storage.h with 10k, 100k and 1M stored file descriptors.
+ *
+ * Two sets of file descriptors are used. Dense one is 0..N-1, which is what
+ * a process usually gets from the kernel, and sparse one is spread randomly
+ * over 0..SPARSENESS*N-1, i.e. only one in SPARSENESS file descriptors is
+ * stored. File descriptors aren't real, storages don't care.
+ *
+ * Usage: descriptor-storage [LOOKUPS]
+ */
+
+#include "bench.h"
+#include "event-machine.h"
+#include "event-storage.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SPARSENESS      16
+
+static uint64_t random_state = 88172645463325252ULL;
+
+/* Xorshift, good enough to shuffle file descriptors. */
+static inline uint64_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+
+    return random_state;
+}
+
+/* Fill fds with n distinct random values from 0..SPARSENESS*n-1. */
+static void random_sparse_set(int fds[], size_t n)
+{
+    unsigned char *const used = calloc(SPARSENESS * n / 8 + 1, 1);
+
+    if (used == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        int fd;
+
+        do
+        {
+            fd = (int)(random_next() % (SPARSENESS * n));
+        } while (used[fd / 8] & (1 << (fd % 8)));
+        used[fd / 8] |= 1 << (fd % 8);
+        fds[i] = fd;
+    }
+
+    free(used);
+}
+
+static void fail(const char *what, uint32_t ret)
+{
+    fprintf(stderr, "%s failed: %u\n", what, ret);
+    exit(EXIT_FAILURE);
+}
+
+static void run(const char *type_name, EM_storage_type type,
+    const char *set_name, const int fds[], size_t n, uint64_t lookups)
+{
+    EM_descriptor_storage storage =
+        { .insert = NULL, .remove = NULL, .lookup = NULL
+        , .data_size = 0, .data = NULL
+        };
+    static EM_event_descriptor ed;
+    char name[128];
+    uint64_t start;
+    uint64_t found = 0;
+    uint32_t ret;
+
+    if_em_failure_of (ret, event_storage_init(&storage, type))
+    {
+        fail("event_storage_init", ret);
+    }
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < n; i++)
+    {
+        if_em_failure_of (ret, storage.insert(storage.data, fds[i], &ed))
+        {
+            fail("insert", ret);
+        }
+    }
+    snprintf(name, sizeof(name), "descriptor-storage/%s/%s/%zu/insert",
+        type_name, set_name, n);
+    bench_report_begin(name, n, bench_now_ns() - start);
+    bench_report_field("memory_bytes",
+        (double)event_storage_memory_usage(&storage));
+    bench_report_field("bytes_per_fd",
+        (double)event_storage_memory_usage(&storage) / n);
+    bench_report_end();
+
+    start = bench_now_ns();
+    for (uint64_t i = 0; i < lookups; i++)
+    {
+        found += storage.lookup(storage.data, fds[random_next() % n]) != NULL;
+    }
+    snprintf(name, sizeof(name), "descriptor-storage/%s/%s/%zu/lookup",
+        type_name, set_name, n);
+    bench_report_begin(name, lookups, bench_now_ns() - start);
+    bench_report_end();
+    if (found != lookups)
+    {
+        fail("lookup", EM_ERROR_STORAGE_NO_SUCH_ENTRY);
+    }
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < n; i++)
+    {
+        EM_event_descriptor *old_ed = NULL;
+
+        if_em_failure_of (ret, storage.remove(storage.data, fds[i], &old_ed))
+        {
+            fail("remove", ret);
+        }
+    }
+    snprintf(name, sizeof(name), "descriptor-storage/%s/%s/%zu/remove",
+        type_name, set_name, n);
+    bench_report_begin(name, n, bench_now_ns() - start);
+    bench_report_field("memory_bytes",
+        (double)event_storage_memory_usage(&storage));
+    bench_report_end();
+
+    event_storage_destroy(&storage);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t lookups = bench_iterations(argc, argv, 10000000);
+    const size_t sizes[] = {10000, 100000, 1000000};
+    const struct { const char *name; EM_storage_type type; } types[] =
+        { {"array", EM_STORAGE_ARRAY}
+        , {"radix", EM_STORAGE_RADIX}
+        , {"hash", EM_STORAGE_HASH}
+        };
+    int *const dense = malloc(sizes[2] * sizeof(int));
+    int *const sparse = malloc(sizes[2] * sizeof(int));
+
+    if (dense == NULL || sparse == NULL || lookups == 0)
+    {
+        fprintf(stderr, "Out of memory or invalid number of lookups.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizes[2]; i++)
+    {
+        dense[i] = (int)i;
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        random_sparse_set(sparse, sizes[s]);
+        for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+        {
+            run(types[t].name, types[t].type, "dense", dense, sizes[s],
+                lookups);
+            run(types[t].name, types[t].type, "sparse", sparse, sizes[s],
+                lookups);
+        }
+    }
+
+    free(dense);
+    free(sparse);
+
+    return EXIT_SUCCESS;
+}
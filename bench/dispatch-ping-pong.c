@@ -0,0 +1,196 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Dispatch overhead per event. Two file descriptors registered in one event
+ * machine bounce a token between each other, handler of one reads it and
+ * writes it to the other, therefore each operation is one iteration of main
+ * loop with exactly one event: epoll_wait(), handler invocation, read() and
+ * write(). It's measured using a socketpair and a pair of eventfds.
+ *
+ * Percentiles are of time between two consecutive handler invocations.
+ *
+ * Usage: dispatch-ping-pong [ITERATIONS]
+ */
+
+#include "bench.h"
+#include "event-machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct ping_pong
+{
+    /* Where handler of each of the two event descriptors writes the token.
+     */
+    int peer_fd[2];
+    EM_event_descriptor eds[2];
+
+    uint64_t remaining;
+    uint64_t last_ns;
+    bench_samples samples;
+};
+
+static void handler(EM *em, event_filter_t events, int fd, void *data)
+{
+    struct ping_pong *const pp = data;
+    const int side = fd == pp->eds[0].fd ? 0 : 1;
+    uint64_t token;
+
+    if (read(fd, &token, sizeof(token)) != sizeof(token))
+    {
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+
+    const uint64_t now = bench_now_ns();
+    bench_samples_add(&pp->samples, now - pp->last_ns);
+    pp->last_ns = now;
+
+    if (--pp->remaining == 0)
+    {
+        event_machine_terminate(em);
+
+        return;
+    }
+    if (write(pp->peer_fd[side], &token, sizeof(token)) != sizeof(token))
+    {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Registered file descriptors are fds[0] and fds[1], token for fds[i] is
+ * written to peer_fds[i].
+ */
+static void ping_pong(const char *name, const int fds[2],
+    const int peer_fds[2], uint64_t iterations)
+{
+    EM em = EM_STATIC_DEFAULT;
+    struct ping_pong pp;
+    const uint64_t token = 1;
+
+    if (event_machine_init(&em) != EM_SUCCESS)
+    {
+        perror("event_machine_init");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        pp.peer_fd[i] = peer_fds[1 - i];
+        pp.eds[i].events = EVENT_READ;
+        pp.eds[i].fd = fds[i];
+        pp.eds[i].data = &pp;
+        pp.eds[i].handler = handler;
+        if (event_machine_add(&em, &pp.eds[i]) != EM_SUCCESS)
+        {
+            perror("event_machine_add");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Warm up caches and branch predictors before measuring.
+     */
+    for (int round = 0; round < 2; round++)
+    {
+        const uint64_t ops = round == 0 ? iterations / 10 + 1 : iterations;
+
+        pp.remaining = ops;
+        bench_samples_init(&pp.samples, ops);
+
+        const uint64_t start = bench_now_ns();
+        pp.last_ns = start;
+        if (write(peer_fds[0], &token, sizeof(token)) != sizeof(token)
+            || event_machine_run(&em) != EM_SUCCESS)
+        {
+            perror("ping_pong");
+            exit(EXIT_FAILURE);
+        }
+        const uint64_t elapsed = bench_now_ns() - start;
+
+        if (round == 1)
+        {
+            bench_report_begin(name, ops, elapsed);
+            bench_report_percentiles(&pp.samples);
+            bench_report_end();
+        }
+        bench_samples_free(&pp.samples);
+    }
+
+    event_machine_destroy(&em);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t iterations = bench_iterations(argc, argv, 1000000);
+    int sockets[2];
+    int eventfds[2];
+
+    if (iterations == 0)
+    {
+        fprintf(stderr, "Number of iterations has to be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) < 0)
+    {
+        perror("socketpair");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        eventfds[i] = eventfd(0, EFD_NONBLOCK);
+        if (eventfds[i] < 0)
+        {
+            perror("eventfd");
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Token written to one end of socketpair is read from the other one,
+     * eventfd is read from the same file descriptor it was written to.
+     */
+    const int socket_peers[2] = {sockets[1], sockets[0]};
+    ping_pong("dispatch-ping-pong/socketpair", sockets, socket_peers,
+        iterations);
+    ping_pong("dispatch-ping-pong/eventfd", eventfds, eventfds, iterations);
+
+    for (int i = 0; i < 2; i++)
+    {
+        close(sockets[i]);
+        close(eventfds[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Event latency while event machine processes a job split in to deferred
+ * tasks. Each round queues NUM_SLICES deferred tasks, each of them doing
+ * SLICE_WORK_NS of work, and every PING_INTERVAL-th of them makes a pipe
+ * readable. Each operation is one pipe event and its time is the delay
+ * between the write and invocation of the pipe handler.
+ *
+ * It's measured without time budget, i.e. the whole job runs in one main
+ * loop iteration, and with TIME_BUDGET_USEC.
+ *
+ * Usage: next-tick-budget [ITERATIONS]
+ */
+
+#include "bench.h"
+#include "event-machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NUM_SLICES          200
+#define SLICE_WORK_NS       10000
+#define PING_INTERVAL       20
+#define NUM_PINGS           (NUM_SLICES / PING_INTERVAL)
+#define TIME_BUDGET_USEC    100
+
+struct job
+{
+    EM em;
+    EM_task slices[NUM_SLICES];
+    int pipe_fds[2];
+    uint64_t sent_at[NUM_PINGS];
+    int slices_done;
+    int pings_sent;
+    int pings_received;
+    bench_samples samples;
+};
+
+static void check_done(struct job *job)
+{
+    if (job->slices_done == NUM_SLICES && job->pings_received == NUM_PINGS)
+    {
+        event_machine_terminate(&job->em);
+    }
+}
+
+static void slice_handler(EM *em, void *data)
+{
+    struct job *job = data;
+    const uint64_t until = bench_now_ns() + SLICE_WORK_NS;
+
+    while (bench_now_ns() < until)
+    {
+        ;
+    }
+
+    if (++job->slices_done % PING_INTERVAL == 0)
+    {
+        const char token = 'p';
+
+        job->sent_at[job->pings_sent++] = bench_now_ns();
+        if (write(job->pipe_fds[1], &token, sizeof(token)) != sizeof(token))
+        {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+    }
+    check_done(job);
+}
+
+static void ping_handler(EM *em, event_filter_t events, int fd, void *data)
+{
+    struct job *job = data;
+    char tokens[NUM_PINGS];
+    const uint64_t now = bench_now_ns();
+
+    const ssize_t n = read(fd, tokens, sizeof(tokens));
+    for (ssize_t i = 0; i < n; i++)
+    {
+        bench_samples_add(&job->samples,
+            now - job->sent_at[job->pings_received++]);
+    }
+    check_done(job);
+}
+
+static void run_job(const char *name, uint32_t budget_usec,
+    uint64_t iterations)
+{
+    static struct job job = { .em = EM_STATIC_DEFAULT };
+
+    if (pipe(job.pipe_fds) != 0
+        || event_machine_init(&job.em) != EM_SUCCESS
+        || event_machine_set_tick_budget(&job.em, budget_usec) != EM_SUCCESS)
+    {
+        perror("event_machine_init");
+        exit(EXIT_FAILURE);
+    }
+
+    EM_event_descriptor ed =
+        { .events = EVENT_READ
+        , .fd = job.pipe_fds[0]
+        , .data = &job
+        , .handler = ping_handler
+        };
+    if (event_machine_add(&job.em, &ed) != EM_SUCCESS)
+    {
+        perror("event_machine_add");
+        exit(EXIT_FAILURE);
+    }
+
+    const uint64_t rounds = (iterations + NUM_PINGS - 1) / NUM_PINGS;
+    bench_samples_init(&job.samples, rounds * NUM_PINGS);
+
+    const uint64_t start = bench_now_ns();
+    for (uint64_t round = 0; round < rounds; round++)
+    {
+        job.slices_done = 0;
+        job.pings_sent = 0;
+        job.pings_received = 0;
+        for (int i = 0; i < NUM_SLICES; i++)
+        {
+            job.slices[i].handler = slice_handler;
+            job.slices[i].data = &job;
+            if (event_machine_next_tick_task(&job.em, &job.slices[i])
+                != EM_SUCCESS)
+            {
+                perror("event_machine_next_tick_task");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (event_machine_run(&job.em) != EM_SUCCESS)
+        {
+            perror("event_machine_run");
+            exit(EXIT_FAILURE);
+        }
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    bench_report_begin(name, job.samples.count, elapsed);
+    bench_report_percentiles(&job.samples);
+    bench_report_end();
+
+    bench_samples_free(&job.samples);
+    event_machine_destroy(&job.em);
+    close(job.pipe_fds[0]);
+    close(job.pipe_fds[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t iterations = bench_iterations(argc, argv, 10000);
+
+    run_job("next-tick-budget/unbounded", 0, iterations);
+    run_job("next-tick-budget/budget", TIME_BUDGET_USEC, iterations);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Latency of a control event, e.g. health check, that arrives in the same
+ * batch as many bulk events. Each operation is one batch: all bulk pipes and
+ * then the control pipe are made readable and the time until control handler
+ * is invoked is recorded. Bulk handler simulates some work.
+ *
+ * It's measured with control descriptor having the same priority as bulk
+ * ones, and with higher priority.
+ *
+ * Usage: priority-dispatch [ITERATIONS]
+ */
+
+#include "bench.h"
+#include "event-machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define NUM_BULK        512
+#define BULK_WORK_NS    1000
+
+struct batch
+{
+    EM em;
+    int remaining;
+    uint64_t start;
+    bench_samples samples;
+};
+
+static void consume(int fd)
+{
+    char token;
+
+    if (read(fd, &token, sizeof(token)) != sizeof(token))
+    {
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void done(struct batch *batch)
+{
+    if (--batch->remaining == 0)
+    {
+        event_machine_terminate(&batch->em);
+    }
+}
+
+static void bulk_handler(EM *em, event_filter_t events, int fd, void *data)
+{
+    const uint64_t until = bench_now_ns() + BULK_WORK_NS;
+
+    consume(fd);
+    while (bench_now_ns() < until)
+    {
+        ;
+    }
+    done(data);
+}
+
+static void control_handler(EM *em, event_filter_t events, int fd,
+    void *data)
+{
+    struct batch *batch = data;
+
+    bench_samples_add(&batch->samples, bench_now_ns() - batch->start);
+    consume(fd);
+    done(batch);
+}
+
+static void new_pipe(int fds[2])
+{
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void signal_pipe(int fd)
+{
+    const char token = 't';
+
+    if (write(fd, &token, sizeof(token)) != sizeof(token))
+    {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void dispatch(const char *name, uint32_t control_priority,
+    uint64_t iterations)
+{
+    struct batch batch =
+        { .em = EM_STATIC_WITH_MAX_EVENTS(NUM_BULK + 2, NULL)
+        };
+    int bulk_fds[NUM_BULK][2];
+    int control_fds[2];
+    EM_event_descriptor bulk[NUM_BULK];
+    EM_event_descriptor control;
+
+    if (event_machine_init(&batch.em) != EM_SUCCESS)
+    {
+        perror("event_machine_init");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < NUM_BULK; i++)
+    {
+        new_pipe(bulk_fds[i]);
+        bulk[i] = (EM_event_descriptor)
+            { .events = EVENT_READ
+            , .fd = bulk_fds[i][0]
+            , .data = &batch
+            , .handler = bulk_handler
+            };
+        if (event_machine_add(&batch.em, &bulk[i]) != EM_SUCCESS)
+        {
+            perror("event_machine_add");
+            exit(EXIT_FAILURE);
+        }
+    }
+    new_pipe(control_fds);
+    control = (EM_event_descriptor)
+        { .events = EVENT_READ
+        , .fd = control_fds[0]
+        , .data = &batch
+        , .handler = control_handler
+        };
+    if (event_machine_add(&batch.em, &control) != EM_SUCCESS)
+    {
+        perror("event_machine_add");
+        exit(EXIT_FAILURE);
+    }
+    if (event_machine_set_priority(&batch.em, control_fds[0], control_priority)
+        != EM_SUCCESS)
+    {
+        perror("event_machine_set_priority");
+        exit(EXIT_FAILURE);
+    }
+
+    bench_samples_init(&batch.samples, iterations);
+
+    const uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        for (int j = 0; j < NUM_BULK; j++)
+        {
+            signal_pipe(bulk_fds[j][1]);
+        }
+        signal_pipe(control_fds[1]);
+
+        batch.remaining = NUM_BULK + 1;
+        batch.start = bench_now_ns();
+        if (event_machine_run(&batch.em) != EM_SUCCESS)
+        {
+            perror("event_machine_run");
+            exit(EXIT_FAILURE);
+        }
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    bench_report_begin(name, iterations, elapsed);
+    bench_report_percentiles(&batch.samples);
+    bench_report_end();
+
+    bench_samples_free(&batch.samples);
+    event_machine_destroy(&batch.em);
+    for (int i = 0; i < NUM_BULK; i++)
+    {
+        close(bulk_fds[i][0]);
+        close(bulk_fds[i][1]);
+    }
+    close(control_fds[0]);
+    close(control_fds[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t iterations = bench_iterations(argc, argv, 1000);
+
+    dispatch("priority-dispatch/same", 0, iterations);
+    dispatch("priority-dispatch/high", 1, iterations);
+
+    return EXIT_SUCCESS;
+}
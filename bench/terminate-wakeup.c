@@ -0,0 +1,123 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Latency of event_machine_terminate() called from another thread, i.e. time
+ * from the call until event_machine_run() returns in the thread running
+ * event machine, which is blocked waiting for events. It includes write to
+ * eventfd or pipe, wakeup of blocked thread and one main loop iteration.
+ *
+ * Usage: terminate-wakeup [ITERATIONS]
+ */
+
+#include "bench.h"
+#include "event-machine.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static EM em = EM_STATIC_DEFAULT;
+static sem_t request;
+static uint64_t iterations;
+static uint64_t terminated_at;
+
+static void *terminator(void *data)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        while (sem_wait(&request) != 0)
+        {
+            ;
+        }
+
+        __atomic_store_n(&terminated_at, bench_now_ns(), __ATOMIC_RELEASE);
+        if (event_machine_terminate(&em) != EM_SUCCESS)
+        {
+            perror("event_machine_terminate");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t thread;
+    bench_samples samples;
+
+    iterations = bench_iterations(argc, argv, 100000);
+    if (iterations == 0)
+    {
+        fprintf(stderr, "Number of iterations has to be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (event_machine_init(&em) != EM_SUCCESS || sem_init(&request, 0, 0) != 0
+        || pthread_create(&thread, NULL, terminator, NULL) != 0)
+    {
+        perror("init");
+        return EXIT_FAILURE;
+    }
+    bench_samples_init(&samples, iterations);
+
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        /* Terminator may run before this thread blocks in event machine, in
+         * which case it measures fast path of an event machine that isn't
+         * waiting yet, which is also what real callers get.
+         */
+        sem_post(&request);
+        if (event_machine_run(&em) != EM_SUCCESS)
+        {
+            perror("event_machine_run");
+            return EXIT_FAILURE;
+        }
+
+        const uint64_t latency = bench_now_ns()
+            - __atomic_load_n(&terminated_at, __ATOMIC_ACQUIRE);
+        bench_samples_add(&samples, latency);
+        total += latency;
+    }
+    pthread_join(thread, NULL);
+
+    bench_report_begin("terminate-wakeup", iterations, total);
+    bench_report_percentiles(&samples);
+    bench_report_end();
+
+    bench_samples_free(&samples);
+    sem_destroy(&request);
+    event_machine_destroy(&em);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Throughput of event_timer_*() functions for timers with their own timerfd
+ * created by event_timer_create() and timers driven by timing wheel created
+ * by event_wheel_timer_create().
+ *
+ * Result "start-stop" measures one event_timer_start() followed by
+ * event_timer_stop() of a timer that didn't expire, percentiles are of such
+ * pairs. Result "expire" starts many one shot timers with 1 ms timeout and
+ * runs event machine until all of them expire, percentiles are of how late
+ * timer callbacks were invoked. Timers that expired while others were being
+ * started are late only from the moment event machine started running.
+ *
+ * Usage: timer-throughput [ITERATIONS]
+ */
+
+#include "bench.h"
+#include "event-machine.h"
+#include "event-timer.h"
+#include "event-wheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_TIMERFD_TIMERS      1000
+#define NUM_WHEEL_TIMERS        100000
+#define EXPIRE_MSEC             1
+
+struct timers
+{
+    EM em;
+    EM_wheel wheel;
+    Event_timer *timers;
+    size_t count;
+
+    size_t remaining;
+    uint64_t *deadlines;
+    uint64_t run_start;
+    bench_samples lateness;
+};
+
+static void expired(Event_timer *timer, void *data)
+{
+    struct timers *const t = data;
+    const uint64_t now = bench_now_ns();
+    const uint64_t deadline = t->deadlines[timer - t->timers] > t->run_start
+        ? t->deadlines[timer - t->timers]
+        : t->run_start;
+
+    bench_samples_add(&t->lateness, now > deadline ? now - deadline : 0);
+    if (--t->remaining == 0)
+    {
+        event_machine_terminate(&t->em);
+    }
+}
+
+static void check(uint32_t ret, const char *what)
+{
+    if (ret != EM_SUCCESS)
+    {
+        fprintf(stderr, "%s: Failed with %u.\n", what, ret);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void timers_init(struct timers *t, size_t count, bool use_wheel)
+{
+    t->em = (EM)EM_STATIC_DEFAULT;
+    t->count = count;
+    t->timers = calloc(count, sizeof(Event_timer));
+    if (t->timers == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    check(event_machine_init(&t->em), "event_machine_init");
+    if (use_wheel)
+    {
+        check(event_wheel_init(&t->em, &t->wheel, EM_WHEEL_DEFAULT_TICK_USEC),
+            "event_wheel_init");
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        check(use_wheel
+            ? event_wheel_timer_create(&t->wheel, &t->timers[i], expired, t)
+            : event_timer_create(&t->em, &t->timers[i], expired, t),
+            "timer create");
+    }
+}
+
+static void timers_destroy(struct timers *t, bool use_wheel)
+{
+    for (size_t i = 0; i < t->count; i++)
+    {
+        event_timer_destroy(&t->timers[i]);
+    }
+    if (use_wheel)
+    {
+        event_wheel_destroy(&t->wheel);
+    }
+    event_machine_destroy(&t->em);
+    free(t->timers);
+}
+
+static void start_stop(const char *name, bool use_wheel, uint64_t iterations)
+{
+    struct timers t;
+    bench_samples samples;
+
+    timers_init(&t, NUM_TIMERFD_TIMERS, use_wheel);
+    bench_samples_init(&samples, iterations);
+
+    const uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        Event_timer *const timer = &t.timers[i % t.count];
+        const uint64_t op_start = bench_now_ns();
+
+        /* Timeouts differ so that wheel timers land in different slots.
+         */
+        check(event_timer_start(timer, 1000 + (int32_t)(i % 4096), true),
+            "event_timer_start");
+        check(event_timer_stop(timer), "event_timer_stop");
+        bench_samples_add(&samples, bench_now_ns() - op_start);
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    bench_report_begin(name, iterations, elapsed);
+    bench_report_percentiles(&samples);
+    bench_report_end();
+
+    bench_samples_free(&samples);
+    timers_destroy(&t, use_wheel);
+}
+
+static void expire(const char *name, bool use_wheel, size_t count)
+{
+    struct timers t;
+
+    timers_init(&t, count, use_wheel);
+    bench_samples_init(&t.lateness, count);
+    t.deadlines = malloc(count * sizeof(uint64_t));
+    if (t.deadlines == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    t.remaining = count;
+    const uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < count; i++)
+    {
+        t.deadlines[i] = bench_now_ns() + EXPIRE_MSEC * 1000000;
+        check(event_timer_start(&t.timers[i], EXPIRE_MSEC, true),
+            "event_timer_start");
+    }
+    t.run_start = bench_now_ns();
+    check(event_machine_run(&t.em), "event_machine_run");
+    const uint64_t elapsed = bench_now_ns() - start;
+
+    bench_report_begin(name, count, elapsed);
+    bench_report_percentiles(&t.lateness);
+    bench_report_end();
+
+    bench_samples_free(&t.lateness);
+    free(t.deadlines);
+    timers_destroy(&t, use_wheel);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint64_t iterations = bench_iterations(argc, argv, 1000000);
+
+    if (iterations == 0)
+    {
+        fprintf(stderr, "Number of iterations has to be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    start_stop("timer-throughput/timerfd/start-stop", false, iterations);
+    start_stop("timer-throughput/wheel/start-stop", true, iterations);
+    expire("timer-throughput/timerfd/expire", false, NUM_TIMERFD_TIMERS);
+    expire("timer-throughput/wheel/expire", true, NUM_WHEEL_TIMERS);
+
+    return EXIT_SUCCESS;
+}
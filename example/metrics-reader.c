@@ -0,0 +1,140 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Samples stats file exported by event_machine_enable_metrics() of another
+ * process, e.g. tcp-server started with a path as its argument, and prints
+ * per second rates of main loop counters.
+ *
+ * Column "busy" is the share of time event machine spent dispatching instead
+ * of waiting for events. When it approaches 100% and "full" batches appear,
+ * event machine is saturated.
+ *
+ * Usage: metrics-reader PATH [INTERVAL_SECONDS]
+ */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199901L
+#define _POSIX_C_SOURCE 199901L
+#endif
+
+#include "event-machine.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+#define DELTA(field)    (double)(now.field - before.field)
+
+// Counters are updated by other process without any synchronization, copy is
+// taken through volatile pointer so that compiler doesn't cache them.
+void sample(const volatile EM_metrics *page, EM_metrics *metrics)
+{
+    memcpy(metrics, (const void *)page, sizeof(EM_metrics));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "Usage: %s PATH [INTERVAL_SECONDS]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const unsigned int interval = argc == 3 ? atoi(argv[2]) : 1;
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0)
+    {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    const volatile EM_metrics *page =
+        mmap(NULL, sizeof(EM_metrics), PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    if (page->magic != EM_METRICS_MAGIC || page->version != EM_METRICS_VERSION
+        || page->size != sizeof(EM_metrics))
+    {
+        fprintf(stderr, "%s: Not a stats file of this version.\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%10s %10s %6s %6s %8s %10s %10s %8s %8s %10s %10s %10s\n",
+        "iter/s", "events/s", "batch", "busy%", "full/s", "handlers/s",
+        "waits/s", "ctl/s", "read/s", "wakeups/s", "io-read/s", "io-write/s");
+
+    EM_metrics before;
+    EM_metrics now;
+
+    sample(page, &before);
+    for (;;)
+    {
+        sleep(interval > 0 ? interval : 1);
+        sample(page, &now);
+
+        // Event machine didn't finish any iteration, there is nothing new.
+        if (now.timestamp == before.timestamp)
+        {
+            printf("%10s\n", "idle");
+            continue;
+        }
+
+        const double seconds = DELTA(timestamp) / 1e9;
+        const double loop_nsec = DELTA(blocked_nsec) + DELTA(dispatch_nsec);
+
+        printf("%10.0f %10.0f %6.1f %6.1f %8.0f %10.0f %10.0f %8.0f %8.0f"
+            " %10.0f %10.0f %10.0f\n",
+            DELTA(iterations) / seconds,
+            DELTA(events) / seconds,
+            DELTA(iterations) > 0 ? DELTA(events) / DELTA(iterations) : 0,
+            loop_nsec > 0 ? 100 * DELTA(dispatch_nsec) / loop_nsec : 0,
+            DELTA(full_batches) / seconds,
+            DELTA(handler_calls) / seconds,
+            DELTA(wait_calls) / seconds,
+            DELTA(ctl_calls) / seconds,
+            DELTA(read_calls) / seconds,
+            DELTA(remote_wakeups) / seconds,
+            DELTA(io_read_calls) / seconds,
+            DELTA(io_write_calls) / seconds);
+        fflush(stdout);
+
+        before = now;
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,276 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* TCP echo server, i.e. the counterpart of tools/loadgen.c. Everything read
+ * from a connection is queued in its output queue and written back at the end
+ * of event machine iteration. If peer doesn't read fast enough and queue
+ * exceeds its high-water mark, then reading from the connection stops until
+ * queue drains to low-water mark, which is the simplest form of
+ * backpressure.
+ *
+ * Usage: tcp-echo-server [PORT]
+ */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199901L
+#define _POSIX_C_SOURCE 199901L
+#endif
+
+#include "event-listener.h"
+#include "event-machine.h"
+#include "event-output.h"
+#include "event-slab.h"
+#include "event-storage.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define BUFFER_SIZE     16384
+#define LOW_WATER       (64 * 1024)
+#define HIGH_WATER      (256 * 1024)
+
+// Payload of slab slots, see tcp-server.c example.
+struct connection
+{
+    EM_slab *slab;
+    EM_output output;
+    bool reading;
+};
+
+void close_connection(EM *em, int socket, struct connection *connection)
+{
+    EM_event_descriptor *old_ed = NULL;
+
+    event_output_destroy(&connection->output);
+    event_machine_delete(em, socket, &old_ed);
+    close(socket);
+    if (old_ed != NULL)
+    {
+        event_slab_free(connection->slab, old_ed);
+    }
+}
+
+// Stop reading while output queue is above high-water mark.
+void output_handler(EM *em, EM_output *output, EM_output_event event,
+    void *data)
+{
+    struct connection *connection = data;
+    EM_event_descriptor *ed = event_slab_descriptor(connection);
+
+    if (event == EM_OUTPUT_ERROR)
+    {
+        close_connection(em, ed->fd, connection);
+        return;
+    }
+
+    connection->reading = event == EM_OUTPUT_LOW_WATER;
+    if (connection->reading)
+    {
+        ed->events |= EPOLLIN;
+    }
+    else
+    {
+        ed->events &= ~(event_filter_t)EPOLLIN;
+    }
+    event_machine_modify(em, ed->fd, ed, NULL);
+}
+
+void connection_handler(EM *em, event_filter_t events, int socket, void *data)
+{
+    struct connection *connection = data;
+    char buffer[BUFFER_SIZE];
+
+    // Write error closes connection in output_handler().
+    if ((events & EPOLLOUT)
+        && is_em_failure(event_output_flush(&connection->output)))
+    {
+        return;
+    }
+
+    // Edge triggered, therefore read until there is nothing left.
+    while (connection->reading)
+    {
+        ssize_t length = read(socket, buffer, BUFFER_SIZE);
+
+        if (length == 0
+            || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            close_connection(em, socket, connection);
+            return;
+        }
+        if (length < 0)
+        {
+            return;
+        }
+
+        if_em_failure (event_output_write(&connection->output, buffer,
+            (size_t)length))
+        {
+            close_connection(em, socket, connection);
+            return;
+        }
+    }
+}
+
+// Invoked by listener for each accepted connection, socket is already
+// nonblocking.
+void accept_handler(EM *em, int socket, const struct sockaddr *address,
+    socklen_t address_len, void *data)
+{
+    EM_slab *slab = data;
+
+    int one = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    EM_event_descriptor *ed = event_slab_alloc(slab);
+    if (ed == NULL)
+    {
+        close(socket);
+        return;
+    }
+    struct connection *connection = ed->data;
+
+    connection->slab = slab;
+    connection->reading = true;
+    ed->events = EPOLLIN | EPOLLET;
+    ed->fd = socket;
+    ed->handler = connection_handler;
+    if (is_em_failure(event_output_init(&connection->output, em, ed))
+        || is_em_failure(event_output_set_watermarks(&connection->output,
+            LOW_WATER, HIGH_WATER, output_handler, connection))
+        || is_em_failure(event_machine_add(em, ed)))
+    {
+        close(socket);
+        event_slab_free(slab, ed);
+    }
+}
+
+void stdin_handler(EM *em, event_filter_t events, int fd, void *data)
+{
+    char buffer[256];
+
+    if (read(fd, buffer, sizeof(buffer)) <= 0)
+    {
+        event_machine_terminate(em);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const int port = argc > 1 ? atoi(argv[1]) : 4041;
+    int listening_socket;
+    EM em = EM_STATIC_DEFAULT;
+    EM_slab connections;
+    EM_listener listener;
+
+    // Write to a connection closed by peer is reported as EPIPE.
+    signal(SIGPIPE, SIG_IGN);
+
+    listening_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listening_socket < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    int one = 1;
+    setsockopt(listening_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in listening_address =
+        { .sin_family = AF_INET
+        , .sin_port = htons((uint16_t)port)
+        , .sin_addr.s_addr = inet_addr("127.0.0.1")
+        };
+    if (bind(listening_socket, (struct sockaddr *)&listening_address,
+            (socklen_t)sizeof(struct sockaddr_in))
+        || listen(listening_socket, SOMAXCONN) < 0)
+    {
+        perror("bind/listen");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(listening_socket, F_SETFL,
+        fcntl(listening_socket, F_GETFL, 0) | O_NONBLOCK);
+
+    if_em_failure (event_storage_init(&em.descriptor_storage,
+        EM_STORAGE_ARRAY))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (is_em_failure(event_machine_init(&em))
+        || is_em_failure(event_machine_set_validation(&em,
+            EM_VALIDATE_TRUSTED))
+        || is_em_failure(event_slab_init(&connections, &em,
+            sizeof(struct connection), 0)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    if_em_failure (event_listener_create(&em, &listener, listening_socket, 0,
+        0, accept_handler, &connections))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Server terminates when standard input is closed, unless it can't be
+    // polled, e.g. if it's /dev/null, in which case it runs until killed.
+    EM_event_descriptor stdin_ed =
+        { .events = EPOLLIN
+        , .fd = STDIN_FILENO
+        , .data = NULL
+        , .handler = stdin_handler
+        };
+    event_machine_add(&em, &stdin_ed);
+
+    fprintf(stderr, "Listening on 127.0.0.1:%d\n", port);
+    if_em_failure (event_machine_run(&em))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    event_listener_destroy(&listener);
+    event_machine_delete(&em, STDIN_FILENO, NULL);
+    event_machine_destroy(&em);
+    event_storage_destroy(&em.descriptor_storage);
+    event_slab_destroy(&connections);
+    close(listening_socket);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,309 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* TCP proxy that forwards connections accepted on 127.0.0.1:PORT to
+ * 127.0.0.1:UPSTREAM_PORT. Data are moved between sockets using splice(),
+ * therefore proxy never copies them to user space. Each connection is closed
+ * after both directions reached end of file or when any of them failed.
+ *
+ * Usage: tcp-proxy PORT UPSTREAM_PORT
+ */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199901L
+#define _POSIX_C_SOURCE 199901L
+#endif
+
+#include "event-machine.h"
+#include "event-splice.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+struct proxy
+{
+    EM_event_descriptor client;
+    EM_event_descriptor upstream;
+    EM_splice to_upstream;
+    EM_splice to_client;
+
+    // Number of directions that reached end of file.
+    int finished;
+    bool failed;
+    bool closed;
+};
+
+// Splice callbacks only record what happened, connection is closed by
+// proxy_handler() after it's done with both directions.
+void splice_handler(EM *em, EM_splice *splice, EM_splice_event event,
+    void *data)
+{
+    struct proxy *proxy = data;
+
+    if (event == EM_SPLICE_ERROR)
+    {
+        proxy->failed = true;
+        return;
+    }
+
+    proxy->finished++;
+    shutdown(splice->sink->fd, SHUT_WR);
+}
+
+void free_proxy(EM *em, void *data)
+{
+    free(data);
+}
+
+void close_proxy(EM *em, struct proxy *proxy)
+{
+    event_splice_destroy(&proxy->to_upstream);
+    event_splice_destroy(&proxy->to_client);
+    event_machine_delete(em, proxy->client.fd, NULL);
+    event_machine_delete(em, proxy->upstream.fd, NULL);
+    close(proxy->client.fd);
+    close(proxy->upstream.fd);
+
+    // Event of the other socket may still be waiting in the current batch
+    // and it points to this structure, therefore it's released by a task
+    // that runs after the batch.
+    proxy->closed = true;
+    if_em_failure (event_machine_post(em, free_proxy, proxy))
+    {
+        perror("event_machine_post");
+    }
+}
+
+void proxy_handler(EM *em, event_filter_t events, int socket, void *data)
+{
+    struct proxy *proxy = data;
+
+    if (proxy->closed)
+    {
+        return;
+    }
+
+    // Socket is source of one direction and sink of the other one, either
+    // of them may have been waiting for this event.
+    if (socket == proxy->client.fd)
+    {
+        event_splice_pump(&proxy->to_upstream);
+        event_splice_pump(&proxy->to_client);
+    }
+    else
+    {
+        event_splice_pump(&proxy->to_client);
+        event_splice_pump(&proxy->to_upstream);
+    }
+
+    if (proxy->failed || proxy->finished == 2)
+    {
+        close_proxy(em, proxy);
+    }
+}
+
+int connect_upstream(int port)
+{
+    struct sockaddr_in address =
+        { .sin_family = AF_INET
+        , .sin_port = htons((uint16_t)port)
+        , .sin_addr.s_addr = inet_addr("127.0.0.1")
+        };
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (socket_fd < 0)
+    {
+        return -1;
+    }
+
+    // Connecting over loopback doesn't block for long, therefore it's done
+    // synchronously for simplicity.
+    if (connect(socket_fd, (struct sockaddr *)&address,
+        (socklen_t)sizeof(struct sockaddr_in)) < 0)
+    {
+        close(socket_fd);
+        return -1;
+    }
+
+    return socket_fd;
+}
+
+void setup_socket(int socket)
+{
+    int one = 1;
+
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+}
+
+void accept_handler(EM *em, event_filter_t events, int listening_socket,
+    void *data)
+{
+    const int upstream_port = *(int *)data;
+
+    for (;;)
+    {
+        int client = accept(listening_socket, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("accept");
+            }
+            return;
+        }
+
+        int upstream = connect_upstream(upstream_port);
+        struct proxy *proxy = calloc(1, sizeof(struct proxy));
+        if (upstream < 0 || proxy == NULL)
+        {
+            perror("connect/calloc");
+            if (upstream >= 0)
+            {
+                close(upstream);
+            }
+            close(client);
+            free(proxy);
+            continue;
+        }
+        setup_socket(client);
+        setup_socket(upstream);
+
+        proxy->client = (EM_event_descriptor)
+            { .events = EPOLLIN
+            , .fd = client
+            , .data = proxy
+            , .handler = proxy_handler
+            };
+        proxy->upstream = (EM_event_descriptor)
+            { .events = EPOLLIN
+            , .fd = upstream
+            , .data = proxy
+            , .handler = proxy_handler
+            };
+
+        if (is_em_failure(event_splice_init(&proxy->to_upstream, em,
+                &proxy->client, &proxy->upstream, 0, splice_handler, proxy))
+            || is_em_failure(event_splice_init(&proxy->to_client, em,
+                &proxy->upstream, &proxy->client, 0, splice_handler, proxy))
+            || is_em_failure(event_machine_add(em, &proxy->client))
+            || is_em_failure(event_machine_add(em, &proxy->upstream)))
+        {
+            fprintf(stderr, "Unable to set up connection.\n");
+            event_machine_delete(em, client, NULL);
+            event_splice_destroy(&proxy->to_upstream);
+            event_splice_destroy(&proxy->to_client);
+            close(client);
+            close(upstream);
+            free(proxy);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int listening_socket;
+    int upstream_port;
+    EM em = EM_STATIC_DEFAULT;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s PORT UPSTREAM_PORT\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    upstream_port = atoi(argv[2]);
+
+    // Write to a connection closed by peer is reported as EPIPE.
+    signal(SIGPIPE, SIG_IGN);
+
+    listening_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listening_socket < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    int one = 1;
+    setsockopt(listening_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in listening_address =
+        { .sin_family = AF_INET
+        , .sin_port = htons((uint16_t)atoi(argv[1]))
+        , .sin_addr.s_addr = inet_addr("127.0.0.1")
+        };
+    if (bind(listening_socket, (struct sockaddr *)&listening_address,
+            (socklen_t)sizeof(struct sockaddr_in))
+        || listen(listening_socket, SOMAXCONN) < 0)
+    {
+        perror("bind/listen");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(listening_socket, F_SETFL,
+        fcntl(listening_socket, F_GETFL, 0) | O_NONBLOCK);
+
+    if_em_failure (event_machine_init(&em))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    EM_event_descriptor listening_ed =
+        { .events = EPOLLIN
+        , .fd = listening_socket
+        , .data = &upstream_port
+        , .handler = accept_handler
+        };
+    if_em_failure (event_machine_add(&em, &listening_ed))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stderr, "Forwarding 127.0.0.1:%s to 127.0.0.1:%d\n", argv[1],
+        upstream_port);
+    if_em_failure (event_machine_run(&em))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    event_machine_destroy(&em);
+    close(listening_socket);
+
+    exit(EXIT_SUCCESS);
+}
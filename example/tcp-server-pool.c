@@ -0,0 +1,181 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event-machine.h"
+#include "event-pool.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+struct connection_data
+{
+    EM_event_descriptor event_descriptor;
+    struct sockaddr_in remote_address;
+};
+
+void connection_handler(EM *em, event_filter_t events, int socket, void *data)
+{
+    struct connection_data *connection = data;
+    char read_buffer[BUFSIZ];
+    ssize_t read_len = 0;
+
+    if (events & EPOLLIN)
+    {
+        read_len = read(socket, &read_buffer, BUFSIZ - 1);
+        if (read_len > 0)
+        {
+            read_buffer[read_len] = '\0';
+            printf("%s: %s", inet_ntoa(connection->remote_address.sin_addr),
+                read_buffer);
+        }
+    }
+
+    /* Error detected or remote site disconnected.
+     */
+    if (read_len == 0 || events & EPOLLERR || events & EPOLLRDHUP)
+    {
+        if_em_failure (event_machine_delete(em, socket, NULL))
+        {
+            fprintf(stderr, "event_machine_delete(): failed.\n");
+        }
+        close(socket);
+
+        printf("%s: *** Closed connection. ***\n",
+            inet_ntoa(connection->remote_address.sin_addr));
+        free(connection);
+    }
+}
+
+// Invoked by a thread of the pool which accepted the connection. Connection
+// is registered in the same event machine, therefore it's handled by that
+// thread for its whole life.
+void accept_handler(EM *em, int socket, const struct sockaddr *address,
+    socklen_t address_len, void *data)
+{
+    struct connection_data *connection =
+        malloc(sizeof(struct connection_data));
+    if (connection == NULL)
+    {
+        perror("malloc");
+        close(socket);
+        return;
+    }
+    memcpy(&(connection->remote_address), address,
+        sizeof(struct sockaddr_in));
+
+    connection->event_descriptor.events = EVENT_READ | EPOLLRDHUP;
+    connection->event_descriptor.fd = socket;
+    connection->event_descriptor.data = connection;
+    connection->event_descriptor.handler = connection_handler;
+    if_em_failure (event_machine_add(em, &(connection->event_descriptor)))
+    {
+        fprintf(stderr, "event_machine_add(): failed.\n");
+        close(socket);
+        free(connection);
+        return;
+    }
+
+    printf("%s: *** Accepted connection. ***\n",
+        inet_ntoa(connection->remote_address.sin_addr));
+}
+
+int main()
+{
+    EM_pool pool;
+
+    // One event machine per online CPU.
+    if_em_failure (event_pool_init(&pool, 0))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Each event machine gets its own listening socket bound to the same
+    // address and kernel distributes incoming connections among them.
+    EM_pool_listener listener =
+        { .shard_mode = EM_POOL_SHARD_REUSEPORT
+        , .accept_policy = EM_POOL_ACCEPT_DRAIN
+        , .backlog = 128
+        , .handler = accept_handler
+        , .data = NULL
+        };
+    struct sockaddr_in listening_address =
+        { .sin_family = AF_INET
+        , .sin_port = htons((uint16_t)4040)
+        , .sin_addr.s_addr = inet_addr("127.0.0.1")
+        };
+    if_em_failure (event_pool_listen(&pool, &listener,
+        (struct sockaddr *)&listening_address, sizeof(listening_address)))
+    {
+        perror("event_pool_listen");
+        exit(EXIT_FAILURE);
+    }
+
+    if_em_failure (event_pool_start(&pool, true))
+    {
+        exit(EXIT_FAILURE);
+    }
+    printf("*** Serving on %zu threads, close stdin to terminate. ***\n",
+        pool.size);
+
+    // Main thread isn't part of the pool, it just waits for standard input
+    // to be closed.
+    char buffer[4096];
+    while (read(STDIN_FILENO, buffer, sizeof(buffer)) > 0)
+    {
+        ;
+    }
+
+    /* {{{ Cleanup ********************************************************* */
+
+    if_em_failure (event_pool_stop(&pool))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if_em_failure (event_pool_unlisten(&pool, &listener))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if_em_failure (event_pool_destroy(&pool))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    /* }}} Cleanup ********************************************************* */
+
+    exit(EXIT_SUCCESS);
+}
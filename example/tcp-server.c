@@ -30,8 +30,13 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "event-buffer.h"
+#include "event-listener.h"
 #include "event-machine.h"
+#include "event-slab.h"
+#include "event-storage.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <stdio.h>
@@ -42,120 +47,180 @@
 #include <unistd.h>
 
 
+/* Per event machine state shared by all connections.
+ */
+struct server
+{
+    EM_slab connections;
+
+    /* Connection holds a read buffer only while it has a partial line, idle
+     * connections cost just the slab slot.
+     */
+    EM_buffer_pool buffers;
+};
+
+/* Payload of slab slots. Each slot holds event descriptor of a connection
+ * followed by this structure.
+ */
 struct connection_data
 {
-    /* Pointer that will referre to struct "accept_connection_data" that this
-     * is part of. It will be used to free the whole data structure.
+    /* Server whose slab this connection was allocated from, it's used to
+     * release it.
      */
-    void *pointer;
+    struct server *server;
     struct sockaddr_in remote_address;
+
+    /* Incomplete line, or NULL.
+     */
+    EM_buffer *input;
 };
 
-struct accept_connection_data
+/* Connections without any activity for this long are closed.
+ */
+#define IDLE_TIMEOUT_MSEC   60000
+
+void close_connection(EM *em, int socket, void *data)
 {
-    EM_event_descriptor event_descriptor;
-    struct connection_data data;
-};
+    struct connection_data *connection = data;
+    struct sockaddr_in remote_address = connection->remote_address;
+    EM_event_descriptor *old_ed = NULL;
+
+    if_em_failure (event_machine_delete(em, socket, &old_ed))
+    {
+        // TODO print error
+        ;
+    }
+    close(socket);
+    event_buffer_release(&(connection->server->buffers), &(connection->input));
+
+    /* event_machine_delete() may return NULL if descriptor storage isn't
+     * used or if it doesn't support remove operation.
+     */
+    if (old_ed != NULL)
+    {
+        event_slab_free(&(connection->server->connections), old_ed);
+    }
+
+    printf("%s: *** Closed connection. ***\n",
+        inet_ntoa(remote_address.sin_addr));
+}
+
+void idle_handler(EM *em, int socket, void *data)
+{
+    printf("%s: *** Connection idle. ***\n",
+        inet_ntoa(((struct connection_data *)data)->remote_address.sin_addr));
+    close_connection(em, socket, data);
+}
+
+// Print complete lines, partial line stays in the buffer.
+void print_lines(struct connection_data *connection)
+{
+    char *line;
+    char *end;
+
+    while ((line = event_buffer_data(connection->input)) != NULL
+        && (end = memchr(line, '\n',
+            event_buffer_length(connection->input))) != NULL)
+    {
+        printf("%s: %.*s\n", inet_ntoa(connection->remote_address.sin_addr),
+            (int)(end - line), line);
+        event_buffer_consume(&(connection->server->buffers),
+            &(connection->input), (size_t)(end - line) + 1);
+    }
+}
 
 void connection_hadnler(EM *em, event_filter_t events, int socket, void *data)
 {
-    struct sockaddr_in remote_address =
-        ((struct connection_data *)data)->remote_address;
-    char read_buffer[BUFSIZ];
-    ssize_t read_len;
+    struct connection_data *connection = data;
+    ssize_t read_len = 1;
 
-    if (events & EPOLLIN)
+    /* Socket is edge triggered, therefore it's read until there is nothing
+     * left.
+     */
+    while (events & EPOLLIN && read_len > 0)
     {
-        memset(read_buffer, 0, BUFSIZ);
-        read_len = read(socket, &read_buffer, BUFSIZ);
-        if (read_len < 0)
+        read_len = event_buffer_read(&(connection->server->buffers),
+            &(connection->input), socket);
+        if (read_len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
         {
+            // ENOBUFS means that line doesn't fit in to a buffer.
             perror("read");
+            close_connection(em, socket, data);
             return;
         }
-        else if (read_len > 0)
-        {
-            printf("%s: %s", inet_ntoa(remote_address.sin_addr), read_buffer);
-        }
+        print_lines(connection);
     }
 
     /* Error detected or remote site disconnected.
      */
-    if (events & EPOLLERR || events & EPOLLRDHUP)
+    if (read_len == 0 || events & EPOLLERR || events & EPOLLRDHUP)
     {
-        EM_event_descriptor *old_ed;
-
-        if_em_failure (event_machine_delete(em, socket, &old_ed))
-        {
-            // TODO print error
-            ;
-        }
-        close(socket);
-
-        /* event_machine_delete() may return NULL if descriptor storage isn't
-         * used or if it doesn't support remove operation.
-         */
-        if (old_ed != NULL)
-        {
-            free(((struct connection_data *)old_ed->data)->pointer);
-        }
-
-        printf("%s: *** Closed connection. ***\n",
-            inet_ntoa(remote_address.sin_addr));
+        close_connection(em, socket, data);
     }
 }
 
-void accept_handler(EM *em, event_filter_t events, int listening_socket,
-    void *data)
+void accept_handler(EM *em, int socket, const struct sockaddr *address,
+    socklen_t address_len, void *data)
 {
-    int socket;
-    socklen_t remote_address_len = sizeof(struct sockaddr_in);
-    struct sockaddr *remote_address;
-    struct accept_connection_data *accept_data;
+    struct server *server = data;
+    struct connection_data *connection;
     EM_event_descriptor *ed;
 
-    accept_data = malloc(sizeof(struct accept_connection_data));
-    if (accept_data == NULL)
-    {
-        // TODO: Proper error handling.
-        perror("malloc");
-        return;
-    }
-    accept_data->data.pointer = (void *)accept_data;
-    ed = &(accept_data->event_descriptor);
-    remote_address = (struct sockaddr *)&(accept_data->data.remote_address);
-
-    socket = accept(listening_socket, remote_address, &remote_address_len);
-    if (socket < 0)
+    /* Slot is taken from per event machine slab, there is no malloc() on
+     * accept path. Socket is already accepted, so it has to be closed if
+     * there is no free slot.
+     */
+    ed = event_slab_alloc(&(server->connections));
+    if (ed == NULL)
     {
-        // TODO: Proper error handling.
-        perror("accept");
+        perror("event_slab_alloc");
+        close(socket);
         return;
     }
+    connection = ed->data;
+    connection->server = server;
+    memcpy(&(connection->remote_address), address,
+        sizeof(struct sockaddr_in));
 
     ed->events = EVENT_READ | EPOLLRDHUP | EPOLLET;
     ed->fd = socket;
-    ed->data = &(accept_data->data);
     ed->handler = connection_hadnler;
     if_em_failure (event_machine_add(em, ed))
     {
         // TODO: Proper error handling.
         printf("event_machine_add(): failed.\n");
+        close(socket);
+        event_slab_free(&(server->connections), ed);
         return;
     }
 
+    /* Event machine restarts the timeout whenever an event is dispatched to
+     * connection_hadnler(), there is no timer per connection.
+     */
+    if_em_failure (event_machine_set_idle_timeout(em, ed, IDLE_TIMEOUT_MSEC,
+        idle_handler))
+    {
+        // TODO: Proper error handling.
+        printf("event_machine_set_idle_timeout(): failed.\n");
+    }
+
     printf("%s: *** Accepted connection. ***\n",
-        inet_ntoa(accept_data->data.remote_address.sin_addr));
+        inet_ntoa(connection->remote_address.sin_addr));
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     int listening_socket;
 
     event_t events[EM_DEFAULT_MAX_EVENTS];
     EM em = EM_STATIC_WITH_MAX_EVENTS(EM_DEFAULT_MAX_EVENTS, events);
+    struct server server;
+    EM_listener listener;
 
-    listening_socket = socket(AF_INET, SOCK_STREAM, 0);
+    /* Listener accepts connections until there are no more of them, so the
+     * listening socket has to be nonblocking.
+     */
+    listening_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (listening_socket < 0)
     {
         perror("socket");
@@ -180,18 +245,43 @@ int main()
         exit(EXIT_FAILURE);
     }
 
+    /* Descriptor storage allows event_machine_delete() to return event
+     * descriptor of closed connection, so that it can be freed.
+     */
+    if_em_failure (event_storage_init(&em.descriptor_storage,
+        EM_STORAGE_ARRAY))
+    {
+        exit(EXIT_FAILURE);
+    }
     if_em_failure (event_machine_init(&em))
     {
         exit(EXIT_FAILURE);
     }
 
-    EM_event_descriptor ed =
-        { .events = EPOLLIN
-        , .fd = listening_socket
-        , .data = NULL
-        , .handler = accept_handler
-        };
-    if_em_failure (event_machine_add(&em, &ed))
+    /* Optional argument is a path of stats file that can be sampled using
+     * metrics-reader example.
+     */
+    if (argc > 1)
+    {
+        if_em_failure (event_machine_enable_metrics(&em, argv[1]))
+        {
+            perror("event_machine_enable_metrics");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (is_em_failure(event_slab_init(&(server.connections), &em,
+            sizeof(struct connection_data), 0))
+        || is_em_failure(event_buffer_pool_init(&(server.buffers), &em, 0,
+            0)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Listener accepts up to EM_LISTENER_DEFAULT_BUDGET connections per
+     * event, accepted sockets are already nonblocking.
+     */
+    if_em_failure (event_listener_create(&em, &listener, listening_socket, 0,
+        0, accept_handler, &server))
     {
         exit(EXIT_FAILURE);
     }
@@ -203,7 +293,7 @@ int main()
 
     /* {{{ Cleanup ********************************************************* */
 
-    if_em_failure (event_machine_delete(&em, listening_socket, NULL))
+    if_em_failure (event_listener_destroy(&listener))
     {
         exit(EXIT_FAILURE);
     }
@@ -211,6 +301,9 @@ int main()
     {
         exit(EXIT_FAILURE);
     }
+    event_storage_destroy(&em.descriptor_storage);
+    event_buffer_pool_destroy(&(server.buffers));
+    event_slab_destroy(&(server.connections));
     if (close(listening_socket) != 0)
     {
         perror("close");
@@ -0,0 +1,143 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* UDP echo server built on EM_datagram. Datagrams are received in batches
+ * using recvmmsg() and echoed back using sendmmsg(). With "gro" argument
+ * kernel may merge datagrams of one sender, they are then echoed back as one
+ * buffer that kernel splits again (UDP_SEGMENT).
+ *
+ * Server prints its counters and terminates when standard input is closed.
+ *
+ * Usage: udp-echo-server [PORT [gro]]
+ */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199901L
+#define _POSIX_C_SOURCE 199901L
+#endif
+
+#include "event-datagram.h"
+#include "event-machine.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+void echo_handler(EM *em, EM_datagram *datagram,
+    EM_datagram_message *messages, size_t count, void *data)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        // Datagram that can't be queued is dropped, which is what UDP would
+        // do anyway.
+        event_datagram_send(datagram, messages[i].data, messages[i].length,
+            messages[i].address, messages[i].address_length,
+            messages[i].segment_size);
+    }
+}
+
+void stdin_handler(EM *em, event_filter_t events, int fd, void *data)
+{
+    char buffer[256];
+
+    if (read(fd, buffer, sizeof(buffer)) <= 0)
+    {
+        event_machine_terminate(em);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const int port = argc > 1 ? atoi(argv[1]) : 4041;
+    const uint32_t flags =
+        argc > 2 && strcmp(argv[2], "gro") == 0 ? EM_DATAGRAM_GRO : 0;
+    EM em = EM_STATIC_DEFAULT;
+    EM_datagram datagram;
+
+    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_in address =
+        { .sin_family = AF_INET
+        , .sin_port = htons((uint16_t)port)
+        , .sin_addr.s_addr = inet_addr("127.0.0.1")
+        };
+    if (bind(socket_fd, (struct sockaddr *)&address,
+            (socklen_t)sizeof(struct sockaddr_in)) < 0)
+    {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if (is_em_failure(event_machine_init(&em))
+        || is_em_failure(event_datagram_create(&em, &datagram, socket_fd, 0,
+            0, flags, echo_handler, NULL)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    EM_event_descriptor stdin_ed =
+        { .events = EPOLLIN
+        , .fd = STDIN_FILENO
+        , .data = NULL
+        , .handler = stdin_handler
+        };
+    event_machine_add(&em, &stdin_ed);
+
+    fprintf(stderr, "Listening on 127.0.0.1:%d%s\n", port,
+        datagram.gro ? " with GRO" : "");
+    if_em_failure (event_machine_run(&em))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("received %" PRIu64 ", sent %" PRIu64 ", dropped %" PRIu64 "\n",
+        datagram.received, datagram.sent, datagram.dropped);
+
+    event_machine_delete(&em, STDIN_FILENO, NULL);
+    event_datagram_destroy(&datagram);
+    event_machine_destroy(&em);
+    close(socket_fd);
+
+    exit(EXIT_SUCCESS);
+}
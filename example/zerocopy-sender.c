@@ -0,0 +1,271 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Sends data over loopback TCP connection using event_zerocopy_send() and
+ * receives them in the same event machine. Each of a few large buffers is
+ * sent again as soon as kernel releases it, preceded by a small header that
+ * is below the threshold and therefore copied.
+ *
+ * On loopback kernel copies data anyway, which is reported by completions,
+ * but the whole completion path is exercised.
+ *
+ * Usage: zerocopy-sender [MEGABYTES]
+ */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199901L
+#define _POSIX_C_SOURCE 199901L
+#endif
+
+#include "event-machine.h"
+#include "event-zerocopy.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define NUM_BUFFERS     4
+#define BUFFER_SIZE     (1024 * 1024)
+
+struct transfer
+{
+    EM_zerocopy zerocopy;
+    char header[64];
+    char *buffers[NUM_BUFFERS];
+    uint64_t total;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t released;
+};
+
+// Send header and one payload buffer, unless everything was sent already.
+void send_buffer(EM *em, struct transfer *transfer, size_t i)
+{
+    if (transfer->sent >= transfer->total)
+    {
+        return;
+    }
+    transfer->sent += sizeof(transfer->header) + BUFFER_SIZE;
+
+    if (is_em_failure(event_zerocopy_send(&transfer->zerocopy,
+            transfer->header, sizeof(transfer->header), NULL))
+        || is_em_failure(event_zerocopy_send(&transfer->zerocopy,
+            transfer->buffers[i], BUFFER_SIZE, transfer->buffers[i])))
+    {
+        perror("event_zerocopy_send");
+        event_machine_terminate(em);
+    }
+}
+
+// Kernel is done with the buffer, it's reused for the next send.
+void release_handler(EM *em, EM_zerocopy *zerocopy, const void *buffer,
+    size_t length, bool copied, void *data)
+{
+    // Sender is the first member of struct transfer.
+    struct transfer *transfer = (struct transfer *)zerocopy;
+
+    transfer->released++;
+    if (data != NULL)
+    {
+        for (size_t i = 0; i < NUM_BUFFERS; i++)
+        {
+            if (transfer->buffers[i] == data)
+            {
+                send_buffer(em, transfer, i);
+            }
+        }
+    }
+}
+
+void sender_handler(EM *em, event_filter_t events, int fd, void *data)
+{
+    struct transfer *transfer = data;
+
+    if_em_failure (event_zerocopy_handle(&transfer->zerocopy, events))
+    {
+        perror("event_zerocopy_handle");
+        event_machine_terminate(em);
+    }
+}
+
+void receiver_handler(EM *em, event_filter_t events, int fd, void *data)
+{
+    struct transfer *transfer = data;
+    static char buffer[65536];
+
+    for (;;)
+    {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+
+        if (length <= 0)
+        {
+            if (length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                event_machine_terminate(em);
+            }
+            return;
+        }
+        transfer->received += (uint64_t)length;
+        if (transfer->received >= transfer->total)
+        {
+            event_machine_terminate(em);
+            return;
+        }
+    }
+}
+
+// Connected pair of nonblocking loopback TCP sockets.
+int connect_pair(int *sender, int *receiver)
+{
+    struct sockaddr_in address =
+        { .sin_family = AF_INET
+        , .sin_port = 0
+        , .sin_addr.s_addr = inet_addr("127.0.0.1")
+        };
+    socklen_t address_length = sizeof(address);
+    int listening_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listening_socket < 0
+        || bind(listening_socket, (struct sockaddr *)&address,
+            sizeof(address)) < 0
+        || listen(listening_socket, 1) < 0
+        || getsockname(listening_socket, (struct sockaddr *)&address,
+            &address_length) < 0
+        || (*sender = socket(AF_INET, SOCK_STREAM, 0)) < 0
+        || connect(*sender, (struct sockaddr *)&address, sizeof(address)) < 0
+        || (*receiver = accept(listening_socket, NULL, NULL)) < 0)
+    {
+        return -1;
+    }
+    close(listening_socket);
+    fcntl(*sender, F_SETFL, fcntl(*sender, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(*receiver, F_SETFL, fcntl(*receiver, F_GETFL, 0) | O_NONBLOCK);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    EM em = EM_STATIC_DEFAULT;
+    static struct transfer transfer;
+    int sender;
+    int receiver;
+    struct timespec start;
+    struct timespec end;
+
+    transfer.total = (argc > 1 ? strtoull(argv[1], NULL, 10) : 1024)
+        * 1024 * 1024;
+    memset(transfer.header, 'h', sizeof(transfer.header));
+    for (size_t i = 0; i < NUM_BUFFERS; i++)
+    {
+        transfer.buffers[i] = malloc(BUFFER_SIZE);
+        if (transfer.buffers[i] == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        memset(transfer.buffers[i], 'a' + (int)i, BUFFER_SIZE);
+    }
+
+    if (connect_pair(&sender, &receiver) < 0)
+    {
+        perror("connect_pair");
+        exit(EXIT_FAILURE);
+    }
+    if_em_failure (event_machine_init(&em))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // EPOLLERR, that signals completions, is always reported.
+    EM_event_descriptor sender_ed =
+        { .events = 0
+        , .fd = sender
+        , .data = &transfer
+        , .handler = sender_handler
+        };
+    EM_event_descriptor receiver_ed =
+        { .events = EPOLLIN
+        , .fd = receiver
+        , .data = &transfer
+        , .handler = receiver_handler
+        };
+    if (is_em_failure(event_machine_add(&em, &sender_ed))
+        || is_em_failure(event_machine_add(&em, &receiver_ed))
+        || is_em_failure(event_zerocopy_init(&transfer.zerocopy, &em,
+            &sender_ed, 0, release_handler)))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (!transfer.zerocopy.enabled)
+    {
+        fprintf(stderr, "SO_ZEROCOPY isn't supported, data are copied.\n");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < NUM_BUFFERS; i++)
+    {
+        send_buffer(&em, &transfer, i);
+    }
+    if_em_failure (event_machine_run(&em))
+    {
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    const double seconds = (double)(end.tv_sec - start.tv_sec)
+        + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("received %" PRIu64 " bytes in %.3f s (%.1f MB/s), %" PRIu64
+        " buffers released, %" PRIu64 " copied by kernel\n",
+        transfer.received, seconds, (double)transfer.received / seconds / 1e6,
+        transfer.released, transfer.zerocopy.copied);
+
+    event_machine_delete(&em, sender, NULL);
+    event_machine_delete(&em, receiver, NULL);
+    close(sender);
+    close(receiver);
+    event_zerocopy_destroy(&transfer.zerocopy);
+    event_machine_destroy(&em);
+    for (size_t i = 0; i < NUM_BUFFERS; i++)
+    {
+        free(transfer.buffers[i]);
+    }
+
+    exit(EXIT_SUCCESS);
+}
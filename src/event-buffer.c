@@ -0,0 +1,271 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-buffer.h"
+#include "event-machine/buffer-internal.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Trimming doesn't need precise time, coarse clock is cheaper where it's
+ * available.
+ */
+#ifdef CLOCK_MONOTONIC_COARSE
+#define TRIM_CLOCK  CLOCK_MONOTONIC_COARSE
+#else
+#define TRIM_CLOCK  CLOCK_MONOTONIC
+#endif
+
+
+static inline uint64_t trim_clock_nsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(TRIM_CLOCK, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static EM_buffer *acquire(EM_buffer_pool *const pool)
+{
+    EM_buffer *buffer = pool->free_list;
+
+    if_null (buffer)
+    {
+        buffer = malloc(sizeof(EM_buffer) + pool->buffer_size);
+        if_null (buffer)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    else
+    {
+        pool->free_list = buffer->next;
+        pool->free_count--;
+    }
+
+    buffer->next = NULL;
+    buffer->begin = 0;
+    buffer->end = 0;
+    pool->in_use++;
+    if (pool->in_use > pool->peak)
+    {
+        pool->peak = pool->in_use;
+    }
+
+    return buffer;
+}
+
+static inline void put_back(EM_buffer_pool *const pool,
+    EM_buffer *const buffer)
+{
+    buffer->next = pool->free_list;
+    pool->free_list = buffer;
+    pool->free_count++;
+    pool->in_use--;
+}
+
+uint32_t event_buffer_pool_init(EM_buffer_pool *const pool, EM *const em,
+    const size_t buffer_size, const uint32_t trim_msec)
+{
+    if (null(pool) || null(em))
+    {
+        return EM_ERROR_NULL;
+    }
+    if_not_null (em->buffer_pool)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    pool->event_machine = em;
+    pool->buffer_size =
+        buffer_size == 0 ? EM_BUFFER_DEFAULT_SIZE : buffer_size;
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool->in_use = 0;
+    pool->peak = 0;
+    pool->trim_interval = (uint64_t)(trim_msec == 0
+        ? EM_BUFFER_DEFAULT_TRIM_MSEC : trim_msec) * 1000000;
+    pool->last_trim = trim_clock_nsec();
+
+    em->buffer_pool = pool;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_buffer_pool_destroy(EM_buffer_pool *const pool)
+{
+    if_null (pool)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    event_buffer_pool_trim(pool, 0);
+    if (not_null(pool->event_machine)
+        && pool->event_machine->buffer_pool == pool)
+    {
+        pool->event_machine->buffer_pool = NULL;
+    }
+    pool->event_machine = NULL;
+
+    return EM_SUCCESS;
+}
+
+void event_buffer_pool_trim(EM_buffer_pool *const pool, const size_t keep)
+{
+    while (pool->free_count > keep)
+    {
+        EM_buffer *const buffer = pool->free_list;
+
+        pool->free_list = buffer->next;
+        pool->free_count--;
+        free(buffer);
+    }
+}
+
+ssize_t event_buffer_read(EM_buffer_pool *const pool,
+    EM_buffer **const buffer, const int fd)
+{
+    EM_buffer *b = *buffer;
+
+    if_null (b)
+    {
+        b = acquire(pool);
+        if_null (b)
+        {
+            return -1;
+        }
+    }
+    else if (b->end == pool->buffer_size)
+    {
+        if_zero (b->begin)
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+        memmove(b->data, b->data + b->begin, b->end - b->begin);
+        b->end -= b->begin;
+        b->begin = 0;
+    }
+
+    EM_METRICS_INC(pool->event_machine, io_read_calls);
+    const ssize_t length =
+        read(fd, b->data + b->end, pool->buffer_size - b->end);
+    if (length > 0)
+    {
+        b->end += (size_t)length;
+        *buffer = b;
+    }
+    else if (b->begin == b->end)
+    {
+        /* Nothing was read and nothing is waiting to be consumed, buffer
+         * isn't needed until the next read.
+         */
+        put_back(pool, b);
+        *buffer = NULL;
+    }
+
+    return length;
+}
+
+void event_buffer_consume(EM_buffer_pool *const pool,
+    EM_buffer **const buffer, const size_t length)
+{
+    EM_buffer *const b = *buffer;
+
+    if_null (b)
+    {
+        return;
+    }
+
+    b->begin += length < b->end - b->begin ? length : b->end - b->begin;
+    if (b->begin == b->end)
+    {
+        put_back(pool, b);
+        *buffer = NULL;
+    }
+}
+
+void event_buffer_release(EM_buffer_pool *const pool,
+    EM_buffer **const buffer)
+{
+    if_not_null (*buffer)
+    {
+        put_back(pool, *buffer);
+        *buffer = NULL;
+    }
+}
+
+int em_buffer_pool_wait_timeout(EM *const em, const int timeout)
+{
+    EM_buffer_pool *const pool = em->buffer_pool;
+
+    if (null(pool) || pool->free_count == 0 || timeout == 0)
+    {
+        return timeout;
+    }
+
+    const uint64_t now = trim_clock_nsec();
+    const uint64_t deadline = pool->last_trim + pool->trim_interval;
+    const uint64_t msec =
+        deadline <= now ? 0 : (deadline - now + 999999) / 1000000;
+    const int trim_timeout = msec > INT_MAX ? INT_MAX : (int)msec;
+
+    return timeout < 0 || trim_timeout < timeout ? trim_timeout : timeout;
+}
+
+void em_buffer_pool_maintain(EM *const em)
+{
+    EM_buffer_pool *const pool = em->buffer_pool;
+    const uint64_t now = trim_clock_nsec();
+
+    if (now - pool->last_trim < pool->trim_interval)
+    {
+        return;
+    }
+
+    /* Keep as many buffers as were in use at the peak of the last interval,
+     * that's how many will likely be needed during the next one.
+     */
+    event_buffer_pool_trim(pool,
+        pool->peak > pool->in_use ? pool->peak - pool->in_use : 0);
+    pool->peak = pool->in_use;
+    pool->last_trim = now;
+}
@@ -0,0 +1,256 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-buffer.h
+ * Pool of read buffers shared by all connections of an event machine.
+ *
+ * Server that keeps one read buffer per connection needs memory
+ * proportional to the number of connections, even if most of them are idle
+ * most of the time, which is typical for long polling or WebSocket
+ * connections. With #EM_buffer_pool a connection holds only a pointer to
+ * #EM_buffer, which is <tt>NULL</tt> while there are no unconsumed data.
+ * event_buffer_read() takes a buffer from the pool when it's needed and
+ * event_buffer_consume() returns it as soon as all data in it were
+ * consumed, therefore memory is proportional to the number of connections
+ * with partially parsed input.
+ *
+ * Released buffers are kept on a free list for reuse. Once per trim interval
+ * event machine frees free buffers that weren't needed during the previous
+ * interval, i.e. it keeps only as many buffers as were in use at the peak.
+ * While there are free buffers, event machine doesn't block for longer than
+ * until the next trim, so that memory is returned even when it's idle.
+ *
+ * Pool is tied to one event machine and there is no locking. It has to be
+ * used only by the thread that runs that event machine. Each event machine
+ * can have at most one pool.
+ *
+ * Usage example can be found here: @link example/tcp-server.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_BUFFER_H_176409215388610476395813726046253148861
+#define EVENT_BUFFER_H_176409215388610476395813726046253148861
+
+#include "event-machine.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of buffers in bytes if zero is passed to event_buffer_pool_init().
+ */
+#define EM_BUFFER_DEFAULT_SIZE          16384
+
+/** Trim interval in milliseconds if zero is passed to
+ * event_buffer_pool_init().
+ */
+#define EM_BUFFER_DEFAULT_TRIM_MSEC     1000
+
+/** Read buffer taken from #EM_buffer_pool.
+ */
+typedef struct EM_buffer_s
+{
+    /** Link of the free list.
+     */
+    struct EM_buffer_s *next;
+
+    /** Data between begin and end weren't consumed yet, space after end is
+     * available for following reads.
+     */
+    size_t begin;
+    size_t end;
+
+    char data[];
+} EM_buffer;
+
+/** Pool of read buffers. Its fields are private, use functions declared
+ * below.
+ */
+typedef struct EM_buffer_pool_s
+{
+    /** Event machine this pool is tied to.
+     */
+    EM *event_machine;
+
+    /** Size of data in each buffer.
+     */
+    size_t buffer_size;
+
+    /** Released buffers linked through their <tt>next</tt> field, most
+     * recently released first.
+     */
+    EM_buffer *free_list;
+    size_t free_count;
+
+    /** Number of buffers attached to file descriptors.
+     */
+    size_t in_use;
+
+    /** Maximum of <tt>in_use</tt> since the last trim.
+     */
+    size_t peak;
+
+    /** Trim interval and time of the last trim in nanoseconds.
+     */
+    uint64_t trim_interval;
+    uint64_t last_trim;
+} EM_buffer_pool;
+
+/** Initialize pool and attach it to event machine.
+ *
+ * @param[out] pool
+ *   Pool structure to initialize.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine.
+ *
+ * @param[in] buffer_size
+ *   Size of each buffer, 0 means #EM_BUFFER_DEFAULT_SIZE.
+ *
+ * @param[in] trim_msec
+ *   How often are unneeded free buffers released, 0 means
+ *   #EM_BUFFER_DEFAULT_TRIM_MSEC.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if event machine already has a
+ *   pool.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_buffer_pool_init(EM_buffer_pool *pool, EM *event_machine,
+    size_t buffer_size, uint32_t trim_msec);
+
+/** Detach pool from event machine and free all free buffers. Buffers that
+ * are still attached to file descriptors have to be released using
+ * event_buffer_release() first, otherwise they are leaked.
+ *
+ * @param[in] pool
+ *   Pool initialized by event_buffer_pool_init().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_buffer_pool_destroy(EM_buffer_pool *pool);
+
+/** Free free buffers, except for <tt>keep</tt> of them. It's done
+ * automatically once per trim interval, calling it explicitly is useful
+ * e.g. after a burst of connections was closed.
+ *
+ * @param[in] pool
+ *   Pool initialized by event_buffer_pool_init().
+ *
+ * @param[in] keep
+ *   How many free buffers are kept.
+ */
+void event_buffer_pool_trim(EM_buffer_pool *pool, size_t keep);
+
+/** Read from file descriptor in to a buffer. If <tt>*buffer</tt> is
+ * <tt>NULL</tt>, then a buffer is taken from the pool first, and if nothing
+ * was read in to an empty buffer, then it's returned to the pool right away
+ * and <tt>*buffer</tt> is set to <tt>NULL</tt> again.
+ *
+ * Unconsumed data are moved to the beginning of the buffer if there is no
+ * space after them.
+ *
+ * @param[in] pool
+ *   Pool initialized by event_buffer_pool_init().
+ *
+ * @param[in,out] buffer
+ *   Buffer of a file descriptor, <tt>NULL</tt> if it has none.
+ *
+ * @param[in] fd
+ *   File descriptor to read from.
+ *
+ * @return
+ *   Value returned by <tt>read()</tt>. If buffer couldn't be allocated it
+ *   returns -1 and sets <tt>errno</tt> to <tt>ENOMEM</tt>, if buffer is full
+ *   of unconsumed data it returns -1 and sets <tt>errno</tt> to
+ *   <tt>ENOBUFS</tt>.
+ */
+ssize_t event_buffer_read(EM_buffer_pool *pool, EM_buffer **buffer, int fd);
+
+/** Mark data at the beginning of a buffer as consumed. Buffer is returned to
+ * the pool when there are no unconsumed data left and <tt>*buffer</tt> is set
+ * to <tt>NULL</tt>.
+ *
+ * @param[in] pool
+ *   Pool initialized by event_buffer_pool_init().
+ *
+ * @param[in,out] buffer
+ *   Buffer filled by event_buffer_read(), it may be <tt>NULL</tt> if
+ *   <tt>length</tt> is zero.
+ *
+ * @param[in] length
+ *   Number of consumed bytes, at most event_buffer_length().
+ */
+void event_buffer_consume(EM_buffer_pool *pool, EM_buffer **buffer,
+    size_t length);
+
+/** Return buffer to the pool regardless of unconsumed data in it, e.g. when
+ * connection is closed. Sets <tt>*buffer</tt> to <tt>NULL</tt>.
+ *
+ * @param[in] pool
+ *   Pool initialized by event_buffer_pool_init().
+ *
+ * @param[in,out] buffer
+ *   Buffer of a file descriptor, it may be <tt>NULL</tt>.
+ */
+void event_buffer_release(EM_buffer_pool *pool, EM_buffer **buffer);
+
+/** Unconsumed data of a buffer, <tt>NULL</tt> if there is no buffer.
+ */
+static inline char *event_buffer_data(EM_buffer *buffer)
+{
+    return buffer == NULL ? NULL : buffer->data + buffer->begin;
+}
+
+/** Number of unconsumed bytes in a buffer, 0 if there is no buffer.
+ */
+static inline size_t event_buffer_length(const EM_buffer *buffer)
+{
+    return buffer == NULL ? 0 : buffer->end - buffer->begin;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_BUFFER_H_176409215388610476395813726046253148861 */
@@ -0,0 +1,458 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-datagram.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP         17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT     103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO         104
+#endif
+
+/* Size of control message buffers of one datagram. Kernel reports GRO
+ * segment size as int, while GSO segment size is passed as uint16_t.
+ */
+#define RX_CONTROL_SIZE     CMSG_SPACE(sizeof(int))
+#define TX_CONTROL_SIZE     CMSG_SPACE(sizeof(uint16_t))
+
+
+/* Take aligned block of memory from the single allocation.
+ */
+static inline void *carve(char **const cursor, const size_t size)
+{
+    void *const block = (*cursor);
+
+    (*cursor) += (size + 15) & ~(size_t)15;
+
+    return block;
+}
+
+static inline size_t carved_size(const size_t size)
+{
+    return (size + 15) & ~(size_t)15;
+}
+
+static void internal_datagram_handler(EM *em, event_filter_t events, int fd,
+    void *data);
+
+/* Set up message headers, each of them owns its buffer, address and control
+ * message buffer for the whole lifetime of datagram socket.
+ */
+static void init_headers(struct mmsghdr *const headers, const size_t batch,
+    const size_t message_size, struct iovec *const iov,
+    struct sockaddr_storage *const addresses, char *const control,
+    const size_t control_size, char *const buffers)
+{
+    for (size_t i = 0; i < batch; i++)
+    {
+        iov[i].iov_base = buffers + i * message_size;
+        iov[i].iov_len = message_size;
+        headers[i].msg_hdr.msg_iov = &iov[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+        headers[i].msg_hdr.msg_name = &addresses[i];
+        headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        headers[i].msg_hdr.msg_control = control + i * control_size;
+        headers[i].msg_hdr.msg_controllen = 0;
+        headers[i].msg_hdr.msg_flags = 0;
+        headers[i].msg_len = 0;
+    }
+}
+
+uint32_t event_datagram_create(EM *const em, EM_datagram *const datagram,
+    const int fd, const size_t batch, const size_t message_size,
+    const uint32_t flags, const EM_datagram_handler handler, void *const data)
+{
+    if (null(em) || null(datagram))
+    {
+        return EM_ERROR_NULL;
+    }
+    if_invalid_fd (fd)
+    {
+        return EM_ERROR_BADFD;
+    }
+    if_null (handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+    if (message_size > EM_DATAGRAM_MAX_SIZE)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    memset(datagram, 0, sizeof(EM_datagram));
+    datagram->event_machine = em;
+    datagram->handler = handler;
+    datagram->data = data;
+    datagram->batch = batch == 0 ? EM_DATAGRAM_DEFAULT_BATCH : batch;
+
+    if (flags & EM_DATAGRAM_GRO)
+    {
+        const int one = 1;
+
+        datagram->gro =
+            setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+    }
+    datagram->message_size = message_size != 0 ? message_size
+        : datagram->gro ? EM_DATAGRAM_MAX_SIZE : EM_DATAGRAM_DEFAULT_SIZE;
+
+    const size_t n = datagram->batch;
+    const size_t size = datagram->message_size;
+    const size_t side_size = carved_size(n * sizeof(struct mmsghdr))
+        + carved_size(n * sizeof(struct iovec))
+        + carved_size(n * sizeof(struct sockaddr_storage))
+        + carved_size(n * size);
+    char *cursor = malloc(2 * side_size
+        + carved_size(n * RX_CONTROL_SIZE) + carved_size(n * TX_CONTROL_SIZE)
+        + carved_size(n * sizeof(EM_datagram_message)));
+
+    if_null (cursor)
+    {
+        return EM_ERROR_MALLOC;
+    }
+    datagram->memory = cursor;
+
+    datagram->rx = carve(&cursor, n * sizeof(struct mmsghdr));
+    struct iovec *const rx_iov = carve(&cursor, n * sizeof(struct iovec));
+    struct sockaddr_storage *const rx_addresses =
+        carve(&cursor, n * sizeof(struct sockaddr_storage));
+    char *const rx_control = carve(&cursor, n * RX_CONTROL_SIZE);
+    char *const rx_buffers = carve(&cursor, n * size);
+    datagram->messages = carve(&cursor, n * sizeof(EM_datagram_message));
+
+    datagram->tx = carve(&cursor, n * sizeof(struct mmsghdr));
+    struct iovec *const tx_iov = carve(&cursor, n * sizeof(struct iovec));
+    struct sockaddr_storage *const tx_addresses =
+        carve(&cursor, n * sizeof(struct sockaddr_storage));
+    char *const tx_control = carve(&cursor, n * TX_CONTROL_SIZE);
+    char *const tx_buffers = carve(&cursor, n * size);
+
+    init_headers(datagram->rx, n, size, rx_iov, rx_addresses, rx_control,
+        RX_CONTROL_SIZE, rx_buffers);
+    init_headers(datagram->tx, n, size, tx_iov, tx_addresses, tx_control,
+        TX_CONTROL_SIZE, tx_buffers);
+
+    datagram->event_descriptor.events = EVENT_READ;
+    datagram->event_descriptor.fd = fd;
+    datagram->event_descriptor.data = datagram;
+    datagram->event_descriptor.handler = internal_datagram_handler;
+
+    uint32_t ret = event_machine_add(em, &(datagram->event_descriptor));
+    if_em_failure (ret)
+    {
+        const int saved_errno = errno;
+
+        free(datagram->memory);
+        datagram->memory = NULL;
+        errno = saved_errno;
+    }
+
+    return ret;
+}
+
+uint32_t event_datagram_destroy(EM_datagram *const datagram)
+{
+    if_null (datagram)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    /* Last argument is NULL, because event descriptor is part of
+     * EM_datagram structure.
+     */
+    const uint32_t ret = event_machine_delete(datagram->event_machine,
+        datagram->event_descriptor.fd, NULL);
+
+    free(datagram->memory);
+    datagram->memory = NULL;
+    datagram->tx_count = 0;
+
+    return ret;
+}
+
+static uint32_t set_write_enabled(EM_datagram *const datagram,
+    const bool enable)
+{
+    EM_event_descriptor *const ed = &(datagram->event_descriptor);
+
+    if (datagram->write_enabled == enable)
+    {
+        return EM_SUCCESS;
+    }
+
+    if (enable)
+    {
+        ed->events |= EVENT_WRITE;
+    }
+    else
+    {
+        ed->events &= ~(event_filter_t)EVENT_WRITE;
+    }
+    ret_em_failure(event_machine_modify(datagram->event_machine, ed->fd, ed,
+        NULL));
+    datagram->write_enabled = enable;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_datagram_flush(EM_datagram *const datagram)
+{
+    if_null (datagram)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    EM *const em = datagram->event_machine;
+    const int fd = datagram->event_descriptor.fd;
+
+    while (datagram->tx_count > 0)
+    {
+        EM_METRICS_INC(em, io_write_calls);
+        const int n = sendmmsg(fd, datagram->tx + datagram->tx_head,
+            (unsigned int)datagram->tx_count, MSG_DONTWAIT);
+
+        if_negative (n)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+
+            /* Error belongs to the first datagram, e.g. it was too big or
+             * destination of connected socket is unreachable.
+             */
+            datagram->dropped++;
+            datagram->tx_head++;
+            datagram->tx_count--;
+            continue;
+        }
+        datagram->sent += (uint64_t)n;
+        datagram->tx_head += (size_t)n;
+        datagram->tx_count -= (size_t)n;
+    }
+    if_zero (datagram->tx_count)
+    {
+        datagram->tx_head = 0;
+    }
+
+    return set_write_enabled(datagram, datagram->tx_count > 0);
+}
+
+/* Move queued datagrams to the beginning of send queue. Headers are swapped,
+ * not copied, so that each of them keeps its own buffers.
+ */
+static void compact(EM_datagram *const datagram)
+{
+    for (size_t i = 0; i < datagram->tx_count; i++)
+    {
+        const struct mmsghdr header = datagram->tx[i];
+
+        datagram->tx[i] = datagram->tx[datagram->tx_head + i];
+        datagram->tx[datagram->tx_head + i] = header;
+    }
+    datagram->tx_head = 0;
+}
+
+uint32_t event_datagram_send(EM_datagram *const datagram,
+    const void *const buffer, const size_t length,
+    const struct sockaddr *const address, const socklen_t address_length,
+    const uint16_t segment_size)
+{
+    if_null (datagram)
+    {
+        return EM_ERROR_NULL;
+    }
+    if (null(buffer) && length > 0)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if (length > datagram->message_size
+        || address_length > sizeof(struct sockaddr_storage))
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    if (datagram->tx_head + datagram->tx_count == datagram->batch)
+    {
+        if (not(datagram->write_enabled))
+        {
+            ret_em_failure(event_datagram_flush(datagram));
+        }
+        if (datagram->tx_count == datagram->batch)
+        {
+            datagram->dropped++;
+            errno = EAGAIN;
+
+            return EM_ERROR_WRITE;
+        }
+        compact(datagram);
+    }
+
+    struct msghdr *const header =
+        &(datagram->tx[datagram->tx_head + datagram->tx_count].msg_hdr);
+
+    memcpy(header->msg_iov->iov_base, buffer, length);
+    header->msg_iov->iov_len = length;
+
+    /* Kernel ignores address if its length is zero.
+     */
+    header->msg_namelen = null(address) ? 0 : address_length;
+    if_not_null (address)
+    {
+        memcpy(header->msg_name, address, address_length);
+    }
+
+    header->msg_controllen = 0;
+    if_not_zero (segment_size)
+    {
+        header->msg_controllen = TX_CONTROL_SIZE;
+
+        struct cmsghdr *const cmsg = CMSG_FIRSTHDR(header);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(uint16_t));
+    }
+    datagram->tx_count++;
+
+    return EM_SUCCESS;
+}
+
+/* Segment size of datagrams merged by GRO, or 0.
+ */
+static uint16_t gro_segment_size(struct msghdr *const header)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); not_null(cmsg);
+        cmsg = CMSG_NXTHDR(header, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+        {
+            int size;
+
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(int));
+
+            return (uint16_t)size;
+        }
+    }
+
+    return 0;
+}
+
+static void internal_datagram_handler(EM *em, event_filter_t events, int fd,
+    void *data)
+{
+    EM_datagram *const datagram = data;
+    const size_t batch = datagram->batch;
+    const socklen_t control_size = datagram->gro ? RX_CONTROL_SIZE : 0;
+
+    if (events & EVENT_WRITE)
+    {
+        event_datagram_flush(datagram);
+    }
+
+    for (int round = 0; round < EM_DATAGRAM_MAX_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < batch; i++)
+        {
+            datagram->rx[i].msg_hdr.msg_namelen =
+                sizeof(struct sockaddr_storage);
+            datagram->rx[i].msg_hdr.msg_controllen = control_size;
+        }
+
+        EM_METRICS_INC(em, io_read_calls);
+        const int n = recvmmsg(fd, datagram->rx, (unsigned int)batch,
+            MSG_DONTWAIT, NULL);
+        if_negative (n)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            /* EAGAIN, or error of connected socket reported by ICMP, which
+             * is consumed by this call.
+             */
+            break;
+        }
+        if_zero (n)
+        {
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct msghdr *const header = &(datagram->rx[i].msg_hdr);
+            EM_datagram_message *const message = &(datagram->messages[i]);
+
+            message->data = header->msg_iov->iov_base;
+            message->length = datagram->rx[i].msg_len;
+            message->address = header->msg_name;
+            message->address_length = header->msg_namelen;
+            message->segment_size =
+                control_size > 0 ? gro_segment_size(header) : 0;
+        }
+        datagram->received += (uint64_t)n;
+
+        datagram->handler(em, datagram, datagram->messages, (size_t)n,
+            datagram->data);
+
+        if ((size_t)n < batch)
+        {
+            break;
+        }
+    }
+
+    /* Replies produced by the handler are sent together.
+     */
+    if (datagram->tx_count > 0 && not(datagram->write_enabled))
+    {
+        event_datagram_flush(datagram);
+    }
+}
@@ -0,0 +1,312 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-datagram.h
+ * Batched receiving and sending of datagrams.
+ *
+ * #EM_datagram registers a datagram socket in event machine and when it's
+ * readable, it receives up to <tt>batch</tt> datagrams using one
+ * <tt>recvmmsg()</tt> call in to preallocated buffers and passes all of them
+ * to #EM_datagram_handler at once. Datagrams queued by event_datagram_send()
+ * are copied in to preallocated buffers as well and sent using one
+ * <tt>sendmmsg()</tt> call after the handler returns, when the queue is
+ * full, or when event_datagram_flush() is called. If socket isn't writable,
+ * <tt>EVENT_WRITE</tt> is enabled until the queue is sent.
+ *
+ * With #EM_DATAGRAM_GRO kernel may merge consecutive datagrams of the same
+ * flow in to one buffer, whose <tt>segment_size</tt> tells where individual
+ * datagrams end. Conversely, passing nonzero <tt>segment_size</tt> to
+ * event_datagram_send() lets kernel split one buffer in to datagrams
+ * (<tt>UDP_SEGMENT</tt>), which is much cheaper than sending them one by one.
+ *
+ * Available only on Linux with <tt>epoll</tt> or <tt>io_uring</tt> backend.
+ *
+ * Usage example can be found here:
+ * @link example/udp-echo-server.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_DATAGRAM_H_20884330637108945916212480563140172251
+#define EVENT_DATAGRAM_H_20884330637108945916212480563140172251
+
+#include "event-machine.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of datagrams received or sent at once if zero is passed to
+ * event_datagram_create().
+ */
+#define EM_DATAGRAM_DEFAULT_BATCH       64
+
+/** Size of receive and send buffers if zero is passed to
+ * event_datagram_create(). With #EM_DATAGRAM_GRO it's
+ * #EM_DATAGRAM_MAX_SIZE instead, because merged datagrams can be that big.
+ */
+#define EM_DATAGRAM_DEFAULT_SIZE        2048
+
+/** Maximum size of UDP payload.
+ */
+#define EM_DATAGRAM_MAX_SIZE            65535
+
+/** Maximum number of receive rounds in one invocation of internal event
+ * handler. Socket that still has datagrams is reported again in the next
+ * main loop iteration, so that it doesn't starve other file descriptors.
+ */
+#define EM_DATAGRAM_MAX_ROUNDS          16
+
+/** Flag of event_datagram_create() that enables <tt>UDP_GRO</tt>.
+ */
+#define EM_DATAGRAM_GRO                 1
+
+struct EM_datagram_s;   /* Forward declaration */
+
+/** One received datagram.
+ */
+typedef struct
+{
+    /** Payload, it's valid only until handler returns.
+     */
+    char *data;
+    size_t length;
+
+    /** Sender address.
+     */
+    const struct sockaddr *address;
+    socklen_t address_length;
+
+    /** If nonzero, then <tt>data</tt> contains several datagrams merged by
+     * <tt>UDP_GRO</tt>, each of them has this size except the last one,
+     * which may be shorter.
+     */
+    uint16_t segment_size;
+} EM_datagram_message;
+
+/** Type of callbacks that receive batches of datagrams.
+ *
+ * Handler may call event_datagram_send(), but it may not destroy the
+ * datagram socket.
+ *
+ * @param[in] event_machine
+ *   Event machine that dispatched the event.
+ *
+ * @param[in] datagram
+ *   Datagram socket that received the datagrams.
+ *
+ * @param[in] messages
+ *   Received datagrams.
+ *
+ * @param[in] count
+ *   Number of <tt>messages</tt>, at least one.
+ *
+ * @param[in] data
+ *   Pointer passed to event_datagram_create().
+ */
+typedef void (*EM_datagram_handler)(EM *event_machine,
+    struct EM_datagram_s *datagram, EM_datagram_message *messages,
+    size_t count, void *data);
+
+/** Datagram socket. Its fields are private, use functions declared below.
+ */
+typedef struct EM_datagram_s
+{
+    /** Event descriptor used to register socket in event machine.
+     */
+    EM_event_descriptor event_descriptor;
+
+    EM *event_machine;
+    EM_datagram_handler handler;
+    void *data;
+
+    /** Maximum number of datagrams received or sent at once, and size of
+     * each buffer.
+     */
+    size_t batch;
+    size_t message_size;
+
+    /** Receive side, all arrays have <tt>batch</tt> elements.
+     */
+    struct mmsghdr *rx;
+    EM_datagram_message *messages;
+
+    /** Send queue, <tt>tx_count</tt> datagrams starting at <tt>tx_head</tt>
+     * wait for being sent.
+     */
+    struct mmsghdr *tx;
+    size_t tx_head;
+    size_t tx_count;
+
+    /** Single allocation that holds buffers, addresses and control messages
+     * of both sides.
+     */
+    void *memory;
+
+    /** Number of datagrams, merged ones count as one, that were received,
+     * sent, and dropped because send queue was full or sending failed.
+     */
+    uint64_t received;
+    uint64_t sent;
+    uint64_t dropped;
+
+    /** True if <tt>UDP_GRO</tt> was enabled.
+     */
+    bool gro;
+
+    /** True while <tt>EVENT_WRITE</tt> is in events of the socket.
+     */
+    bool write_enabled;
+} EM_datagram;
+
+/** Register datagram socket in event machine.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine.
+ *
+ * @param[out] datagram
+ *   Datagram socket structure to initialize.
+ *
+ * @param[in] fd
+ *   Nonblocking datagram socket. It isn't closed by event_datagram_destroy().
+ *
+ * @param[in] batch
+ *   Number of datagrams received or sent at once, 0 means
+ *   #EM_DATAGRAM_DEFAULT_BATCH.
+ *
+ * @param[in] message_size
+ *   Size of each receive and send buffer, 0 means
+ *   #EM_DATAGRAM_DEFAULT_SIZE. Longer datagrams are truncated.
+ *
+ * @param[in] flags
+ *   Zero or #EM_DATAGRAM_GRO. If kernel doesn't support <tt>UDP_GRO</tt>,
+ *   then it's silently not used.
+ *
+ * @param[in] handler
+ *   Callback that receives datagrams, it may not be <tt>NULL</tt>.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>handler</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL if <tt>handler</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if memory allocation failed.
+ *
+ * @return
+ *   Errors returned by event_machine_add().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_datagram_create(EM *event_machine, EM_datagram *datagram,
+    int fd, size_t batch, size_t message_size, uint32_t flags,
+    EM_datagram_handler handler, void *data);
+
+/** Unregister socket and release buffers. Queued datagrams are dropped.
+ *
+ * @param[in] datagram
+ *   Datagram socket initialized by event_datagram_create().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_datagram_destroy(EM_datagram *datagram);
+
+/** Queue datagram for sending.
+ *
+ * @param[in] datagram
+ *   Datagram socket initialized by event_datagram_create().
+ *
+ * @param[in] buffer
+ *   Payload, it's copied.
+ *
+ * @param[in] length
+ *   Length of payload, at most <tt>message_size</tt> passed to
+ *   event_datagram_create().
+ *
+ * @param[in] address
+ *   Destination or <tt>NULL</tt> for connected socket.
+ *
+ * @param[in] address_length
+ *   Length of <tt>address</tt>.
+ *
+ * @param[in] segment_size
+ *   If nonzero, then kernel splits payload in to datagrams of this size
+ *   using <tt>UDP_SEGMENT</tt>, last of them may be shorter.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if <tt>length</tt> or
+ *   <tt>address_length</tt> is too big.
+ *
+ * @return
+ *   Returns #EM_ERROR_WRITE if queue is full and socket isn't writable, or
+ *   if flushing of full queue failed. Datagram is dropped in such case.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_datagram_send(EM_datagram *datagram, const void *buffer,
+    size_t length, const struct sockaddr *address, socklen_t address_length,
+    uint16_t segment_size);
+
+/** Send queued datagrams. It's called automatically after handler returns,
+ * call it after event_datagram_send() done outside of the handler.
+ *
+ * @param[in] datagram
+ *   Datagram socket initialized by event_datagram_create().
+ *
+ * @return
+ *   Errors of event_machine_modify() when <tt>EVENT_WRITE</tt> couldn't be
+ *   toggled.
+ *
+ * @return
+ *   On success, including the case when socket isn't writable and
+ *   datagrams stay queued, function returns <tt>EM_SUCCESS</tt>.
+ */
+uint32_t event_datagram_flush(EM_datagram *datagram);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_DATAGRAM_H_20884330637108945916212480563140172251 */
@@ -0,0 +1,198 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-listener.h"
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(USE_EPOLL) && defined(EPOLLEXCLUSIVE)
+#define EVENT_EXCLUSIVE EPOLLEXCLUSIVE
+#else
+/* Other backends don't have a way to wake up only one of the waiters. All
+ * event machines are woken up and all but one get EAGAIN from accept4().
+ */
+#define EVENT_EXCLUSIVE 0
+#endif
+
+
+static inline int open_reserved_fd(void)
+{
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+/* Accept one pending connection using reserved file descriptor and close it
+ * right away. Returns false if it wasn't possible.
+ */
+static bool reject(EM_listener *const listener, const int fd)
+{
+    if_invalid_fd (listener->reserved_fd)
+    {
+        /* Reserved file descriptor was taken by someone else after it was
+         * closed last time, it may be available again.
+         */
+        listener->reserved_fd = open_reserved_fd();
+        if_invalid_fd (listener->reserved_fd)
+        {
+            return false;
+        }
+    }
+
+    close(listener->reserved_fd);
+    const int connection = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if_valid_fd (connection)
+    {
+        close(connection);
+        listener->rejected++;
+    }
+    listener->reserved_fd = open_reserved_fd();
+
+    return valid_fd(connection);
+}
+
+static void internal_listener_handler(EM *const em,
+    const event_filter_t events, const int fd, void *const data)
+{
+    EM_listener *const listener = data;
+
+    for (size_t i = 0; i < listener->budget; i++)
+    {
+        struct sockaddr_storage address;
+        socklen_t address_len = sizeof(address);
+
+        const int connection = accept4(fd, (struct sockaddr *)&address,
+            &address_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if_invalid_fd (connection)
+        {
+            /* Aborted connections are skipped. EAGAIN, and any other error,
+             * means that there is nothing more to accept right now; listening
+             * socket is level triggered, so we will get notified again if
+             * something is still pending.
+             */
+            if (errno == ECONNABORTED || errno == EINTR || errno == EPROTO)
+            {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && reject(listener, fd))
+            {
+                continue;
+            }
+
+            return;
+        }
+
+        listener->accepted++;
+        listener->handler(em, connection, (struct sockaddr *)&address,
+            address_len, listener->data);
+    }
+}
+
+uint32_t event_listener_create(EM *const em, EM_listener *const listener,
+    const int fd, const size_t budget, const uint32_t flags,
+    const EM_listener_handler handler, void *const data)
+{
+    if (null(em) || null(listener))
+    {
+        return EM_ERROR_NULL;
+    }
+    if_invalid_fd (fd)
+    {
+        return EM_ERROR_BADFD;
+    }
+    if_null (handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    memset(listener, 0, sizeof(EM_listener));
+    listener->event_machine = em;
+    listener->handler = handler;
+    listener->data = data;
+    listener->budget = budget == 0 ? EM_LISTENER_DEFAULT_BUDGET : budget;
+
+    /* Failure isn't fatal, reserved file descriptor is needed only after
+     * process runs out of them and it's reopened on demand.
+     */
+    listener->reserved_fd = open_reserved_fd();
+
+    listener->event_descriptor.events = EVENT_READ
+        | ((flags & EM_LISTENER_EXCLUSIVE) ? EVENT_EXCLUSIVE : 0);
+    listener->event_descriptor.fd = fd;
+    listener->event_descriptor.data = listener;
+    listener->event_descriptor.handler = internal_listener_handler;
+
+    const uint32_t ret =
+        event_machine_add(em, &(listener->event_descriptor));
+    if_em_failure (ret)
+    {
+        const int saved_errno = errno;
+
+        if_valid_fd (listener->reserved_fd)
+        {
+            close(listener->reserved_fd);
+            listener->reserved_fd = -1;
+        }
+        errno = saved_errno;
+    }
+
+    return ret;
+}
+
+uint32_t event_listener_destroy(EM_listener *const listener)
+{
+    if_null (listener)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    /* Last argument is NULL, because event descriptor is part of
+     * EM_listener structure.
+     */
+    uint32_t ret = event_machine_delete(listener->event_machine,
+        listener->event_descriptor.fd, NULL);
+
+    if_valid_fd (listener->reserved_fd)
+    {
+        if (is_negative(close(listener->reserved_fd)) && is_em_success(ret))
+        {
+            ret = EM_ERROR_CLOSE;
+        }
+        listener->reserved_fd = -1;
+    }
+
+    return ret;
+}
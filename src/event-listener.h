@@ -0,0 +1,198 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-listener.h
+ * Accepting of connections on a listening socket.
+ *
+ * When listening socket becomes readable #EM_listener accepts pending
+ * connections using <tt>accept4()</tt>, until there are no more of them or
+ * until <tt>budget</tt> connections were accepted. Remaining connections are
+ * accepted in the next iteration of the main loop, so that a connection storm
+ * doesn't starve already established connections. Accepted connections are
+ * in nonblocking mode and have <tt>FD_CLOEXEC</tt> set, they are passed to
+ * #EM_listener_handler one by one.
+ *
+ * When process runs out of file descriptors, i.e. <tt>accept4()</tt> fails
+ * with <tt>EMFILE</tt> or <tt>ENFILE</tt>, pending connection can't be
+ * accepted and level triggered listening socket would be reported over and
+ * over again. Therefore listener keeps one reserved file descriptor, which
+ * it closes to accept such connection, closes the connection immediately and
+ * then reopens the reserved file descriptor. Peer sees the connection closed
+ * instead of waiting in the backlog until it times out.
+ *
+ * Available only on Linux with <tt>epoll</tt> or <tt>io_uring</tt> backend.
+ *
+ * Usage example can be found here: @link example/tcp-server.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_LISTENER_H_148763360922187153406286139751429508317
+#define EVENT_LISTENER_H_148763360922187153406286139751429508317
+
+#include "event-machine.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of connections accepted per event if zero is passed to
+ * event_listener_create().
+ */
+#define EM_LISTENER_DEFAULT_BUDGET  64
+
+/** Flag of event_listener_create() that registers listening socket using
+ * <tt>EPOLLEXCLUSIVE</tt>, if it's available, so that only one of event
+ * machines that share the listening socket is woken up per connection.
+ *
+ * With <tt>io_uring</tt> backend, or if <tt>EPOLLEXCLUSIVE</tt> isn't
+ * available, the flag is ignored. All event machines are woken up per
+ * connection and all but one of them get <tt>EAGAIN</tt> from
+ * <tt>accept4()</tt>.
+ */
+#define EM_LISTENER_EXCLUSIVE       1
+
+/** Type of callbacks invoked for each accepted connection.
+ *
+ * @param[in] event_machine
+ *   Event machine in which the listener is registered.
+ *
+ * @param[in] fd
+ *   Accepted connection. It's already in nonblocking mode and has
+ *   <tt>FD_CLOEXEC</tt> flag set. Callback is responsible for closing it.
+ *
+ * @param[in] address
+ *   Address of remote peer.
+ *
+ * @param[in] address_len
+ *   Length of <tt>address</tt>.
+ *
+ * @param[in] data
+ *   Pointer passed to event_listener_create().
+ */
+typedef void (*EM_listener_handler)(EM *event_machine, int fd,
+    const struct sockaddr *address, socklen_t address_len, void *data);
+
+/** Listening socket registered in event machine. Its fields are private,
+ * except for statistics.
+ */
+typedef struct
+{
+    /** Event descriptor used to register listening socket in event machine.
+     */
+    EM_event_descriptor event_descriptor;
+
+    EM *event_machine;
+    EM_listener_handler handler;
+    void *data;
+
+    /** Maximum number of connections accepted per event.
+     */
+    size_t budget;
+
+    /** File descriptor of <tt>/dev/null</tt> that is given up when process
+     * runs out of file descriptors, or -1 if it isn't currently open.
+     */
+    int reserved_fd;
+
+    /** Number of connections passed to handler.
+     */
+    uint64_t accepted;
+
+    /** Number of connections closed immediately after they were accepted,
+     * because process ran out of file descriptors.
+     */
+    uint64_t rejected;
+} EM_listener;
+
+/** Register listening socket in event machine.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine.
+ *
+ * @param[out] listener
+ *   Listener structure to initialize.
+ *
+ * @param[in] fd
+ *   Listening socket, it should be in nonblocking mode, otherwise
+ *   <tt>accept4()</tt> may block when connection is aborted before it's
+ *   accepted. It isn't closed by event_listener_destroy().
+ *
+ * @param[in] budget
+ *   Maximum number of connections accepted per event, 0 means
+ *   #EM_LISTENER_DEFAULT_BUDGET.
+ *
+ * @param[in] flags
+ *   Zero or #EM_LISTENER_EXCLUSIVE.
+ *
+ * @param[in] handler
+ *   Callback invoked for each accepted connection, it may not be
+ *   <tt>NULL</tt>. It may not destroy the listener.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>handler</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL if <tt>handler</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   Errors returned by event_machine_add().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_listener_create(EM *event_machine, EM_listener *listener,
+    int fd, size_t budget, uint32_t flags, EM_listener_handler handler,
+    void *data);
+
+/** Unregister listening socket and close reserved file descriptor.
+ *
+ * @param[in] listener
+ *   Listener initialized by event_listener_create().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_listener_destroy(EM_listener *listener);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_LISTENER_H_148763360922187153406286139751429508317 */
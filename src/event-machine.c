@@ -30,18 +30,36 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#ifdef USE_PIPE2
+#if defined(USE_PIPE2) || defined(USE_EVENTFD)
 #define _GNU_SOURCE
 #endif
 
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199901L
+#define _POSIX_C_SOURCE 199901L
+#endif
+
 #include "event-machine.h"
+#include "event-machine/buffer-internal.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/output-internal.h"
+#include "event-machine/probes-internal.h"
+#include "event-machine/profile-internal.h"
 #include "event-machine/result-internal.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef USE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
 #ifdef USE_EPOLL
 #include <sys/epoll.h>
 
@@ -51,8 +69,37 @@
 #define EVENT_ADD       EPOLL_CTL_ADD
 #define EVENT_MODIFY    EPOLL_CTL_MOD
 #define EVENT_DELETE    EPOLL_CTL_DEL
+
+/* Busy-poll parameters of epoll instance were added in Linux 6.9 and older C
+ * library headers don't know about them.
+ */
+#include <sys/ioctl.h>
+
+#ifndef EPIOCSPARAMS
+struct epoll_params
+{
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+
+#define EPIOCSPARAMS    _IOW(0x8A, 0x01, struct epoll_params)
+#endif /* EPIOCSPARAMS */
 #endif /* USE_EPOLL */
 
+#ifdef USE_IO_URING
+#include "event-machine/ring-internal.h"
+#include <sys/epoll.h>
+
+#define GET_EVENT_DATA_PTR(e)   ((e).data.ptr)
+#define GET_EVENTS(e)           ((e).events)
+
+#define EVENT_ADD       EPOLL_CTL_ADD
+#define EVENT_MODIFY    EPOLL_CTL_MOD
+#define EVENT_DELETE    EPOLL_CTL_DEL
+#endif /* USE_IO_URING */
+
 #ifdef USE_KQUEUE
 #include <sys/types.h>
 #include <sys/event.h>
@@ -72,14 +119,28 @@
 #define BREAK_LOOP_READ(em)     (BREAK_LOOP_PIPE(em)[0])
 #define BREAK_LOOP_WRITE(em)    (BREAK_LOOP_PIPE(em)[1])
 
+#define STORAGE_DATA(em)                    (em->descriptor_storage.data)
 #define STORAGE_INSERT(em)                  (em->descriptor_storage.insert)
-#define STORAGE_INSERT_ENTRY(em, fd, ptr)   (STORAGE_INSERT(em)(fd, ptr))
+#define STORAGE_INSERT_ENTRY(em, fd, ptr)   \
+    (STORAGE_INSERT(em)(STORAGE_DATA(em), fd, ptr))
 #define STORAGE_REMOVE(em)                  (em->descriptor_storage.remove)
-#define STORAGE_REMOVE_ENTRY(em, fd, ptr)   (STORAGE_REMOVE(em)(fd, ptr))
+#define STORAGE_REMOVE_ENTRY(em, fd, ptr)   \
+    (STORAGE_REMOVE(em)(STORAGE_DATA(em), fd, ptr))
+#define STORAGE_LOOKUP(em)                  (em->descriptor_storage.lookup)
+#define STORAGE_LOOKUP_ENTRY(em, fd)        \
+    (STORAGE_LOOKUP(em)(STORAGE_DATA(em), fd))
 
 
-static inline int create_event_queue()
+static inline int create_event_queue(EM *const em)
 {
+#ifdef USE_IO_URING
+    /* Submission ring has to be able to hold at least one request per
+     * registration change made in one batch, otherwise it is flushed earlier.
+     * Number of events processed in one batch is good estimate.
+     */
+    return em_ring_create(&(em->ring), (unsigned int)em->max_events);
+#endif /* USE_IO_URING */
+
 #ifdef USE_EPOLL
     /* Function epoll_create1() was introduced in Linux kernel 2.6.27 and glibc
      * support was added in version 2.9.
@@ -92,9 +153,16 @@ static inline int create_event_queue()
 #endif
 }
 
-static inline int event_ctl(const int queue_fd, EM_event_descriptor *const ed,
+static inline int event_ctl(EM *const em, EM_event_descriptor *const ed,
     int fd, int operation)
 {
+    EM_METRICS_INC(em, ctl_calls);
+    EM_TRACE_CTL(em, ed == NULL ? fd : ed->fd, operation);
+
+#ifdef USE_IO_URING
+    return em_ring_ctl(em->ring, ed, fd, operation);
+#else /* !defined(USE_IO_URING) */
+    const int queue_fd     = em->queue_fd;
     const int event_fd     = ed == NULL ? fd : ed->fd;
     const int event_filter = ed == NULL ? 0  : ed->events;
 
@@ -126,6 +194,8 @@ static inline int event_ctl(const int queue_fd, EM_event_descriptor *const ed,
          * dup()-ed. Calling epoll_ctl() with EPOLL_CTL_MOD may succeed in such
          * case.
          */
+        EM_METRICS_INC(em, ctl_calls);
+
         return epoll_ctl(queue_fd, operation, ed->fd, &event);
     }
 
@@ -143,330 +213,1684 @@ static inline int event_ctl(const int queue_fd, EM_event_descriptor *const ed,
 
     return kevent(queue_fd, &event, 1, NULL, 0, NULL);
 #endif /* USE_KQUEUE */
+#endif /* USE_IO_URING */
 }
 
-static inline int event_wait(const int queue_fd, event_t events[],
-    const int max_events)
-{
-#ifdef USE_EPOLL
-    return epoll_wait(queue_fd, events, max_events, -1);
-#endif /* USE_EPOLL */
+/* {{{ Deferred registration changes ****************************************/
 
-#if USE_KQUEUE
-    return kevent(queue_fd, NULL, 0, events, max_events, NULL);
-#endif /* USE_KQUEUE */
-}
+#define JOURNAL_MIN_SIZE    64
 
-uint32_t event_machine_init(EM *const em)
+typedef struct
 {
-    if_null (em)
-    {
-        return EM_ERROR_NULL;
-    }
+    int fd;
 
-    if_invalid_max_events (em->max_events)
-    {
-        em->events = NULL;
-        em->max_events = EM_DEFAULT_MAX_EVENTS;
-    }
+    /* True if file descriptor was registered in event queue before the first
+     * change recorded in current iteration.
+     */
+    bool was_registered;
 
-    if_null (em->events)
-    {
-        em->events = malloc(sizeof(event_t) * em->max_events);
+    /* True if file descriptor was removed and added again, possibly after
+     * its number was reused by a new file.
+     */
+    bool re_added;
 
-        /* Function event_machine_destroy() will call
-         * free(em->events) when this flag is set.
-         */
-        em->do_free_events = true;
-    }
-    else
-    {
-        em->do_free_events = false;
-    }
+    /* Intended registration or NULL if file descriptor should be removed.
+     */
+    EM_event_descriptor *ed;
+} EM_change;
 
-    /* We need break_loop_pipe to be non-blocking to prevent writing
-     * in to it from blocking.
-     *
-     * Imagine situation where one thread is running epoll_wait()
-     * loop and some other thread calls event_machine_terminate()
-     * which writes in to write end of the pipe to notify former that
-     * it should terminate. Now if epoll_wait() loop terminates then
-     * there is nobody to read data from the pipe. Since pipes have
-     * finite buffer size then after filling it up any subsequent
-     * write, i.e. event_machine_terminate() call, would be blocked.
+struct EM_journal_s
+{
+    EM_change *changes;
+    size_t num_changes;
+    size_t changes_size;
+
+    /* Position of a change plus one indexed by file descriptor. Zero means
+     * that there is no change recorded for that file descriptor.
      */
-#ifdef USE_PIPE2
-    if_not_zero (pipe2(BREAK_LOOP_PIPE(em), O_CLOEXEC | O_NONBLOCK))
+    uint32_t *index;
+    size_t index_size;
+};
+
+/* Make sure that array has at least min_size elements. New elements are
+ * zeroed.
+ */
+static int grow_array(void **const array, size_t *const size,
+    const size_t min_size, const size_t element_size)
+{
+    if (min_size <= (*size))
     {
-        return EM_ERROR_PIPE;
+        return 0;
     }
-#else /* !defined(USE_PIPE2) */
-    if_not_zero (pipe(BREAK_LOOP_PIPE(em)))
+
+    size_t new_size = (*size) < JOURNAL_MIN_SIZE ? JOURNAL_MIN_SIZE : (*size);
+    while (new_size < min_size)
     {
-        return EM_ERROR_PIPE;
+        new_size *= 2;
     }
 
-    /* For both ends of the pipe we have to be set FD_CLOEXEC and O_NONBLOCK.
-     */
-    for (unsigned short int i = 0; i < 2; i++)
+    char *const new_array = realloc(*array, new_size * element_size);
+    if_null (new_array)
     {
-        const int fd = BREAK_LOOP_PIPE(em)[i];
-
-        const int fd_flags = fcntl(fd, F_GETFL);
-        if_negative (fd_flags)
-        {
-            return EM_ERROR_FCNTL;
-        }
-
-        if_negative (fcntl(fd, F_SETFL, fd_flags | FD_CLOEXEC | O_NONBLOCK))
-        {
-            return EM_ERROR_FCNTL;
-        }
+        return -1;
     }
-#endif /* USE_PIPE2 */
+    memset(new_array + (*size) * element_size, 0,
+        (new_size - (*size)) * element_size);
 
-    /* The break_loop_pipe is used to notify main event handling loop
-     * that it should terminate. As a result we need to react to
-     * awaiting data for read event on the read end of the pipe. The
-     * write end is used by event_machine_terminate() to send the
-     * notification.
-     */
-    BREAK_LOOP_ED(em).events = EVENT_READ;
-    BREAK_LOOP_ED(em).fd = BREAK_LOOP_READ(em);
-
-    /* This event is handled internally so there is no need for spplying
-     * private data or even event handler.
-     */
-    BREAK_LOOP_ED(em).data = NULL;
-    BREAK_LOOP_ED(em).handler = NULL;
+    (*array) = new_array;
+    (*size) = new_size;
 
-    int queue_fd = create_event_queue();
-    if_invalid_fd (queue_fd)
-    {
-        return EM_ERROR_EVENT_CREATE_QUEUE;
-    }
-    em->queue_fd = queue_fd;
+    return 0;
+}
 
-    if_not_zero (event_ctl(em->queue_fd, &(BREAK_LOOP_ED(em)), -1, EVENT_ADD))
+static void journal_free(struct EM_journal_s *const journal)
+{
+    if_not_null (journal)
     {
-        return EM_ERROR_EVENT_CTL;
+        free(journal->changes);
+        free(journal->index);
+        free(journal);
     }
-
-    return EM_SUCCESS;
 }
 
-uint32_t event_machine_destroy(EM *const em)
+/* Record intended registration of a file descriptor. Argument ed is NULL
+ * when file descriptor is being removed and expect_registered is true for
+ * modify and delete operations.
+ *
+ * Returns 0 on success and -1 on failure, in which case errno is set the same
+ * way as event queue would set it.
+ */
+static int journal_record(struct EM_journal_s *const journal,
+    EM_event_descriptor *const ed, const int fd, const bool expect_registered)
 {
-    if_null (em)
+    const int event_fd = ed == NULL ? fd : ed->fd;
+
+    if_negative (grow_array((void **)&(journal->index), &(journal->index_size),
+        (size_t)event_fd + 1, sizeof(uint32_t)))
     {
-        return EM_ERROR_NULL;
+        return -1;
     }
 
-    /* Closing queue_fd first to ensure that any epoll_ctl() and epoll_wait()
-     * on it would fail.
-     */
-    if_valid_fd (em->queue_fd)
+    const uint32_t position = journal->index[event_fd];
+    if_zero (position)
     {
-        if_not_zero (close(em->queue_fd));
+        if_negative (grow_array((void **)&(journal->changes),
+            &(journal->changes_size), journal->num_changes + 1,
+            sizeof(EM_change)))
         {
-            return EM_ERROR_CLOSE;
+            return -1;
         }
-        em->queue_fd = -1;
-    }
 
-    /* Freeing memory for storing epoll events after closing epoll file
-     * descriptor is important, since there is a possibility that main loop is
-     * running while someone called event_machine_destroy() and then we wan't
-     * it to fail either on bad faildescriptor (if blocked on epoll_wait()) or
-     * on NULL pointer rather then any random memory.
-     */
-    if (em->do_free_events)
-    {
-        void *tmp = em->events;
-        em->events = NULL;
-        free(tmp);
+        EM_change *const change = &(journal->changes[journal->num_changes]);
+
+        change->fd = event_fd;
+        change->was_registered = expect_registered;
+        change->re_added = false;
+        change->ed = ed;
+        journal->index[event_fd] = ++(journal->num_changes);
+
+        return 0;
     }
 
-    /* Closing write end of break loop pipe first to make sure that writing in
-     * to it would fail.
-     */
-    if_valid_fd (BREAK_LOOP_WRITE(em))
+    EM_change *const change = &(journal->changes[position - 1]);
+    if (not(expect_registered) && not_null(change->ed))
     {
-        if_not_zero (close(BREAK_LOOP_WRITE(em)))
-        {
-            return EM_ERROR_CLOSE;
-        }
-        BREAK_LOOP_WRITE(em) = -1;
+        errno = EEXIST;
+
+        return -1;
     }
+    if (expect_registered && null(change->ed))
+    {
+        errno = ENOENT;
 
-    if_valid_fd (BREAK_LOOP_READ(em))
+        return -1;
+    }
+    if (null(change->ed) && not_null(ed))
     {
-        if_not_zero (close(BREAK_LOOP_READ(em)))
-        {
-            return EM_ERROR_CLOSE;
-        }
-        BREAK_LOOP_READ(em) = -1;
+        change->re_added = true;
     }
+    change->ed = ed;
 
-    return EM_SUCCESS;
+    return 0;
 }
 
-static inline uint32_t event_machine_run_once(EM *const em,
-    const int queue_fd, event_t events[], const int max_events,
-    const int break_loop_read_fd, bool *const break_loop)
+/* Apply net change for each file descriptor recorded in the journal. All
+ * changes are applied even if some of them fail, each failure is reported to
+ * change error handler.
+ */
+static void journal_apply(EM *const em)
 {
-    assert(em != NULL);
-    assert(valid_fd(queue_fd));
-    assert(valid_fd(break_loop_read_fd));
+    struct EM_journal_s *const journal = em->journal;
 
-    const int num_events = event_wait(queue_fd, events, max_events);
-    if_negative (num_events)
+    for (size_t i = 0; i < journal->num_changes; i++)
     {
-        return EM_ERROR_EVENT_WAIT;
-    }
+        const EM_change *const change = &(journal->changes[i]);
+        int r;
 
-    for (int i = 0; i < num_events; i++)
-    {
-        EM_event_descriptor *ed =
-            (EM_event_descriptor *)(GET_EVENT_DATA_PTR(events[i]));
+        journal->index[change->fd] = 0;
 
-        if (ed->fd == break_loop_read_fd)
+        if (not(change->was_registered))
         {
-            char ch;
-
-            (*break_loop) = true;
-            if_negative (read(break_loop_read_fd, &ch, 1))
+            if_null (change->ed)
             {
-                return EM_ERROR_READ;
+                /* Added and removed in the same iteration.
+                 */
+                continue;
             }
-            /* Case that read() would return 0 doesn't make sense,
-             * since that would contradict the fact that we are
-             * handling event which is invoked when data are
-             * available for reading.
+
+            r = event_ctl(em, change->ed, -1, EVENT_ADD);
+        }
+        else if_null (change->ed)
+        {
+            r = event_ctl(em, NULL, change->fd, EVENT_DELETE);
+
+            /* Handler already closed the file descriptor, which removed it
+             * from event queue.
              */
+            if (r != 0 && (errno == EBADF || errno == ENOENT))
+            {
+                r = 0;
+            }
         }
         else
         {
-            ed->handler(em, GET_EVENTS(events[i]), ed->fd, ed->data);
+            r = event_ctl(em, change->ed, -1, EVENT_MODIFY);
+
+            /* Old file descriptor was removed and closed and its number was
+             * reused by newly added one. Plain modify of unregistered file
+             * descriptor is an error, same as when it's not deferred.
+             */
+            if (r != 0 && errno == ENOENT && change->re_added)
+            {
+                r = event_ctl(em, change->ed, -1, EVENT_ADD);
+            }
+        }
+
+        if (r != 0 && not_null(em->change_error_handler))
+        {
+            em->change_error_handler(em, change->fd, change->ed, errno,
+                em->change_error_data);
         }
     }
+    journal->num_changes = 0;
+}
 
-    return EM_SUCCESS;
+/* Either apply registration change immediately or record it in the journal
+ * if event machine is dispatching events and deferring is enabled.
+ */
+static inline int change_registration(EM *const em,
+    EM_event_descriptor *const ed, const int fd, const int operation,
+    const bool expect_registered)
+{
+    if (em->dispatching && not_null(em->journal))
+    {
+        return journal_record(em->journal, ed, fd, expect_registered);
+    }
+
+    return event_ctl(em, ed, fd, operation);
 }
 
-uint32_t event_machine_run(EM *const em)
+uint32_t event_machine_defer_changes(EM *const em, const bool enable)
 {
     if_null (em)
     {
         return EM_ERROR_NULL;
     }
-    if_invalid_fd (em->queue_fd)
-    {
-        return EM_ERROR_BADFD;
-    }
-    if_invalid_max_events (em->max_events)
-    {
-        return EM_ERROR_MAX_EVENTS_TOO_SMALL;
-    }
-    if_null (em->events)
+    if (em->dispatching)
     {
-        return EM_ERROR_EVENTS_NULL;
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
     }
 
-    if_negative (fcntl(em->queue_fd, F_GETFL, 0))
+    if (not(enable))
     {
-        return EM_ERROR_BADFD;
+        journal_free(em->journal);
+        em->journal = NULL;
     }
-
-    for (bool break_loop = false; not(break_loop); )
+    else if_null (em->journal)
     {
-        uint32_t ret =
-            event_machine_run_once(em, em->queue_fd, em->events,
-                em->max_events, BREAK_LOOP_READ(em), &break_loop);
-        if_em_failure (ret)
+        em->journal = calloc(1, sizeof(struct EM_journal_s));
+        if_null (em->journal)
         {
-            return ret;
+            return EM_ERROR_MALLOC;
         }
     }
 
     return EM_SUCCESS;
 }
 
-uint32_t event_machine_terminate(EM *const em)
+uint32_t event_machine_set_change_error_handler(EM *const em,
+    const EM_change_error_handler handler, void *const data)
 {
     if_null (em)
     {
         return EM_ERROR_NULL;
     }
 
-    /* If this file descriptor is invalid it may indicate that either we are
-     * trying to call unitialized event machine or if it was already destroyed.
+    em->change_error_handler = handler;
+    em->change_error_data = data;
+
+    return EM_SUCCESS;
+}
+
+/* }}} Deferred registration changes ****************************************/
+
+/* {{{ Idle timeouts ********************************************************/
+
+typedef struct
+{
+    /* Earliest time, in nanoseconds, when timeout may expire. Activity only
+     * updates last_activity of event descriptor, deadline is corrected once
+     * it's reached.
      */
-    if_invalid_fd (em->break_loop_pipe[1])
-    {
-        return EM_ERROR_BADFD;
-    }
-    if_negative(fcntl(em->break_loop_pipe[1], F_GETFL, 0))
+    uint64_t deadline;
+    EM_event_descriptor *ed;
+} EM_idle_entry;
+
+/* Binary min-heap of idle deadlines.
+ */
+struct EM_idle_s
+{
+    EM_idle_entry *heap;
+    size_t count;
+    size_t heap_size;
+
+    /* Position of an entry in the heap plus one indexed by file descriptor.
+     * Zero means that file descriptor has no idle timeout.
+     */
+    uint32_t *index;
+    size_t index_size;
+};
+
+static inline uint64_t monotonic_nsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static inline uint64_t idle_deadline(const EM_event_descriptor *const ed)
+{
+    return ed->last_activity + (uint64_t)ed->idle_timeout * 1000000;
+}
+
+static inline void idle_place(struct EM_idle_s *const idle, const size_t i,
+    const EM_idle_entry entry)
+{
+    idle->heap[i] = entry;
+    idle->index[entry.ed->fd] = (uint32_t)(i + 1);
+}
+
+/* Move entry towards the root or towards the leaves, whichever restores heap
+ * property.
+ */
+static void idle_sift(struct EM_idle_s *const idle, size_t i)
+{
+    const EM_idle_entry entry = idle->heap[i];
+
+    while (i > 0 && idle->heap[(i - 1) / 2].deadline > entry.deadline)
     {
-        return EM_ERROR_BADFD;
+        idle_place(idle, i, idle->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
     }
 
-    char ch = 0;
-    if_negative (write(em->break_loop_pipe[1], &ch, 1))
+    for (;;)
     {
-        /* EAGAIN or EWOULDBLOCK indicate that pipe is full and write
-         * operation would block. In such case we don't need to write
-         * anything and there were no error.
-         */
-        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        size_t child = 2 * i + 1;
+
+        if (child >= idle->count)
         {
-            return EM_ERROR_WRITE;
+            break;
         }
+        if (child + 1 < idle->count
+            && idle->heap[child + 1].deadline < idle->heap[child].deadline)
+        {
+            child++;
+        }
+        if (idle->heap[child].deadline >= entry.deadline)
+        {
+            break;
+        }
+        idle_place(idle, i, idle->heap[child]);
+        i = child;
     }
 
-    return EM_SUCCESS;
+    idle_place(idle, i, entry);
 }
 
-uint32_t event_machine_add(EM *const em, EM_event_descriptor *const ed)
+static void idle_remove(struct EM_idle_s *const idle, const int fd)
 {
-    if_null (em)
+    if (null(idle) || (size_t)fd >= idle->index_size
+        || idle->index[fd] == 0)
     {
-        return EM_ERROR_NULL;
+        return;
     }
-    if_null (ed)
+
+    const size_t i = idle->index[fd] - 1;
+
+    idle->index[fd] = 0;
+    idle->count--;
+    if (i < idle->count)
+    {
+        idle_place(idle, i, idle->heap[idle->count]);
+        idle_sift(idle, i);
+    }
+}
+
+/* Move idle timeout of a file descriptor to its new event descriptor.
+ */
+static void idle_replace(struct EM_idle_s *const idle, const int fd,
+    EM_event_descriptor *const ed)
+{
+    if (null(idle) || (size_t)fd >= idle->index_size
+        || idle->index[fd] == 0)
+    {
+        return;
+    }
+
+    EM_idle_entry *const entry = &(idle->heap[idle->index[fd] - 1]);
+    if (entry->ed != ed)
+    {
+        ed->idle_timeout = entry->ed->idle_timeout;
+        ed->idle_handler = entry->ed->idle_handler;
+        ed->last_activity = entry->ed->last_activity;
+        entry->ed = ed;
+    }
+}
+
+static void idle_free(struct EM_idle_s *const idle)
+{
+    if_not_null (idle)
+    {
+        free(idle->heap);
+        free(idle->index);
+        free(idle);
+    }
+}
+
+/* Timeout for waiting on events in miliseconds, rounded up so that event
+ * machine doesn't wake up just before the earliest deadline.
+ */
+static inline int idle_wait_timeout(const struct EM_idle_s *const idle)
+{
+    if (null(idle) || idle->count == 0)
+    {
+        return -1;
+    }
+
+    const uint64_t now = monotonic_nsec();
+    const uint64_t deadline = idle->heap[0].deadline;
+    if (deadline <= now)
+    {
+        return 0;
+    }
+
+    const uint64_t msec = (deadline - now + 999999) / 1000000;
+
+    return msec > INT_MAX ? INT_MAX : (int)msec;
+}
+
+/* Invoke handlers of all expired idle timeouts. Handlers may freely add,
+ * remove or change idle timeouts, including their own.
+ *
+ * Returns number of invoked handlers.
+ */
+static int idle_expire(EM *const em)
+{
+    struct EM_idle_s *const idle = em->idle;
+    const uint64_t now = em->loop_time;
+    int num_expired = 0;
+
+    while (idle->count > 0 && idle->heap[0].deadline <= now)
+    {
+        EM_event_descriptor *const ed = idle->heap[0].ed;
+        const uint64_t deadline = idle_deadline(ed);
+
+        if (deadline > now)
+        {
+            idle->heap[0].deadline = deadline;
+            idle_sift(idle, 0);
+
+            continue;
+        }
+
+        idle_remove(idle, ed->fd);
+        ed->idle_timeout = 0;
+        num_expired++;
+        ed->idle_handler(em, ed->fd, ed->data);
+    }
+
+    return num_expired;
+}
+
+/* }}} Idle timeouts ********************************************************/
+
+/* {{{ Metrics **************************************************************/
+
+/* Size of stats file, mapping has to cover whole pages.
+ */
+static inline size_t metrics_mapping_size(void)
+{
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    return (sizeof(EM_metrics) + page_size - 1) / page_size * page_size;
+}
+
+static void metrics_free(EM_metrics *const metrics, const bool mapped)
+{
+    if (mapped)
+    {
+        munmap(metrics, metrics_mapping_size());
+    }
+    else
+    {
+        free(metrics);
+    }
+}
+
+static EM_metrics *metrics_map(const char *const path)
+{
+    const size_t size = metrics_mapping_size();
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if_negative (fd)
+    {
+        return NULL;
+    }
+    if_negative (ftruncate(fd, (off_t)size))
+    {
+        const int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+
+        return NULL;
+    }
+
+    void *const metrics =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int saved_errno = errno;
+
+    /* Mapping stays valid after file descriptor is closed.
+     */
+    close(fd);
+    errno = saved_errno;
+
+    return metrics == MAP_FAILED ? NULL : metrics;
+}
+
+/* Index of batch_sizes bucket, i.e. number of significant bits of batch size.
+ */
+static inline size_t metrics_batch_bucket(const int num_events)
+{
+    if (num_events <= 0)
+    {
+        return 0;
+    }
+
+    const size_t bucket = sizeof(unsigned int) * 8
+        - (size_t)__builtin_clz((unsigned int)num_events);
+
+    return bucket < EM_METRICS_BATCH_BUCKETS
+        ? bucket
+        : EM_METRICS_BATCH_BUCKETS - 1;
+}
+
+/* }}} Metrics **************************************************************/
+
+/* {{{ Priorities ***********************************************************/
+
+static inline uint32_t event_priority(const EM *const em,
+    const event_t *const event)
+{
+    const int fd = ((EM_event_descriptor *)GET_EVENT_DATA_PTR(*event))->fd;
+
+    return (size_t)fd < em->priorities_size ? em->priorities[fd] : 0;
+}
+
+/* File descriptor number that is registered again or deleted starts with
+ * default priority.
+ */
+static inline void priority_reset(EM *const em, const int fd)
+{
+    if ((size_t)fd < em->priorities_size && em->priorities[fd] != 0)
+    {
+        em->priorities[fd] = 0;
+        em->num_prioritized--;
+    }
+}
+
+/* Closing file descriptor removes it from epoll without event machine
+ * knowing about it, its priority would stay counted and every batch would be
+ * sorted. Such file descriptors are found by checking whether they are still
+ * open.
+ */
+static void priority_sweep(EM *const em)
+{
+    for (size_t fd = 0;
+        fd < em->priorities_size && em->num_prioritized > 0;
+        fd++)
+    {
+        if_zero (em->priorities[fd])
+        {
+            continue;
+        }
+
+        EM_METRICS_INC(em, fcntl_calls);
+        if (is_negative(fcntl((int)fd, F_GETFD)) && errno == EBADF)
+        {
+            priority_reset(em, (int)fd);
+        }
+    }
+}
+
+/* Order in which events of a batch are dispatched, or NULL if they should be
+ * dispatched in the order they were received, which is the case if all of
+ * them have the same priority.
+ *
+ * Events are sorted by priority using counting sort, which preserves their
+ * order within each priority. If priority_burst is non-zero, then after that
+ * many consecutive events of higher priorities one event of the lowest
+ * pending priority is taken.
+ */
+static const int *priority_order(EM *const em, const event_t events[],
+    const int num_events)
+{
+    size_t count[EM_PRIORITY_LEVELS] = {0};
+
+    for (int i = 0; i < num_events; i++)
+    {
+        count[event_priority(em, &events[i])]++;
+    }
+    if (count[0] < (size_t)num_events)
+    {
+        em->unprioritized_batches = 0;
+    }
+    else if (++em->unprioritized_batches >= EM_PRIORITY_SWEEP_BATCHES)
+    {
+        em->unprioritized_batches = 0;
+        priority_sweep(em);
+    }
+    for (int p = 0; p < EM_PRIORITY_LEVELS; p++)
+    {
+        if (count[p] == (size_t)num_events)
+        {
+            return NULL;
+        }
+    }
+
+    if_null (em->dispatch_order)
+    {
+        /* Second half holds events sorted by priority, first half is the
+         * resulting order. On allocation failure events are dispatched in
+         * the order they were received.
+         */
+        em->dispatch_order = malloc(2 * (size_t)em->max_events * sizeof(int));
+        if_null (em->dispatch_order)
+        {
+            return NULL;
+        }
+    }
+    int *const order = em->dispatch_order;
+    int *const sorted = order + em->max_events;
+
+    /* Highest priority goes first.
+     */
+    size_t next[EM_PRIORITY_LEVELS];
+    size_t end[EM_PRIORITY_LEVELS];
+    size_t offset = 0;
+    for (int p = EM_PRIORITY_LEVELS - 1; p >= 0; p--)
+    {
+        next[p] = offset;
+        offset += count[p];
+        end[p] = offset;
+    }
+    for (int i = 0; i < num_events; i++)
+    {
+        sorted[next[event_priority(em, &events[i])]++] = i;
+    }
+    for (int p = 0; p < EM_PRIORITY_LEVELS; p++)
+    {
+        next[p] = end[p] - count[p];
+    }
+
+    const uint32_t burst = em->priority_burst;
+    uint32_t run = 0;
+    for (int n = 0; n < num_events; n++)
+    {
+        int highest = EM_PRIORITY_LEVELS - 1;
+        int lowest = 0;
+
+        while (next[highest] == end[highest])
+        {
+            highest--;
+        }
+        while (next[lowest] == end[lowest])
+        {
+            lowest++;
+        }
+
+        if (highest == lowest)
+        {
+            run = 0;
+        }
+        else if (burst != 0 && run >= burst)
+        {
+            highest = lowest;
+            run = 0;
+        }
+        else
+        {
+            run++;
+        }
+        order[n] = sorted[next[highest]++];
+    }
+
+    return order;
+}
+
+/* }}} Priorities ***********************************************************/
+
+/* Wait for events. Timeout is in miliseconds, if it's zero, then return
+ * immediately even if there are no events, and negative value means wait
+ * indefinitely.
+ */
+static inline int event_wait(EM *const em, const int queue_fd,
+    event_t events[], const int max_events, const int timeout)
+{
+    EM_METRICS_INC(em, wait_calls);
+
+#ifdef USE_IO_URING
+    return em_ring_wait(em->ring, events, max_events, timeout);
+#endif /* USE_IO_URING */
+
+#ifdef USE_EPOLL
+    return epoll_wait(queue_fd, events, max_events, timeout < 0 ? -1 : timeout);
+#endif /* USE_EPOLL */
+
+#if USE_KQUEUE
+    const struct timespec ts =
+    {
+        .tv_sec = timeout / 1000,
+        .tv_nsec = (long)(timeout % 1000) * 1000000
+    };
+
+    return kevent(queue_fd, NULL, 0, events, max_events,
+        timeout < 0 ? NULL : &ts);
+#endif /* USE_KQUEUE */
+}
+
+static inline uint64_t elapsed_usec(const struct timespec *const since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - since->tv_sec) * 1000000
+        + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/* Poll for events using zero timeout for at most spin_usec microseconds and
+ * only then block for at most timeout miliseconds. Clock is consulted only
+ * after the first poll came back empty, so busy event machine doesn't pay for
+ * it.
+ */
+static inline int event_wait_spinning(EM *const em, const int queue_fd,
+    event_t events[], const int max_events, const uint32_t spin_usec,
+    const int timeout)
+{
+    struct timespec start;
+
+    int num_events = event_wait(em, queue_fd, events, max_events, 0);
+    if (num_events != 0 || timeout == 0)
+    {
+        return num_events;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+    {
+        num_events = event_wait(em, queue_fd, events, max_events, 0);
+        if_not_zero (num_events)
+        {
+            return num_events;
+        }
+    } while (elapsed_usec(&start) < spin_usec);
+
+    return event_wait(em, queue_fd, events, max_events, timeout);
+}
+
+/* True if file descriptor should be checked using fcntl() and it turns out to
+ * be closed. Trusted event machine skips the check and leaves detection of
+ * closed file descriptors to the system call that uses them.
+ */
+static inline bool is_closed_fd(const EM *const em, const int fd)
+{
+    if (em->validation == EM_VALIDATE_TRUSTED)
+    {
+        return false;
+    }
+    EM_METRICS_INC(em, fcntl_calls);
+
+    return is_negative(fcntl(fd, F_GETFL, 0));
+}
+
+uint32_t event_machine_set_priority(EM *const em, const int fd,
+    const uint32_t priority)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_invalid_fd (fd)
+    {
+        errno = EBADF;
+
+        return EM_ERROR_BADFD;
+    }
+    if (priority >= EM_PRIORITY_LEVELS)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    if_zero (priority)
+    {
+        priority_reset(em, fd);
+
+        return EM_SUCCESS;
+    }
+    if_negative (grow_array((void **)&(em->priorities), &(em->priorities_size),
+        (size_t)fd + 1, sizeof(uint8_t)))
+    {
+        return EM_ERROR_MALLOC;
+    }
+    if_zero (em->priorities[fd])
+    {
+        em->num_prioritized++;
+    }
+    em->priorities[fd] = (uint8_t)priority;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_set_priority_burst(EM *const em, const uint32_t burst)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    em->priority_burst = burst;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_set_validation(EM *const em,
+    const EM_validation validation)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if (validation != EM_VALIDATE_ALWAYS && validation != EM_VALIDATE_TRUSTED)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    em->validation = validation;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_init(EM *const em)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    if_invalid_max_events (em->max_events)
+    {
+        em->events = NULL;
+        em->max_events = EM_DEFAULT_MAX_EVENTS;
+    }
+
+    if_null (em->events)
+    {
+        em->events = malloc(sizeof(event_t) * em->max_events);
+
+        /* Function event_machine_destroy() will call
+         * free(em->events) when this flag is set.
+         */
+        em->do_free_events = true;
+    }
+    else
+    {
+        em->do_free_events = false;
+    }
+
+    em->break_loop_requested = 0;
+    em->wakeup_pending = 0;
+    em->posted_tasks = NULL;
+    em->dispatching = false;
+
+    /* We need break_loop_pipe to be non-blocking to prevent writing
+     * in to it from blocking.
+     *
+     * Imagine situation where one thread is running epoll_wait()
+     * loop and some other thread calls event_machine_terminate()
+     * which writes in to write end of the pipe to notify former that
+     * it should terminate. Now if epoll_wait() loop terminates then
+     * there is nobody to read data from the pipe. Since pipes have
+     * finite buffer size then after filling it up any subsequent
+     * write, i.e. event_machine_terminate() call, would be blocked.
+     *
+     * On Linux eventfd is used instead of a pipe. It needs only one file
+     * descriptor and any number of notifications fits in to its counter.
+     */
+#if defined(USE_EVENTFD)
+    const int wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if_invalid_fd (wakeup_fd)
+    {
+        return EM_ERROR_PIPE;
+    }
+    BREAK_LOOP_READ(em) = wakeup_fd;
+    BREAK_LOOP_WRITE(em) = wakeup_fd;
+#elif defined(USE_PIPE2)
+    if_not_zero (pipe2(BREAK_LOOP_PIPE(em), O_CLOEXEC | O_NONBLOCK))
+    {
+        return EM_ERROR_PIPE;
+    }
+#else /* !defined(USE_EVENTFD) && !defined(USE_PIPE2) */
+    if_not_zero (pipe(BREAK_LOOP_PIPE(em)))
+    {
+        return EM_ERROR_PIPE;
+    }
+
+    /* For both ends of the pipe we have to be set FD_CLOEXEC and O_NONBLOCK.
+     */
+    for (unsigned short int i = 0; i < 2; i++)
+    {
+        const int fd = BREAK_LOOP_PIPE(em)[i];
+
+        const int fd_flags = fcntl(fd, F_GETFL);
+        if_negative (fd_flags)
+        {
+            return EM_ERROR_FCNTL;
+        }
+
+        if_negative (fcntl(fd, F_SETFL, fd_flags | FD_CLOEXEC | O_NONBLOCK))
+        {
+            return EM_ERROR_FCNTL;
+        }
+    }
+#endif /* USE_PIPE2 */
+
+    /* The break_loop_pipe is used to notify main event handling loop
+     * that it should terminate or that there are posted tasks. As a result
+     * we need to react to awaiting data for read event on the read end of
+     * the pipe. The write end is used by event_machine_terminate() and
+     * event_machine_post() to send the notification.
+     */
+    BREAK_LOOP_ED(em).events = EVENT_READ;
+    BREAK_LOOP_ED(em).fd = BREAK_LOOP_READ(em);
+
+    /* This event is handled internally so there is no need for spplying
+     * private data or even event handler.
+     */
+    BREAK_LOOP_ED(em).data = NULL;
+    BREAK_LOOP_ED(em).handler = NULL;
+
+    int queue_fd = create_event_queue(em);
+    if_invalid_fd (queue_fd)
+    {
+        return EM_ERROR_EVENT_CREATE_QUEUE;
+    }
+    em->queue_fd = queue_fd;
+
+    if_not_zero (event_ctl(em, &(BREAK_LOOP_ED(em)), -1, EVENT_ADD))
+    {
+        return EM_ERROR_EVENT_CTL;
+    }
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_destroy(EM *const em)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    /* Closing queue_fd first to ensure that any epoll_ctl() and epoll_wait()
+     * on it would fail.
+     */
+    if_valid_fd (em->queue_fd)
+    {
+        if_not_zero (close(em->queue_fd))
+        {
+            return EM_ERROR_CLOSE;
+        }
+        em->queue_fd = -1;
+    }
+
+#ifdef USE_IO_URING
+    /* Rings are still mapped after closing their file descriptor, unmapping
+     * them releases the io_uring instance.
+     */
+    em_ring_destroy(em->ring);
+    em->ring = NULL;
+#endif /* USE_IO_URING */
+
+    /* Freeing memory for storing epoll events after closing epoll file
+     * descriptor is important, since there is a possibility that main loop is
+     * running while someone called event_machine_destroy() and then we wan't
+     * it to fail either on bad faildescriptor (if blocked on epoll_wait()) or
+     * on NULL pointer rather then any random memory.
+     */
+    if (em->do_free_events)
+    {
+        void *tmp = em->events;
+        em->events = NULL;
+        free(tmp);
+    }
+
+    /* Closing write end of break loop pipe first to make sure that writing in
+     * to it would fail. With eventfd both ends are the same file descriptor.
+     */
+    if (valid_fd(BREAK_LOOP_WRITE(em))
+        && BREAK_LOOP_WRITE(em) != BREAK_LOOP_READ(em))
+    {
+        if_not_zero (close(BREAK_LOOP_WRITE(em)))
+        {
+            return EM_ERROR_CLOSE;
+        }
+        BREAK_LOOP_WRITE(em) = -1;
+    }
+
+    if_valid_fd (BREAK_LOOP_READ(em))
+    {
+        if_not_zero (close(BREAK_LOOP_READ(em)))
+        {
+            return EM_ERROR_CLOSE;
+        }
+        BREAK_LOOP_READ(em) = -1;
+    }
+    BREAK_LOOP_WRITE(em) = -1;
+
+    journal_free(em->journal);
+    em->journal = NULL;
+
+    idle_free(em->idle);
+    em->idle = NULL;
+
+    if_not_null (em->metrics)
     {
-        return EM_ERROR_DESCRIPTOR_NULL;
+        metrics_free(em->metrics, em->metrics_mapped);
+        em->metrics = NULL;
+    }
+
+    em_profile_free(em->profile);
+    em->profile = NULL;
+
+    free(em->dispatch_order);
+    em->dispatch_order = NULL;
+
+    free(em->priorities);
+    em->priorities = NULL;
+    em->priorities_size = 0;
+    em->num_prioritized = 0;
+
+    /* Output queues belong to the user, only their data aren't written.
+     */
+    em_output_forget_pending(em);
+
+    /* Tasks that were posted or deferred, but never executed, are
+     * discarded.
+     */
+    for (EM_task *task = em->next_tick_head; not_null(task);)
+    {
+        EM_task *const next = task->next;
+
+        if (task->do_free)
+        {
+            free(task);
+        }
+        task = next;
+    }
+    em->next_tick_head = NULL;
+    em->next_tick_tail = NULL;
+
+    EM_task *task = __atomic_exchange_n(&(em->posted_tasks), NULL,
+        __ATOMIC_ACQUIRE);
+    while (not_null(task))
+    {
+        EM_task *const next = task->next;
+
+        if (task->do_free)
+        {
+            free(task);
+        }
+        task = next;
+    }
+
+    return EM_SUCCESS;
+}
+
+/* Notify main loop that it should check for posted tasks and termination
+ * request, unless it's awake or it was already notified.
+ */
+static inline uint32_t wakeup(EM *const em)
+{
+    if_not_zero (__atomic_exchange_n(&(em->wakeup_pending), 1,
+        __ATOMIC_SEQ_CST))
+    {
+        return EM_SUCCESS;
+    }
+
+#ifdef USE_EVENTFD
+    const uint64_t value = 1;
+#else /* !defined(USE_EVENTFD) */
+    const char value = 0;
+#endif /* USE_EVENTFD */
+
+    if_negative (write(BREAK_LOOP_WRITE(em), &value, sizeof(value)))
+    {
+        /* EAGAIN or EWOULDBLOCK indicate that pipe is full and write
+         * operation would block. In such case we don't need to write
+         * anything and there were no error.
+         */
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            return EM_ERROR_WRITE;
+        }
+    }
+
+    return EM_SUCCESS;
+}
+
+/* Consume all wakeup notifications. Read end is nonblocking, therefore
+ * running out of data is reported as EAGAIN.
+ *
+ * Each wakeup() writes value 1 or one byte, therefore what was read is the
+ * number of writes other threads made.
+ */
+static inline uint32_t consume_wakeup(EM *const em, const int fd)
+{
+#ifdef USE_EVENTFD
+    uint64_t value = 0;
+
+    EM_METRICS_INC(em, read_calls);
+    const ssize_t ret = read(fd, &value, sizeof(value));
+    if_not_null (em->metrics)
+    {
+        em->metrics->remote_wakeups += value;
+    }
+    if_negative (ret)
+#else /* !defined(USE_EVENTFD) */
+    char buffer[64];
+    ssize_t ret;
+
+    do
+    {
+        EM_METRICS_INC(em, read_calls);
+        ret = read(fd, buffer, sizeof(buffer));
+        if (not_null(em->metrics) && ret > 0)
+        {
+            em->metrics->remote_wakeups += (uint64_t)ret;
+        }
+    } while (ret == sizeof(buffer));
+    if_negative (ret)
+#endif /* USE_EVENTFD */
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            return EM_ERROR_READ;
+        }
+    }
+
+    return EM_SUCCESS;
+}
+
+/* Execute all tasks posted so far. Tasks posted while this function runs are
+ * left for the next iteration of main loop.
+ */
+static inline void run_posted_tasks(EM *const em)
+{
+    EM_task *task = __atomic_exchange_n(&(em->posted_tasks), NULL,
+        __ATOMIC_SEQ_CST);
+    EM_task *reversed = NULL;
+
+    /* Tasks are pushed on top of a stack, reversing it gives us the order in
+     * which they were posted.
+     */
+    while (not_null(task))
+    {
+        EM_task *const next = task->next;
+
+        task->next = reversed;
+        reversed = task;
+        task = next;
+    }
+
+    while (not_null(reversed))
+    {
+        EM_task *const next = reversed->next;
+        const bool do_free = reversed->do_free;
+
+        /* Handler is allowed to free or re-post the task, therefore it may
+         * not be touched after handler returns.
+         */
+        EM_METRICS_INC(em, task_calls);
+        reversed->handler(em, reversed->data);
+        if (do_free)
+        {
+            free(reversed);
+        }
+        reversed = next;
+    }
+}
+
+/* Execute deferred tasks queued until now, tasks queued by them are left for
+ * the next iteration. If time budget of current iteration, which started at
+ * loop_time, is exceeded, then remaining tasks are left for the next
+ * iteration as well.
+ */
+static inline void run_next_ticks(EM *const em)
+{
+    EM_task *task = em->next_tick_head;
+    EM_task *const last = em->next_tick_tail;
+    const uint64_t budget = (uint64_t)em->tick_budget_usec * 1000;
+
+    em->next_tick_head = NULL;
+    em->next_tick_tail = NULL;
+
+    while (not_null(task))
+    {
+        EM_task *const next = task->next;
+        const bool do_free = task->do_free;
+
+        /* Handler is allowed to free or re-queue the task, therefore it may
+         * not be touched after handler returns.
+         */
+        EM_METRICS_INC(em, task_calls);
+        task->handler(em, task->data);
+        if (do_free)
+        {
+            free(task);
+        }
+        task = next;
+
+        if (not_null(task) && budget != 0
+            && monotonic_nsec() - em->loop_time >= budget)
+        {
+            /* Remaining tasks go before those queued in the meantime.
+             */
+            last->next = em->next_tick_head;
+            em->next_tick_head = task;
+            if_null (em->next_tick_tail)
+            {
+                em->next_tick_tail = last;
+            }
+            break;
+        }
+    }
+}
+
+static inline uint32_t event_machine_run_once(EM *const em,
+    const int queue_fd, event_t events[], const int max_events,
+    const int break_loop_read_fd, bool *const break_loop)
+{
+    uint32_t ret = EM_SUCCESS;
+
+    assert(em != NULL);
+    assert(valid_fd(queue_fd));
+    assert(valid_fd(break_loop_read_fd));
+
+    EM_metrics *const metrics = em->metrics;
+    const bool has_idle = not_null(em->idle) && em->idle->count > 0;
+    const uint32_t spin_usec = em->latency_mode.spin_usec;
+    const int timeout = not_null(em->next_tick_head) ? 0
+        : not_null(em->buffer_pool)
+            ? em_buffer_pool_wait_timeout(em, idle_wait_timeout(em->idle))
+            : idle_wait_timeout(em->idle);
+
+    EM_TRACE_WAIT_START(em, timeout);
+    const int num_events = spin_usec > 0
+        ? event_wait_spinning(em, queue_fd, events, max_events, spin_usec,
+            timeout)
+        : event_wait(em, queue_fd, events, max_events, timeout);
+    EM_TRACE_WAIT_DONE(em, num_events);
+    if_negative (num_events)
+    {
+        return EM_ERROR_EVENT_WAIT;
+    }
+
+    /* Timestamp of this iteration is what dispatched events record as last
+     * activity and what time budget is measured from. It's not needed if
+     * there are no idle timeouts, there is no time budget and metrics aren't
+     * maintained.
+     */
+    if (has_idle || not_null(metrics) || em->tick_budget_usec != 0)
+    {
+        em->loop_time = monotonic_nsec();
+    }
+    if_not_null (metrics)
+    {
+        metrics->blocked_nsec += em->loop_time - metrics->timestamp;
+        metrics->events += (uint64_t)num_events;
+        metrics->batch_sizes[metrics_batch_bucket(num_events)]++;
+        if (num_events == max_events)
+        {
+            metrics->full_batches++;
+        }
+    }
+    int num_handlers = 0;
+
+    /* When profiling, end of one handler is start of the next one, therefore
+     * there is only one clock read per event.
+     */
+    uint64_t handler_start = not_null(em->profile) ? monotonic_nsec() : 0;
+
+    /* While we are awake there is no need for other threads to notify us
+     * about posted tasks, they will be executed at the end of this
+     * iteration.
+     */
+    __atomic_store_n(&(em->wakeup_pending), 1, __ATOMIC_RELAXED);
+    em->dispatching = true;
+
+    /* Event descriptors aren't touched here, unless there are some with
+     * non-zero priority.
+     */
+    const int *const order = em->num_prioritized > 0
+        ? priority_order(em, events, num_events)
+        : NULL;
+
+    for (int n = 0; n < num_events; n++)
+    {
+        const int i = null(order) ? n : order[n];
+        EM_event_descriptor *ed =
+            (EM_event_descriptor *)(GET_EVENT_DATA_PTR(events[i]));
+
+        if (ed->fd == break_loop_read_fd)
+        {
+            /* Termination request and posted tasks are checked below.
+             */
+            if_em_failure_of (ret, consume_wakeup(em, break_loop_read_fd))
+            {
+                break;
+            }
+            handler_start = 0;
+        }
+        else
+        {
+            /* Handler may free the event descriptor.
+             */
+            const EM_event_handler handler = ed->handler;
+            const int fd = ed->fd;
+            const event_filter_t filter = GET_EVENTS(events[i]);
+
+            if_not_zero (ed->idle_timeout)
+            {
+                ed->last_activity = em->loop_time;
+            }
+            num_handlers++;
+
+            EM_TRACE_DISPATCH_START(em, fd, filter);
+            if_null (em->profile)
+            {
+                handler(em, filter, fd, ed->data);
+            }
+            else
+            {
+                const uint64_t start =
+                    handler_start == 0 ? monotonic_nsec() : handler_start;
+
+                handler(em, filter, fd, ed->data);
+
+                handler_start = monotonic_nsec();
+
+                /* Time spent in slow handler callback isn't accounted to the
+                 * next event handler.
+                 */
+                if (not_null(em->profile)
+                    && em_profile_record(em, handler, fd,
+                        handler_start - start))
+                {
+                    handler_start = monotonic_nsec();
+                }
+            }
+            EM_TRACE_DISPATCH_DONE(em, fd, filter);
+        }
+    }
+
+    /* Clearing wakeup_pending before looking at posted tasks guarantees that
+     * task posted after we looked will wake us up.
+     */
+    __atomic_store_n(&(em->wakeup_pending), 0, __ATOMIC_SEQ_CST);
+    run_posted_tasks(em);
+
+    if (has_idle)
+    {
+        num_handlers += idle_expire(em);
+    }
+
+    if_not_null (em->next_tick_head)
+    {
+        run_next_ticks(em);
+    }
+
+    /* Everything written by handlers, tasks and idle handlers of this
+     * iteration is written using one writev() per file descriptor.
+     */
+    if_not_null (em->output_pending)
+    {
+        em_output_flush_pending(em);
+    }
+
+    /* Read buffers released by handlers aren't freed right away, they are
+     * kept for reuse as long as they were needed recently.
+     */
+    if_not_null (em->buffer_pool)
+    {
+        em_buffer_pool_maintain(em);
+    }
+
+    em->dispatching = false;
+    if_not_null (em->journal)
+    {
+        journal_apply(em);
+    }
+
+    if_not_null (metrics)
+    {
+        metrics->timestamp = monotonic_nsec();
+        metrics->dispatch_nsec += metrics->timestamp - em->loop_time;
+        metrics->handler_calls += (uint64_t)num_handlers;
+        metrics->iterations++;
+    }
+    ret_em_failure(ret);
+
+    if_not_zero (__atomic_exchange_n(&(em->break_loop_requested), 0,
+        __ATOMIC_SEQ_CST))
+    {
+        (*break_loop) = true;
+    }
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_run(EM *const em)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_invalid_fd (em->queue_fd)
+    {
+        return EM_ERROR_BADFD;
+    }
+    if_invalid_max_events (em->max_events)
+    {
+        return EM_ERROR_MAX_EVENTS_TOO_SMALL;
+    }
+    if_null (em->events)
+    {
+        return EM_ERROR_EVENTS_NULL;
+    }
+
+    if (is_closed_fd(em, em->queue_fd))
+    {
+        return EM_ERROR_BADFD;
+    }
+
+    /* Time between event_machine_run() calls isn't accounted as blocked.
+     */
+    if_not_null (em->metrics)
+    {
+        em->metrics->timestamp = monotonic_nsec();
+    }
+
+    for (bool break_loop = false; not(break_loop); )
+    {
+        uint32_t ret =
+            event_machine_run_once(em, em->queue_fd, em->events,
+                em->max_events, BREAK_LOOP_READ(em), &break_loop);
+        if_em_failure (ret)
+        {
+            return ret;
+        }
+    }
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_terminate(EM *const em)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    /* If this file descriptor is invalid it may indicate that either we are
+     * trying to call unitialized event machine or if it was already destroyed.
+     */
+    if_invalid_fd (em->break_loop_pipe[1])
+    {
+        return EM_ERROR_BADFD;
+    }
+    if (is_closed_fd(em, em->break_loop_pipe[1]))
+    {
+        return EM_ERROR_BADFD;
+    }
+
+    __atomic_store_n(&(em->break_loop_requested), 1, __ATOMIC_SEQ_CST);
+
+    return wakeup(em);
+}
+
+static inline void queue_next_tick(EM *const em, EM_task *const task)
+{
+    task->next = NULL;
+    if_null (em->next_tick_tail)
+    {
+        em->next_tick_head = task;
+    }
+    else
+    {
+        em->next_tick_tail->next = task;
+    }
+    em->next_tick_tail = task;
+}
+
+static uint32_t post_task(EM *const em, EM_task *const task)
+{
+    if_invalid_fd (BREAK_LOOP_WRITE(em))
+    {
+        errno = EBADF;
+
+        return EM_ERROR_BADFD;
     }
 
-    /* It doesn't make sense to try to register file descriptor if it's invalid
-     * or if queue_fd is invalid. By checking for it we get more sensible error
-     * then if we wen't ahead and called epoll_ctl().
+    /* Lock-free push on top of a stack. Consumer always takes the whole
+     * stack at once, therefore there is no ABA problem.
      */
-    if (invalid_fd(em->queue_fd) || invalid_fd(ed->fd))
+    task->next = __atomic_load_n(&(em->posted_tasks), __ATOMIC_RELAXED);
+    while (not(__atomic_compare_exchange_n(&(em->posted_tasks), &(task->next),
+        task, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)))
     {
-        errno = EBADF;
+        ;
+    }
 
-        return EM_ERROR_BADFD;
+    return wakeup(em);
+}
+
+uint32_t event_machine_next_tick(EM *const em, const EM_task_handler handler,
+    void *const data)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
     }
-    if (is_negative(fcntl(em->queue_fd, F_GETFL, 0))
-        || is_negative(fcntl(ed->fd, F_GETFL, 0)))
+    if_null (handler)
     {
-        return EM_ERROR_BADFD;
+        return EM_ERROR_CALLBACK_NULL;
     }
 
-    if_not_zero (event_ctl(em->queue_fd, ed, -1, EVENT_ADD))
+    EM_task *const task = malloc(sizeof(EM_task));
+    if_null (task)
     {
-        return EM_ERROR_EVENT_CTL;
+        return EM_ERROR_MALLOC;
     }
+    task->handler = handler;
+    task->data = data;
+    task->do_free = true;
+    queue_next_tick(em, task);
 
-    if_not_null (STORAGE_INSERT(em))
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_next_tick_task(EM *const em, EM_task *const task)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (task)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if_null (task->handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    task->do_free = false;
+    queue_next_tick(em, task);
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_set_tick_budget(EM *const em, const uint32_t usec)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    em->tick_budget_usec = usec;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_post_task(EM *const em, EM_task *const task)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (task)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if_null (task->handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    task->do_free = false;
+
+    return post_task(em, task);
+}
+
+uint32_t event_machine_post(EM *const em, const EM_task_handler handler,
+    void *const data)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    EM_task *const task = malloc(sizeof(EM_task));
+    if_null (task)
+    {
+        return EM_ERROR_MALLOC;
+    }
+    task->handler = handler;
+    task->data = data;
+    task->do_free = true;
+
+    uint32_t ret = post_task(em, task);
+    if_em_failure (ret)
+    {
+        free(task);
+    }
+
+    return ret;
+}
+
+uint32_t event_machine_set_latency_mode(EM *const em,
+    const EM_latency_mode *const latency_mode)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (latency_mode)
     {
-        return STORAGE_INSERT_ENTRY(em, ed->fd, ed);
+        return EM_ERROR_BUFFER_NULL;
     }
 
+    if_not_zero (latency_mode->busy_poll_usec)
+    {
+#ifdef USE_EPOLL
+        struct epoll_params params =
+        {
+            .busy_poll_usecs = latency_mode->busy_poll_usec,
+            .busy_poll_budget = latency_mode->busy_poll_budget,
+            .prefer_busy_poll = latency_mode->prefer_busy_poll ? 1 : 0
+        };
+
+        if_invalid_fd (em->queue_fd)
+        {
+            errno = EBADF;
+
+            return EM_ERROR_BADFD;
+        }
+        if_negative (ioctl(em->queue_fd, EPIOCSPARAMS, &params))
+        {
+            return EM_ERROR_IOCTL;
+        }
+#else /* !defined(USE_EPOLL) */
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+#endif /* USE_EPOLL */
+    }
+
+    em->latency_mode = (*latency_mode);
+
     return EM_SUCCESS;
 }
 
+/* Set SO_BUSY_POLL on a newly registered socket. This is only a hint,
+ * therefore failures are ignored, most notably ENOTSOCK for file descriptors
+ * that aren't sockets and EPERM when exceeding net.core.busy_read without
+ * CAP_NET_ADMIN.
+ */
+static inline void set_socket_busy_poll(const int fd, const uint32_t usec)
+{
+#ifdef SO_BUSY_POLL
+    const int value = (int)usec;
+
+    (void)setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value));
+#endif /* SO_BUSY_POLL */
+}
+
 static uint32_t remove_event_descriptor(EM *const em, const int fd,
     EM_event_descriptor **old_ed)
 {
@@ -510,6 +1934,73 @@ static uint32_t remove_event_descriptor(EM *const em, const int fd,
     return ret;
 }
 
+uint32_t event_machine_add(EM *const em, EM_event_descriptor *const ed)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (ed)
+    {
+        return EM_ERROR_DESCRIPTOR_NULL;
+    }
+
+    /* It doesn't make sense to try to register file descriptor if it's invalid
+     * or if queue_fd is invalid. By checking for it we get more sensible error
+     * then if we wen't ahead and called epoll_ctl().
+     */
+    if (invalid_fd(em->queue_fd) || invalid_fd(ed->fd))
+    {
+        errno = EBADF;
+
+        return EM_ERROR_BADFD;
+    }
+    if (is_closed_fd(em, em->queue_fd) || is_closed_fd(em, ed->fd))
+    {
+        return EM_ERROR_BADFD;
+    }
+    if_not_zero (change_registration(em, ed, -1, EVENT_ADD, false))
+    {
+        return EM_ERROR_EVENT_CTL;
+    }
+
+    /* File descriptor number may have been closed without being deleted
+     * first, in which case its idle timeout, priority and stored event
+     * descriptor belong to a stale registration.
+     */
+    idle_remove(em->idle, ed->fd);
+    priority_reset(em, ed->fd);
+    (void)remove_event_descriptor(em, ed->fd, NULL);
+    ed->idle_timeout = 0;
+    ed->idle_handler = NULL;
+    ed->last_activity = 0;
+
+    if_not_zero (em->latency_mode.socket_busy_poll_usec)
+    {
+        set_socket_busy_poll(ed->fd, em->latency_mode.socket_busy_poll_usec);
+    }
+
+    if_not_null (STORAGE_INSERT(em))
+    {
+        const uint32_t ret = STORAGE_INSERT_ENTRY(em, ed->fd, ed);
+
+        /* File descriptor isn't left registered if it's reported as not
+         * added.
+         */
+        if_em_failure (ret)
+        {
+            const int error = errno;
+
+            (void)change_registration(em, NULL, ed->fd, EVENT_DELETE, true);
+            errno = error;
+        }
+
+        return ret;
+    }
+
+    return EM_SUCCESS;
+}
+
 uint32_t event_machine_delete(EM *const em, const int fd,
     EM_event_descriptor **old_ed)
 {
@@ -528,13 +2019,20 @@ uint32_t event_machine_delete(EM *const em, const int fd,
 
         return EM_ERROR_BADFD;
     }
-    if (is_negative(fcntl(em->queue_fd, F_GETFL, 0))
-        || is_negative(fcntl(fd, F_GETFL, 0)))
+
+    /* File descriptor may have been closed already, which unregistered it,
+     * but its idle timeout still points to event descriptor that caller is
+     * about to free and its priority is still counted.
+     */
+    idle_remove(em->idle, fd);
+    priority_reset(em, fd);
+
+    if (is_closed_fd(em, em->queue_fd) || is_closed_fd(em, fd))
     {
         return EM_ERROR_BADFD;
     }
 
-    if_not_zero (event_ctl(em->queue_fd, NULL, fd, EVENT_DELETE))
+    if_not_zero (change_registration(em, NULL, fd, EVENT_DELETE, true))
     {
         return EM_ERROR_EVENT_CTL;
     }
@@ -562,16 +2060,22 @@ uint32_t event_machine_modify(EM *const em, const int fd,
 
         return EM_ERROR_BADFD;
     }
-    if (is_negative(fcntl(em->queue_fd, F_GETFL, 0))
-        || is_negative(fcntl(fd, F_GETFL, 0)))
+    if (is_closed_fd(em, em->queue_fd) || is_closed_fd(em, fd))
     {
         return EM_ERROR_BADFD;
     }
-
-    if_not_zero (event_ctl(em->queue_fd, ed, -1, EVENT_MODIFY))
+    if_not_zero (change_registration(em, ed, -1, EVENT_MODIFY, true))
     {
+        /* Backend doesn't know the file descriptor, e.g. it was closed.
+         */
+        if (errno == ENOENT || errno == EBADF)
+        {
+            priority_reset(em, fd);
+        }
+
         return EM_ERROR_EVENT_CTL;
     }
+    idle_replace(em->idle, fd, ed);
 
     ret_em_failure_of(ret, remove_event_descriptor(em, fd, old_ed));
     if_not_null (STORAGE_INSERT(em))
@@ -581,3 +2085,174 @@ uint32_t event_machine_modify(EM *const em, const int fd,
 
     return ret;
 }
+
+uint32_t event_machine_set_idle_timeout(EM *const em,
+    EM_event_descriptor *const ed, const uint32_t msec,
+    const EM_idle_handler handler)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (ed)
+    {
+        return EM_ERROR_DESCRIPTOR_NULL;
+    }
+    if_invalid_fd (ed->fd)
+    {
+        errno = EBADF;
+
+        return EM_ERROR_BADFD;
+    }
+
+    if_zero (msec)
+    {
+        idle_remove(em->idle, ed->fd);
+        ed->idle_timeout = 0;
+
+        return EM_SUCCESS;
+    }
+    if_null (handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    if_null (em->idle)
+    {
+        em->idle = calloc(1, sizeof(struct EM_idle_s));
+        if_null (em->idle)
+        {
+            return EM_ERROR_MALLOC;
+        }
+    }
+    struct EM_idle_s *const idle = em->idle;
+
+    if_negative (grow_array((void **)&(idle->index), &(idle->index_size),
+        (size_t)ed->fd + 1, sizeof(uint32_t)))
+    {
+        return EM_ERROR_MALLOC;
+    }
+    if (idle->index[ed->fd] == 0)
+    {
+        if_negative (grow_array((void **)&(idle->heap), &(idle->heap_size),
+            idle->count + 1, sizeof(EM_idle_entry)))
+        {
+            return EM_ERROR_MALLOC;
+        }
+        idle->count++;
+        idle->index[ed->fd] = (uint32_t)idle->count;
+    }
+
+    /* Loop time isn't maintained while there are no idle timeouts and even
+     * if it is, handlers may have been running for a while. It's left as it
+     * is, since it marks start of current iteration for metrics and time
+     * budget of next-tick tasks.
+     */
+    ed->idle_timeout = msec;
+    ed->idle_handler = handler;
+    ed->last_activity = monotonic_nsec();
+
+    const size_t i = idle->index[ed->fd] - 1;
+    idle_place(idle, i, (EM_idle_entry){idle_deadline(ed), ed});
+    idle_sift(idle, i);
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_enable_metrics(EM *const em, const char *const path)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    EM_metrics *const metrics = null(path)
+        ? calloc(1, sizeof(EM_metrics))
+        : metrics_map(path);
+    if_null (metrics)
+    {
+        return null(path) ? EM_ERROR_MALLOC : EM_ERROR_MMAP;
+    }
+
+    if_not_null (em->metrics)
+    {
+        (*metrics) = (*em->metrics);
+        metrics_free(em->metrics, em->metrics_mapped);
+    }
+    else
+    {
+        metrics->timestamp = monotonic_nsec();
+    }
+    metrics->magic = EM_METRICS_MAGIC;
+    metrics->version = EM_METRICS_VERSION;
+    metrics->size = sizeof(EM_metrics);
+    metrics->max_events = em->max_events;
+
+    em->metrics = metrics;
+    em->metrics_mapped = not_null(path);
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_metrics(const EM *const em, EM_metrics *const metrics)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (metrics)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if_null (em->metrics)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    (*metrics) = (*em->metrics);
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_set_hooks(EM *const em, const EM_hooks *const hooks)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    em->hooks = hooks;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_machine_lookup(EM *const em, const int fd,
+    EM_event_descriptor **const ed)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (ed)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if_invalid_fd (fd)
+    {
+        errno = EBADF;
+
+        return EM_ERROR_BADFD;
+    }
+    if_null (STORAGE_LOOKUP(em))
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    (*ed) = STORAGE_LOOKUP_ENTRY(em, fd);
+    if_null (*ed)
+    {
+        return EM_ERROR_STORAGE_NO_SUCH_ENTRY;
+    }
+
+    return EM_SUCCESS;
+}
@@ -35,6 +35,21 @@
  * Simple low-level event machine based on Linux <tt>epoll</tt> or FreeBSD
  * <tt>kqueue</tt>.
  *
+ * On Linux it is also possible to use <tt>io_uring</tt> instead of
+ * <tt>epoll</tt> by compiling the library with <tt>USE_IO_URING</tt> instead
+ * of <tt>USE_EPOLL</tt>. In such case registration changes are queued and
+ * submitted in batches together with waiting for events, i.e. using only one
+ * system call per event loop iteration. Event handlers and #EM_event_descriptor
+ * work the same way as with <tt>epoll</tt>, events are reported using
+ * <tt>EPOLL*</tt> constants. Only difference is that closing file descriptor
+ * doesn't unregister it, closing it without calling event_machine_delete()
+ * first is not supported with this backend. Poll request would keep the
+ * file open, e.g. socket wouldn't be released, its event descriptor could be
+ * dispatched after it was freed, and registering reused file descriptor
+ * number would fail with <tt>EEXIST</tt>. Flag <tt>EPOLLEXCLUSIVE</tt> isn't
+ * supported, registration using it fails with <tt>EINVAL</tt>, and
+ * <tt>EPOLLET</tt> may report one wakeup more than once per batch.
+ *
  * Usage examples can be found here:
  *
  * @li @link example/stdin-stdout.c @endlink
@@ -56,6 +71,10 @@
  * @example example/tcp-server.c
  *   Simple TCP server that reads data from clients and prints it to stdout.
  *   For details see mentioned @link example/stdin-stdout.c @endlink.
+ *
+ * @example example/metrics-reader.c
+ *   Samples stats file exported by event_machine_enable_metrics() of another
+ *   process and prints loop rates and saturation once per second.
  */
 
 #ifndef EVENT_MACHINE_H_230071399244842574860511267360184913417
@@ -64,7 +83,11 @@
 #if defined(USE_EPOLL) && defined(USE_KQUEUE)
 #error USE_EPOLL and USE_KQUEUE are mutually exculisive.
 #endif
+#if defined(USE_IO_URING) && (defined(USE_EPOLL) || defined(USE_KQUEUE))
+#error USE_IO_URING is mutually exclusive with USE_EPOLL and USE_KQUEUE.
+#endif
 
+#include "event-machine/metrics.h"
 #include "event-machine/result.h"
 #include <stddef.h>     /* size_t */
 #include <stdbool.h>
@@ -72,7 +95,7 @@
 
 /* {{{ Platform Dependent Imports ********************************************/
 
-#ifdef USE_EPOLL
+#if defined(USE_EPOLL) || defined(USE_IO_URING)
 #include <sys/epoll.h>
 #endif /* HAVE_EPOLL */
 
@@ -88,13 +111,13 @@ extern "C" {
 
 /* {{{ Platform Dependent Code ***********************************************/
 
-#if USE_EPOLL
+#if defined(USE_EPOLL) || defined(USE_IO_URING)
 #define EVENT_READ  EPOLLIN
 #define EVENT_WRITE EPOLLOUT
 
 typedef struct epoll_event event_t;
 typedef uint32_t event_filter_t;
-#endif /* USE_EPOLL */
+#endif /* USE_EPOLL || USE_IO_URING */
 
 #if USE_KQUEUE
 #define EVENT_READ  EVFILT_READ
@@ -111,7 +134,32 @@ typedef int16_t event_filter_t;
  */
 #define EM_DEFAULT_MAX_EVENTS   4096
 
-struct EM_s;    /* Forward declaration */
+/** Number of dispatch priorities, valid values passed to
+ * event_machine_set_priority() are from 0 to <tt>EM_PRIORITY_LEVELS - 1</tt>.
+ */
+#define EM_PRIORITY_LEVELS      4
+
+/** Number of consecutive batches without event of non-zero priority after
+ * which priorities of closed file descriptors are cleared.
+ *
+ * @see event_machine_set_priority()
+ */
+#define EM_PRIORITY_SWEEP_BATCHES   1024
+
+/** Default value of <tt>priority_burst</tt> field of #EM.
+ *
+ * @see event_machine_set_priority_burst()
+ */
+#define EM_DEFAULT_PRIORITY_BURST   64
+
+struct EM_s;        /* Forward declaration */
+struct EM_ring_s;   /* Forward declaration, private to io_uring backend. */
+struct EM_journal_s;    /* Forward declaration, private. */
+struct EM_idle_s;       /* Forward declaration, private. */
+struct EM_profile_s;    /* Forward declaration, private. */
+struct EM_output_s;     /* Forward declaration, see event-output.h. */
+struct EM_buffer_pool_s; /* Forward declaration, see event-buffer.h. */
+struct Event_timer_s;   /* Forward declaration, see event-timer.h. */
 
 /** Type of callbacks triggered by event.
  *
@@ -132,6 +180,66 @@ struct EM_s;    /* Forward declaration */
 typedef void (*EM_event_handler)(struct EM_s *event_machine,
     event_filter_t events, int fd, void *data);
 
+/** Type of callbacks triggered when no event occurred on a file descriptor
+ * for longer than its idle timeout.
+ *
+ * @param[in] event_machine
+ *   #EM (event machine) that invoked this callback function.
+ *
+ * @param[in] fd
+ *   File descriptor that was idle.
+ *
+ * @param[in] data
+ *   Pointer to private data associated with this specific file descriptor
+ *   via EM_event_descriptor.
+ *
+ * @see event_machine_set_idle_timeout()
+ */
+typedef void (*EM_idle_handler)(struct EM_s *event_machine, int fd,
+    void *data);
+
+/** Type of callbacks of tasks posted using event_machine_post() or
+ * event_machine_post_task().
+ *
+ * @param[in] event_machine
+ *   #EM (event machine) whose thread executes the task.
+ *
+ * @param[in] data
+ *   Pointer to private data passed to event_machine_post() or stored in
+ *   EM_task.
+ */
+typedef void (*EM_task_handler)(struct EM_s *event_machine, void *data);
+
+/** Task executed by event machine thread on behalf of another thread.
+ *
+ * Tasks are intrusive, i.e. event machine doesn't allocate anything when
+ * instance of this structure is passed to event_machine_post_task(). It has
+ * to stay allocated until its handler is invoked, handler itself may free
+ * it.
+ */
+typedef struct EM_task_s
+{
+    /** Next task in a queue. Managed by event machine.
+     */
+    struct EM_task_s *next;
+
+    /** Function executed by event machine thread. It may not be
+     * <tt>NULL</tt>.
+     */
+    EM_task_handler handler;
+
+    /** Private user data passed to handler as is.
+     *
+     * Value may be <tt>NULL</tt>.
+     */
+    void *data;
+
+    /** Set to true if task was allocated by event_machine_post() and it has
+     * to be freed after handler returns.
+     */
+    bool do_free;
+} EM_task;
+
 /** Structure that describes set of events that event machine monitors on
  * specific file descriptor.
  *
@@ -187,26 +295,93 @@ typedef struct
     /** Event handler invoked when any registered event occures.
      */
     EM_event_handler handler;
+
+    /** Idle timeout in miliseconds, or 0 if there is none. Managed by event
+     * machine, it's cleared by event_machine_add().
+     *
+     * @see event_machine_set_idle_timeout()
+     */
+    uint32_t idle_timeout;
+
+    /** Callback invoked when idle timeout expires. Managed by event machine.
+     */
+    EM_idle_handler idle_handler;
+
+    /** Time of last activity on the file descriptor, in nanoseconds of
+     * <tt>CLOCK_MONOTONIC</tt>. Managed by event machine, used only if
+     * <tt>idle_timeout</tt> is non-zero.
+     *
+     * @see event_machine_touch()
+     */
+    uint64_t last_activity;
 } EM_event_descriptor;
 
+/** Type of callbacks notified about deferred registration changes that
+ * failed.
+ *
+ * Callback is invoked at the end of main loop iteration, after event
+ * handlers returned, therefore registration changes it makes are applied
+ * immediately. It may not disable deferring of changes.
+ *
+ * @param[in] event_machine
+ *   Event machine that applied the change.
+ *
+ * @param[in] fd
+ *   File descriptor whose registration failed.
+ *
+ * @param[in] event_descriptor
+ *   Intended registration, or <tt>NULL</tt> if file descriptor was being
+ *   removed.
+ *
+ * @param[in] error
+ *   Value of <tt>errno</tt> set by event queue.
+ *
+ * @param[in] data
+ *   Pointer passed to event_machine_set_change_error_handler().
+ *
+ * @see event_machine_defer_changes()
+ */
+typedef void (*EM_change_error_handler)(struct EM_s *event_machine, int fd,
+    EM_event_descriptor *event_descriptor, int error, void *data);
+
+/** Callbacks of a storage that maps file descriptors to event descriptors
+ * registered for them.
+ *
+ * All callbacks get value of <tt>data</tt> field as their first argument.
+ * Ready to use implementations can be found in event-storage.h.
+ */
 typedef struct
 {
     /** Function called by <tt>event_machine_add()</tt> and
      * <tt>event_machine_modify()</tt> when registering event descriptor.
      *
+     * Has to return #EM_ERROR_STORAGE_DUPLICATE_ENTRY if there already is
+     * an event descriptor stored for the same file descriptor.
+     *
      * If this field is <tt>NULL</tt> then event descriptors aren't stored.
      */
-    uint32_t (*insert)(int, EM_event_descriptor *);
+    uint32_t (*insert)(void *data, int fd, EM_event_descriptor *ed);
 
     /** Function called by <tt>event_machine_delete()</tt> and
      * <tt>event_machine_modify()</tt> when event descriptor is being
      * unregistered.
      *
+     * Has to return #EM_ERROR_STORAGE_NO_SUCH_ENTRY if there is no event
+     * descriptor stored for the file descriptor.
+     *
      * If this field is <tt>NULL</tt>, then event descriptors can't be
      * retrieved again. It is perfectly find to define <tt>insert</tt>, but not
      * <tt>remove</tt>.
      */
-    uint32_t (*remove)(int, EM_event_descriptor **);
+    uint32_t (*remove)(void *data, int fd, EM_event_descriptor **ed);
+
+    /** Function called by <tt>event_machine_lookup()</tt>. Returns event
+     * descriptor stored for the file descriptor or <tt>NULL</tt> if there is
+     * none.
+     *
+     * Value may be <tt>NULL</tt> if storage doesn't support lookups.
+     */
+    EM_event_descriptor *(*lookup)(void *data, int fd);
 
     /** Size of private data. See data field documentation for details.
      *
@@ -222,30 +397,229 @@ typedef struct
     void *data;
 } EM_descriptor_storage;
 
-typedef struct EM_s
+/** Latency related settings of an event machine.
+ *
+ * All values are zero by default, which means that event machine blocks in
+ * <tt>epoll_wait()</tt> (or its equivalent) as soon as there are no events
+ * to process.
+ *
+ * @see event_machine_set_latency_mode()
+ */
+typedef struct
 {
-    /** Descriptor for <tt>epoll</tt> or <tt>kqueue</tt> event queue.
+    /** For how long, in microseconds, event machine keeps polling for events
+     * using zero timeout before it blocks.
      *
-     * Used only on systems with epoll() system call (e.g. Linux).
+     * This trades one CPU core for avoiding sleep/wakeup and context switch
+     * on every idle to busy transition. Value 0 disables spinning.
+     */
+    uint32_t spin_usec;
+
+    /** Kernel busy-poll timeout of <tt>epoll</tt> instance in microseconds.
+     * It's set using <tt>EPIOCSPARAMS</tt> <tt>ioctl()</tt> (Linux 6.9 and
+     * newer) and it's supported only by <tt>epoll</tt> backend. Value 0
+     * leaves kernel settings untouched.
+     */
+    uint32_t busy_poll_usec;
+
+    /** Maximum number of packets processed in one busy-poll attempt. Values
+     * above 64 require <tt>CAP_NET_ADMIN</tt>. Used only if
+     * <tt>busy_poll_usec</tt> is non-zero.
+     */
+    uint16_t busy_poll_budget;
+
+    /** Ask kernel to prefer busy-polling over interrupt driven processing.
+     * Used only if <tt>busy_poll_usec</tt> is non-zero.
+     */
+    bool prefer_busy_poll;
+
+    /** Value of <tt>SO_BUSY_POLL</tt> socket option, in microseconds, set on
+     * each socket registered using event_machine_add(). Failures, e.g.
+     * because file descriptor isn't a socket, are ignored. Value 0 leaves
+     * socket options untouched.
+     */
+    uint32_t socket_busy_poll_usec;
+} EM_latency_mode;
+
+/** Callbacks invoked at key points of event machine loop, each of them can be
+ * <tt>NULL</tt>. Same points are also USDT probes if library is built with
+ * <tt>USE_USDT</tt> defined, probes have the same arguments except
+ * <tt>data</tt>.
+ *
+ * Hooks are invoked by the thread running event machine and they should be
+ * cheap, they are meant for tracing and measurements.
+ *
+ * @see event_machine_set_hooks()
+ */
+typedef struct
+{
+    /** Invoked before waiting for events, <tt>timeout</tt> is in
+     * miliseconds and it's negative if event machine waits indefinitely.
+     *
+     * Probe <tt>event_machine:wait__start</tt>.
+     */
+    void (*before_wait)(struct EM_s *event_machine, int timeout, void *data);
+
+    /** Invoked after waiting for events returned <tt>num_events</tt>, which
+     * is negative on failure.
+     *
+     * Probe <tt>event_machine:wait__done</tt>.
+     */
+    void (*after_wait)(struct EM_s *event_machine, int num_events,
+        void *data);
+
+    /** Invoked before event handler of file descriptor <tt>fd</tt> is
+     * invoked.
+     *
+     * Probe <tt>event_machine:dispatch__start</tt>.
+     */
+    void (*before_dispatch)(struct EM_s *event_machine, int fd,
+        event_filter_t events, void *data);
+
+    /** Invoked after event handler of file descriptor <tt>fd</tt> returned.
+     * Event descriptor may not exist any more.
+     *
+     * Probe <tt>event_machine:dispatch__done</tt>.
+     */
+    void (*after_dispatch)(struct EM_s *event_machine, int fd,
+        event_filter_t events, void *data);
+
+    /** Invoked when registration of file descriptor is passed to event
+     * queue, <tt>operation</tt> is e.g. <tt>EPOLL_CTL_ADD</tt>. Registration
+     * changes deferred by event_machine_defer_changes() are reported when
+     * they are applied.
+     *
+     * Probe <tt>event_machine:ctl</tt>.
+     */
+    void (*ctl)(struct EM_s *event_machine, int fd, int operation,
+        void *data);
+
+    /** Invoked when timer expired, before its callback is invoked.
+     * Argument <tt>overruns</tt> is number of expirations reported by this
+     * invocation.
+     *
+     * Probe <tt>event_machine:timer__expire</tt>.
+     */
+    void (*timer_expire)(struct EM_s *event_machine,
+        struct Event_timer_s *timer, uint64_t overruns, void *data);
+
+    /** Pointer passed to all hooks.
+     */
+    void *data;
+} EM_hooks;
+
+/** How thoroughly event machine checks file descriptors passed to it.
+ *
+ * @see event_machine_set_validation()
+ */
+typedef enum
+{
+    /** Check every file descriptor, including the one of event queue, using
+     * <tt>fcntl(fd, F_GETFL)</tt> before it's used, so that closed file
+     * descriptor is reported as #EM_ERROR_BADFD. Costs one or two additional
+     * system calls per registration change.
+     */
+    EM_VALIDATE_ALWAYS = 0,
+
+    /** Trust the caller and only reject negative file descriptors. Closed
+     * file descriptor is reported by the system call that uses it, e.g. as
+     * #EM_ERROR_EVENT_CTL.
+     */
+    EM_VALIDATE_TRUSTED = 1
+} EM_validation;
+
+/** Validation policy used by <tt>EM_STATIC_WITH_MAX_EVENTS</tt> and
+ * <tt>EM_STATIC_DEFAULT</tt>.
+ *
+ * Unless defined before this header is included, it's
+ * #EM_VALIDATE_TRUSTED if <tt>NDEBUG</tt> is defined and #EM_VALIDATE_ALWAYS
+ * otherwise.
+ */
+#ifndef EM_DEFAULT_VALIDATION
+#ifdef NDEBUG
+#define EM_DEFAULT_VALIDATION   EM_VALIDATE_TRUSTED
+#else
+#define EM_DEFAULT_VALIDATION   EM_VALIDATE_ALWAYS
+#endif /* NDEBUG */
+#endif /* EM_DEFAULT_VALIDATION */
+
+typedef struct EM_s
+{
+    /** Descriptor for <tt>epoll</tt>, <tt>io_uring</tt> or <tt>kqueue</tt>
+     * event queue.
      *
      * @default -1
      */
     int queue_fd;
 
-    /** Pipe used for breaking main processing loop in which
-     * <tt>epoll_wait()</tt> or <tt>kevent()/kevent64()</tt> is invoked
+#ifdef USE_IO_URING
+    /** Memory mapped submission and completion rings associated with
+     * <tt>queue_fd</tt>. Allocated by event_machine_init() and freed by
+     * event_machine_destroy().
+     *
+     * @default NULL
+     */
+    struct EM_ring_s *ring;
+#endif /* USE_IO_URING */
+
+    /** Pipe used for waking up main processing loop in which
+     * <tt>epoll_wait()</tt> or <tt>kevent()/kevent64()</tt> is invoked,
+     * either to break it or to execute posted tasks.
+     *
+     * When compiled with <tt>USE_EVENTFD</tt> then both entries contain the
+     * same <tt>eventfd</tt> file descriptor.
      *
      * @see event_machine_run()
+     * @see event_machine_terminate()
+     * @see event_machine_post()
      */
     int break_loop_pipe[2];
 
     /** Event descriptor used for registering read end of pipe used for
-     * breaking main processing loop.
+     * waking up main processing loop.
      *
      * @see #break_loop_pipe
      */
     EM_event_descriptor break_loop_event_descriptor;
 
+    /** Non-zero if event_machine_terminate() was called and main loop
+     * hasn't noticed it, yet. Accessed atomically.
+     */
+    uint32_t break_loop_requested;
+
+    /** Non-zero if main loop is awake, or if wakeup notification was already
+     * written in to #break_loop_pipe. In both cases main loop will execute
+     * posted tasks without any further notification, therefore posting
+     * threads skip writing in to the pipe. Accessed atomically.
+     */
+    uint32_t wakeup_pending;
+
+    /** Tasks posted by other threads in reverse order. Accessed atomically.
+     *
+     * @see event_machine_post()
+     */
+    EM_task *posted_tasks;
+
+    /** Tasks deferred by the event machine thread itself, in the order they
+     * were queued. Accessed only by the event machine thread.
+     *
+     * @default NULL
+     *
+     * @see event_machine_next_tick()
+     */
+    EM_task *next_tick_head;
+    EM_task *next_tick_tail;
+
+    /** Maximum time, in microseconds, that one main loop iteration spends
+     * dispatching events and deferred tasks before remaining deferred tasks
+     * are left for the next iteration. Value 0 means no limit.
+     *
+     * @default 0
+     *
+     * @see event_machine_set_tick_budget()
+     */
+    uint32_t tick_budget_usec;
+
     /** Maximum number of events returned by <tt>epoll_wait()</tt> or
      * <tt>kevent()</tt> system call in one batch.
      *
@@ -277,6 +651,153 @@ typedef struct EM_s
     bool do_free_events;
 
     EM_descriptor_storage descriptor_storage;
+
+    /** Spinning and busy-polling settings.
+     *
+     * @see event_machine_set_latency_mode()
+     */
+    EM_latency_mode latency_mode;
+
+    /** Whether file descriptors are checked using <tt>fcntl()</tt> before
+     * they are used.
+     *
+     * @default EM_DEFAULT_VALIDATION
+     *
+     * @see event_machine_set_validation()
+     */
+    EM_validation validation;
+
+    /** True while main loop executes event handlers and posted tasks.
+     */
+    bool dispatching;
+
+    /** After this many consecutive events of higher priority one event of
+     * the lowest pending priority is dispatched, 0 means strict priority
+     * order.
+     *
+     * @default EM_DEFAULT_PRIORITY_BURST
+     *
+     * @see event_machine_set_priority_burst()
+     */
+    uint32_t priority_burst;
+
+    /** Dispatch priorities indexed by file descriptor, allocated when first
+     * non-zero priority is set. File descriptors beyond
+     * <tt>priorities_size</tt> have priority 0.
+     *
+     * @default NULL
+     *
+     * @see event_machine_set_priority()
+     */
+    uint8_t *priorities;
+    size_t priorities_size;
+
+    /** Number of registered file descriptors with non-zero priority. While
+     * it's 0 batches are dispatched in the order they were received.
+     */
+    size_t num_prioritized;
+
+    /** Number of consecutive batches without event of non-zero priority
+     * since priorities were last checked for closed file descriptors.
+     */
+    uint32_t unprioritized_batches;
+
+    /** Dispatch order of current batch, allocated when first batch with
+     * different priorities is received.
+     *
+     * @default NULL
+     */
+    int *dispatch_order;
+
+    /** Registration changes made while dispatching that are applied at the
+     * end of current main loop iteration. If it's <tt>NULL</tt>, then
+     * changes are applied immediately.
+     *
+     * @default NULL
+     *
+     * @see event_machine_defer_changes()
+     */
+    struct EM_journal_s *journal;
+
+    /** Callback notified about deferred registration changes that failed,
+     * or <tt>NULL</tt>.
+     *
+     * @default NULL
+     *
+     * @see event_machine_set_change_error_handler()
+     */
+    EM_change_error_handler change_error_handler;
+
+    /** Pointer passed to <tt>change_error_handler</tt>.
+     *
+     * @default NULL
+     */
+    void *change_error_data;
+
+    /** Deadlines of file descriptors with idle timeout. Allocated by first
+     * event_machine_set_idle_timeout() call.
+     *
+     * @default NULL
+     */
+    struct EM_idle_s *idle;
+
+    /** Time, in nanoseconds of <tt>CLOCK_MONOTONIC</tt>, when main loop
+     * last returned from waiting for events. Updated only while there are
+     * file descriptors with idle timeout, metrics are maintained or there is
+     * a time budget.
+     *
+     * @see event_machine_touch()
+     */
+    uint64_t loop_time;
+
+    /** Counters describing main loop, or <tt>NULL</tt> if they aren't
+     * maintained.
+     *
+     * @default NULL
+     *
+     * @see event_machine_enable_metrics()
+     */
+    EM_metrics *metrics;
+
+    /** True if <tt>metrics</tt> point to memory mapped stats file.
+     *
+     * @default false
+     */
+    bool metrics_mapped;
+
+    /** Histograms of event handler durations, or <tt>NULL</tt> if they
+     * aren't measured.
+     *
+     * @default NULL
+     *
+     * @see event_profile_enable()
+     */
+    struct EM_profile_s *profile;
+
+    /** Tracing hooks, or <tt>NULL</tt>.
+     *
+     * @default NULL
+     *
+     * @see event_machine_set_hooks()
+     */
+    const EM_hooks *hooks;
+
+    /** Output queues that received data during current main loop iteration
+     * and are flushed at its end.
+     *
+     * @default NULL
+     *
+     * @see event_output_write()
+     */
+    struct EM_output_s *output_pending;
+
+    /** Pool of read buffers trimmed by event machine, or <tt>NULL</tt>.
+     *
+     * @default NULL
+     *
+     * @see event_buffer_pool_init()
+     */
+    struct EM_buffer_pool_s *buffer_pool;
 } EM;
 
 /** Initialize #EM structure.
@@ -356,6 +877,325 @@ uint32_t event_machine_run(EM *event_machine);
  */
 uint32_t event_machine_terminate(EM *event_machine);
 
+/** Execute function in event machine thread.
+ *
+ * Task is queued and executed after the event machine finishes processing
+ * of current batch of events. This function is safe to call from any thread
+ * including the event machine thread itself. Tasks posted from one thread
+ * are executed in the same order as they were posted.
+ *
+ * Event machine is woken up only if it's blocked waiting for events and
+ * there isn't a wakeup already pending, therefore posting many tasks in a
+ * row costs at most one system call.
+ *
+ * Tasks that weren't executed before event_machine_destroy() are discarded.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine instance function operates on.
+ *
+ * @param[in] handler
+ *   Function to execute. It may not be <tt>NULL</tt>.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>handler</tt>. Value may be <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL if <tt>handler</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if task couldn't be allocated. Use
+ *   event_machine_post_task() to avoid allocation.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_post(EM *event_machine, EM_task_handler handler,
+    void *data);
+
+/** Same as event_machine_post(), but uses caller supplied task structure
+ * and therefore it doesn't allocate any memory.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine instance function operates on.
+ *
+ * @param[in] task
+ *   Task with <tt>handler</tt> and <tt>data</tt> filled in. It has to stay
+ *   allocated until its handler is invoked and it may not be posted again
+ *   before that.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_post_task(EM *event_machine, EM_task *task);
+
+/** Defer function call to the end of current main loop iteration.
+ *
+ * Deferred tasks are executed after events of current batch, posted tasks
+ * and idle timeouts were handled, in the order they were queued. Tasks
+ * queued by deferred tasks themselves are executed in the next iteration,
+ * which makes it possible to split long running job in to slices without
+ * blocking other events. While there are deferred tasks, event machine
+ * doesn't block waiting for events.
+ *
+ * Unlike event_machine_post() it may be called only from the event machine
+ * thread, e.g. from event handlers, and it never wakes up the event
+ * machine.
+ *
+ * Tasks that weren't executed before event_machine_destroy() are discarded.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine instance function operates on.
+ *
+ * @param[in] handler
+ *   Function to execute. It may not be <tt>NULL</tt>.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>handler</tt>. Value may be <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL if <tt>handler</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if task couldn't be allocated. Use
+ *   event_machine_next_tick_task() to avoid allocation.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ *
+ * @see event_machine_set_tick_budget()
+ */
+uint32_t event_machine_next_tick(EM *event_machine, EM_task_handler handler,
+    void *data);
+
+/** Same as event_machine_next_tick(), but uses caller supplied task
+ * structure and therefore it doesn't allocate any memory.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine instance function operates on.
+ *
+ * @param[in] task
+ *   Task with <tt>handler</tt> and <tt>data</tt> filled in. It has to stay
+ *   allocated until its handler is invoked and it may not be queued again
+ *   before that.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_next_tick_task(EM *event_machine, EM_task *task);
+
+/** Limit time spent by one main loop iteration.
+ *
+ * Time is measured from the moment event machine stops waiting for events.
+ * When it's exceeded, then remaining deferred tasks are left for the next
+ * iteration, which checks for new events first, without blocking. At least
+ * one deferred task is executed in each iteration. Event handlers are never
+ * interrupted, therefore the limit holds only if they defer long running
+ * work in to short deferred tasks.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] usec
+ *   Time budget in microseconds, 0 means no limit.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_set_tick_budget(EM *event_machine, uint32_t usec);
+
+/** Change latency mode of an event machine.
+ *
+ * Usage example:
+ *
+ * @code{.c}
+ * // ...
+ * EM_latency_mode latency_mode =
+ * {
+ *     // Keep polling for 50us before going to sleep.
+ *     .spin_usec = 50,
+ *
+ *     // Let the kernel busy-poll network device queues for 20us.
+ *     .busy_poll_usec = 20,
+ *     .busy_poll_budget = 64,
+ *     .prefer_busy_poll = true
+ * };
+ *
+ * if_em_failure (event_machine_set_latency_mode(em, &latency_mode))
+ * {
+ *     // Error handling.
+ * }
+ * // ...
+ * @endcode
+ *
+ * @param[in] event_machine
+ *   Initialized event machine instance function operates on.
+ *
+ * @param[in] latency_mode
+ *   New settings, they are copied in to <tt>event_machine</tt>. Value of
+ *   <tt>socket_busy_poll_usec</tt> affects only sockets registered after this
+ *   call.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if kernel busy-polling was
+ *   requested, but it's not supported by the backend the library was
+ *   compiled with.
+ *
+ * @return
+ *   Returns #EM_ERROR_IOCTL if setting <tt>epoll</tt> busy-poll parameters
+ *   failed. Read value of <tt>errno</tt> for details.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_set_latency_mode(EM *event_machine,
+    const EM_latency_mode *latency_mode);
+
+/** Set dispatch priority of registered file descriptor.
+ *
+ * Within each batch events of file descriptors with higher priority are
+ * dispatched before the others, e.g. health checks before bulk data
+ * transfers. Priority is reset to 0 by event_machine_add() and
+ * event_machine_delete(), and kept by event_machine_modify(). Therefore it
+ * has to be set after file descriptor is added, priority set before
+ * event_machine_add() is lost.
+ *
+ * Priority of file descriptor that was closed without being deleted is
+ * cleared once event machine notices it, i.e. when its number is added
+ * again, or when it's found closed by a check that runs after
+ * #EM_PRIORITY_SWEEP_BATCHES consecutive batches without any prioritized
+ * event.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] fd
+ *   File descriptor registered using event_machine_add().
+ *
+ * @param[in] priority
+ *   From 0 (default) to <tt>EM_PRIORITY_LEVELS - 1</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if <tt>priority</tt> isn't less
+ *   than #EM_PRIORITY_LEVELS.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ *
+ * @see event_machine_set_priority_burst()
+ */
+uint32_t event_machine_set_priority(EM *event_machine, int fd,
+    uint32_t priority);
+
+/** Set starvation protection of low priority events.
+ *
+ * Within each batch events are dispatched in order of priority of their
+ * file descriptors, see event_machine_set_priority(). To keep latency of
+ * lower priorities bounded even if a batch is full of higher priority
+ * events, one event of the lowest pending priority is dispatched after each
+ * <tt>burst</tt> consecutive events of higher priorities.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] burst
+ *   Maximum number of consecutive higher priority events dispatched while
+ *   there are pending lower priority events, 0 means strict priority order.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_set_priority_burst(EM *event_machine, uint32_t burst);
+
+/** Set how thoroughly event machine checks file descriptors passed to it.
+ *
+ * Checks done by #EM_VALIDATE_ALWAYS are useful while debugging, but
+ * they double or triple number of system calls done by event_machine_add(),
+ * event_machine_modify() and event_machine_delete(). Production code that
+ * doesn't pass closed file descriptors to event machine can switch to
+ * #EM_VALIDATE_TRUSTED.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] validation
+ *   Either #EM_VALIDATE_ALWAYS or #EM_VALIDATE_TRUSTED.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if <tt>validation</tt> isn't one of
+ *   the above values.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_set_validation(EM *event_machine,
+    EM_validation validation);
+
+/** Enable or disable deferring of registration changes made by event
+ * handlers.
+ *
+ * When enabled, event_machine_add(), event_machine_modify() and
+ * event_machine_delete() called while event machine dispatches events only
+ * record intended registration of a file descriptor. Only net change is
+ * applied, once per file descriptor, at the end of current main loop
+ * iteration. For example adding and deleting the same file descriptor
+ * cancel out, and turning <tt>EVENT_WRITE</tt> on and off results in at
+ * most one <tt>epoll_ctl()</tt> call.
+ *
+ * Descriptor storage is still updated immediately. Failure of a deferred
+ * change affects only its file descriptor, it's reported to callback set by
+ * event_machine_set_change_error_handler() and event machine keeps running.
+ * Removing file descriptors that were already closed isn't a failure.
+ *
+ * Calls made outside of event handlers are always applied immediately.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine instance function operates on.
+ *
+ * @param[in] enable
+ *   Enable deferring if true, disable it otherwise.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if called from an event handler.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if journal couldn't be allocated.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_defer_changes(EM *event_machine, bool enable);
+
+/** Set callback notified about deferred registration changes that failed.
+ * Without it such failures are ignored.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] handler
+ *   Callback, or <tt>NULL</tt> to remove it.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>handler</tt>. Value may be <tt>NULL</tt>.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ *
+ * @see event_machine_defer_changes()
+ */
+uint32_t event_machine_set_change_error_handler(EM *event_machine,
+    EM_change_error_handler handler, void *data);
+
 /** Register file descriptor for specified event with its associated data and
  * handler.
  *
@@ -363,6 +1203,11 @@ uint32_t event_machine_terminate(EM *event_machine);
  * event_machine_add() since it doesn't make any copies and therefore it would
  * cause inconistencies.
  *
+ * If the same file descriptor number was closed without being deleted, its
+ * stale entry in descriptor storage is replaced. If storing event descriptor
+ * fails, then file descriptor is unregistered again before error is
+ * returned.
+ *
  * Usage example:
  *
  * @code{.c}
@@ -464,6 +1309,178 @@ uint32_t event_machine_modify(EM *event_machine, int fd,
     EM_event_descriptor *event_descriptor,
     EM_event_descriptor **old_event_descriptor);
 
+/** Find event descriptor registered for a file descriptor.
+ *
+ * Requires descriptor storage that supports lookups, see event-storage.h for
+ * implementations shipped with the library.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] fd
+ *   File descriptor that caller wants to find event descriptor for.
+ *
+ * @param[out] event_descriptor
+ *   Event descriptor registered for <tt>fd</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL if descriptor storage doesn't support
+ *   lookups.
+ *
+ * @return
+ *   Returns #EM_ERROR_STORAGE_NO_SUCH_ENTRY if there is no event descriptor
+ *   stored for <tt>fd</tt>.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_lookup(EM *event_machine, int fd,
+    EM_event_descriptor **event_descriptor);
+
+/** Set idle timeout of a registered file descriptor.
+ *
+ * If no event is dispatched for the file descriptor for <tt>msec</tt>
+ * miliseconds, then <tt>handler</tt> is invoked, usually to close the
+ * connection. Event machine tracks time of last event itself, event handlers
+ * don't have to do anything. Activity that isn't visible to event machine,
+ * e.g. data sent to the peer, can be recorded using event_machine_touch().
+ *
+ * All deadlines are kept in one structure and event machine derives timeout
+ * of <tt>epoll_wait()</tt> from the earliest of them, there are no timers or
+ * system calls per file descriptor. Idle timeouts are checked after events
+ * of each main loop iteration are dispatched.
+ *
+ * Timeout is one shot, once it expires it's cleared and it can be set again.
+ * It's also cleared by event_machine_delete(), while event_machine_modify()
+ * moves it to the new event descriptor.
+ *
+ * Event machine keeps pointer to <tt>event_descriptor</tt> until timeout is
+ * cleared, therefore file descriptor with idle timeout has to be deleted
+ * using event_machine_delete() before its event descriptor is freed. Closing
+ * file descriptor isn't enough, <tt>epoll</tt> forgets it without event
+ * machine knowing about it. Calling event_machine_delete() after
+ * <tt>close()</tt> is fine, it fails with #EM_ERROR_BADFD, but the timeout is
+ * cleared.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] event_descriptor
+ *   Event descriptor registered using event_machine_add().
+ *
+ * @param[in] msec
+ *   Idle timeout in miliseconds, or 0 to remove it.
+ *
+ * @param[in] handler
+ *   Callback invoked when timeout expires. Can be <tt>NULL</tt> only if
+ *   <tt>msec</tt> is 0.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL if <tt>handler</tt> is <tt>NULL</tt> and
+ *   <tt>msec</tt> isn't 0.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if memory allocation failed.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_set_idle_timeout(EM *event_machine,
+    EM_event_descriptor *event_descriptor, uint32_t msec,
+    EM_idle_handler handler);
+
+/** Record activity on a file descriptor that has idle timeout, which
+ * postpones the timeout. It's only a store of a timestamp cached by the
+ * main loop, therefore it's cheap enough to be called on every write.
+ *
+ * Events dispatched by event machine are recorded automatically.
+ *
+ * @param[in] event_machine
+ *   Event machine in which event descriptor is registered.
+ *
+ * @param[in] event_descriptor
+ *   Event descriptor registered in event machine.
+ */
+static inline void event_machine_touch(const EM *event_machine,
+    EM_event_descriptor *event_descriptor)
+{
+    event_descriptor->last_activity = event_machine->loop_time;
+}
+
+/** Start maintaining #EM_metrics counters of event machine.
+ *
+ * Counters are updated by the thread running event machine without atomic
+ * operations, it costs two <tt>clock_gettime()</tt> calls per main loop
+ * iteration and a few increments.
+ *
+ * If <tt>path</tt> isn't <tt>NULL</tt>, then counters are stored in a file
+ * of that name, which is created or truncated and memory mapped. External
+ * tool can then sample them by mapping the same file, without stopping or
+ * otherwise disturbing the process. Using file on <tt>tmpfs</tt>, e.g. in
+ * <tt>/dev/shm</tt>, avoids any disk writes. File isn't removed by
+ * event_machine_destroy(), counters stay readable after process exits. See
+ * @link example/metrics-reader.c @endlink.
+ *
+ * Calling this function again moves counters to a new location, values are
+ * preserved. It must not be called while event_machine_run() is running.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] path
+ *   Path of stats file, or <tt>NULL</tt> if counters should be kept only in
+ *   private memory.
+ *
+ * @return
+ *   Returns #EM_ERROR_MMAP if stats file couldn't be created or mapped.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_enable_metrics(EM *event_machine, const char *path);
+
+/** Copy current values of event machine counters.
+ *
+ * It may be called from any thread, counters read while event machine is
+ * running may come from adjacent main loop iterations.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[out] metrics
+ *   Buffer where counters are copied.
+ *
+ * @return
+ *   Returns #EM_ERROR_BUFFER_NULL if <tt>metrics</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if metrics weren't enabled using
+ *   event_machine_enable_metrics().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_metrics(const EM *event_machine, EM_metrics *metrics);
+
+/** Set tracing hooks invoked at key points of event machine loop.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] hooks
+ *   Hooks that are used until they are changed, therefore they have to stay
+ *   valid, or <tt>NULL</tt> to remove hooks.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_machine_set_hooks(EM *event_machine, const EM_hooks *hooks);
+
 /** Statically set user specified entries of #EM structure.
  *
  * Usage example:
@@ -492,6 +1509,29 @@ uint32_t event_machine_modify(EM *event_machine, int fd,
 #define EM_STATIC_WITH_MAX_EVENTS(maxevs, evs)  \
     { .queue_fd = -1                            \
     , .break_loop_pipe = {-1, -1}               \
+    , .break_loop_requested = 0                 \
+    , .wakeup_pending = 0                       \
+    , .posted_tasks = NULL                      \
+    , .next_tick_head = NULL                    \
+    , .next_tick_tail = NULL                    \
+    , .tick_budget_usec = 0                     \
+    , .validation = EM_DEFAULT_VALIDATION       \
+    , .priority_burst = EM_DEFAULT_PRIORITY_BURST \
+    , .priorities = NULL                        \
+    , .priorities_size = 0                      \
+    , .num_prioritized = 0                      \
+    , .unprioritized_batches = 0                \
+    , .dispatch_order = NULL                    \
+    , .dispatching = false                      \
+    , .journal = NULL                           \
+    , .change_error_handler = NULL              \
+    , .change_error_data = NULL                 \
+    , .idle = NULL                              \
+    , .loop_time = 0                            \
+    , .metrics = NULL                           \
+    , .metrics_mapped = false                   \
+    , .profile = NULL                           \
+    , .hooks = NULL                             \
     , .break_loop_event_descriptor =            \
         { .events = 0                           \
         , .fd = -1                              \
@@ -503,6 +1543,7 @@ uint32_t event_machine_modify(EM *event_machine, int fd,
     , .descriptor_storage =                     \
         { .insert = NULL                        \
         , .remove = NULL                        \
+        , .lookup = NULL                        \
         , .data_size = 0                        \
         , .data = NULL                          \
         }                                       \
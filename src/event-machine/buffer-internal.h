@@ -0,0 +1,58 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-machine/buffer-internal.h
+ * Trimming of read buffer pool by event machine, see event-buffer.h.
+ *
+ * @warning
+ *   This header file is not meant to be used outside of this library.
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_MACHINE_BUFFER_INTERNAL_H_33816170524829376014985290744392856
+#define EVENT_MACHINE_BUFFER_INTERNAL_H_33816170524829376014985290744392856
+
+#include "event-buffer.h"
+
+/** Limit wait timeout so that event machine wakes up for the next trim if
+ * its pool has free buffers.
+ */
+int em_buffer_pool_wait_timeout(EM *event_machine, int timeout);
+
+/** Trim pool of event machine if trim interval elapsed since the last trim.
+ */
+void em_buffer_pool_maintain(EM *event_machine);
+
+#endif
+/* EVENT_MACHINE_BUFFER_INTERNAL_H_33816170524829376014985290744392856 */
@@ -0,0 +1,61 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-machine/metrics-internal.h
+ * Updating of event machine metrics outside of main loop.
+ *
+ * @warning
+ *   This header file is not meant to be used outside of this library.
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_MACHINE_METRICS_INTERNAL_H_31764052318937413808591232140744029
+#define EVENT_MACHINE_METRICS_INTERNAL_H_31764052318937413808591232140744029
+
+#include "event-machine.h"
+
+/** Increment counter of event machine metrics, if they are enabled. Has to be
+ * called from the thread that runs the event machine.
+ */
+#define EM_METRICS_INC(em, counter)                 \
+    do                                              \
+    {                                               \
+        if ((em)->metrics != NULL)                  \
+        {                                           \
+            (em)->metrics->counter++;               \
+        }                                           \
+    } while (0)
+
+#endif
+/* EVENT_MACHINE_METRICS_INTERNAL_H_31764052318937413808591232140744029 */
@@ -0,0 +1,184 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-machine/metrics.h
+ * Counters that event machine maintains about its main loop, see
+ * event_machine_enable_metrics().
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_MACHINE_METRICS_H_151937043387092616227093315660238180439
+#define EVENT_MACHINE_METRICS_H_151937043387092616227093315660238180439
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Value of <tt>EM_metrics.magic</tt>, it identifies exported stats page.
+ */
+#define EM_METRICS_MAGIC            0x534d4d45  /* "EMMS" in little endian. */
+
+/** Value of <tt>EM_metrics.version</tt>, it's incremented whenever layout of
+ * #EM_metrics changes.
+ */
+#define EM_METRICS_VERSION          2
+
+/** Number of buckets of <tt>EM_metrics.batch_sizes</tt> histogram.
+ */
+#define EM_METRICS_BATCH_BUCKETS    16
+
+/** Counters of one event machine.
+ *
+ * All counters are monotonic and maintained by the thread that runs the
+ * event machine without any synchronization, therefore each of them is
+ * consistent on its own, but counters read by other thread may come from
+ * adjacent iterations of main loop. Rates are obtained by sampling counters
+ * twice and dividing their difference by difference of
+ * <tt>timestamp</tt>.
+ *
+ * Structure is also the layout of stats page exported by
+ * event_machine_enable_metrics(), therefore it has only fixed size members.
+ */
+typedef struct EM_metrics_s
+{
+    /** Always #EM_METRICS_MAGIC.
+     */
+    uint32_t magic;
+
+    /** Always #EM_METRICS_VERSION.
+     */
+    uint32_t version;
+
+    /** Size of this structure in bytes.
+     */
+    uint32_t size;
+
+    /** Value of <tt>EM.max_events</tt>, i.e. maximum size of a batch.
+     */
+    int32_t max_events;
+
+    /** Time, in nanoseconds of <tt>CLOCK_MONOTONIC</tt>, when counters were
+     * last updated by main loop.
+     */
+    uint64_t timestamp;
+
+    /** Number of main loop iterations.
+     */
+    uint64_t iterations;
+
+    /** Number of events returned by waiting for events, including internal
+     * ones.
+     */
+    uint64_t events;
+
+    /** Number of batches that contained <tt>max_events</tt> events, i.e.
+     * there may have been more events ready. It's a sign of saturated event
+     * machine.
+     */
+    uint64_t full_batches;
+
+    /** Histogram of batch sizes. Bucket 0 counts empty batches and bucket
+     * <tt>i > 0</tt> counts batches of size from <tt>2^(i - 1)</tt> to
+     * <tt>2^i - 1</tt>, last bucket counts all bigger batches as well.
+     */
+    uint64_t batch_sizes[EM_METRICS_BATCH_BUCKETS];
+
+    /** Nanoseconds spent outside of dispatching, mostly blocked waiting for
+     * events.
+     */
+    uint64_t blocked_nsec;
+
+    /** Nanoseconds spent dispatching events, running posted tasks and idle
+     * handlers, and applying deferred registration changes.
+     */
+    uint64_t dispatch_nsec;
+
+    /** Number of event handler and idle handler invocations.
+     */
+    uint64_t handler_calls;
+
+    /** Number of posted tasks that were executed.
+     */
+    uint64_t task_calls;
+
+    /** Number of <tt>epoll_wait()</tt>, <tt>kevent()</tt>, or
+     * <tt>io_uring</tt> waits, including nonblocking ones done while
+     * spinning.
+     */
+    uint64_t wait_calls;
+
+    /** Number of registration changes passed to <tt>epoll_ctl()</tt>,
+     * <tt>kevent()</tt>, or queued in <tt>io_uring</tt>.
+     */
+    uint64_t ctl_calls;
+
+    /** Number of <tt>fcntl()</tt> calls used to validate file descriptors.
+     *
+     * @see event_machine_set_validation()
+     */
+    uint64_t fcntl_calls;
+
+    /** Number of <tt>read()</tt> calls made by event machine and its timers
+     * to consume wakeups and timer expirations.
+     */
+    uint64_t read_calls;
+
+    /** Number of wakeups requested by event_machine_post() and
+     * event_machine_terminate(), usually from other threads. These aren't
+     * system calls of the event loop, they are counted once event machine
+     * consumes them.
+     */
+    uint64_t remote_wakeups;
+
+    /** Number of system calls that received data on behalf of handlers,
+     * made by read buffer pools, datagram sockets, splice forwarders, and
+     * zero-copy senders reading completions from the error queue.
+     */
+    uint64_t io_read_calls;
+
+    /** Number of system calls that sent data on behalf of handlers, made by
+     * output queues, datagram sockets, splice forwarders, and zero-copy
+     * senders.
+     */
+    uint64_t io_write_calls;
+} EM_metrics;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_MACHINE_METRICS_H_151937043387092616227093315660238180439 */
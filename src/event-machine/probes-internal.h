@@ -0,0 +1,130 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-machine/probes-internal.h
+ * Static tracepoints and user hooks at key points of event machine loop.
+ *
+ * If library is built with <tt>USE_USDT</tt> defined, e.g. using
+ * <tt>make USDT=yes</tt>, then each trace point is also an USDT probe of
+ * provider <tt>event_machine</tt>, which can be attached to by
+ * <tt>bpftrace</tt>, <tt>perf</tt> or <tt>systemtap</tt>. Probe that isn't
+ * attached to is a single <tt>nop</tt> instruction. Probes require
+ * <tt>sys/sdt.h</tt> header, e.g. from systemtap-sdt-dev(el) package.
+ *
+ * Hooks set using event_machine_set_hooks() are invoked at the same points
+ * and cost one test of a pointer when not set.
+ *
+ * @warning
+ *   This header file is not meant to be used outside of this library.
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_MACHINE_PROBES_INTERNAL_H_16873509135318170263380475299628133
+#define EVENT_MACHINE_PROBES_INTERNAL_H_16873509135318170263380475299628133
+
+#include "event-machine.h"
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+
+#define EM_PROBE2(name, a, b)       DTRACE_PROBE2(event_machine, name, a, b)
+#define EM_PROBE3(name, a, b, c)    DTRACE_PROBE3(event_machine, name, a, b, c)
+#else /* !defined(USE_USDT) */
+#define EM_PROBE2(name, a, b)       do { } while (0)
+#define EM_PROBE3(name, a, b, c)    do { } while (0)
+#endif /* USE_USDT */
+
+/** Invoke <tt>hook</tt> member of #EM_hooks set in event machine, if there
+ * is one. Arguments following <tt>hook</tt> are passed to it between event
+ * machine and <tt>EM_hooks.data</tt>.
+ */
+#define EM_HOOK(em, hook, ...)                              \
+    do                                                      \
+    {                                                       \
+        const EM_hooks *const em_hooks_ = (em)->hooks;      \
+                                                            \
+        if (em_hooks_ != NULL && em_hooks_->hook != NULL)   \
+        {                                                   \
+            em_hooks_->hook((em), __VA_ARGS__, em_hooks_->data); \
+        }                                                   \
+    } while (0)
+
+/* Trace points. Each of them is both USDT probe and hook, arguments of probes
+ * are the same as of hooks, with event machine as the first one.
+ */
+
+#define EM_TRACE_WAIT_START(em, timeout)                    \
+    do                                                      \
+    {                                                       \
+        EM_PROBE2(wait__start, (em), (timeout));            \
+        EM_HOOK((em), before_wait, (timeout));              \
+    } while (0)
+
+#define EM_TRACE_WAIT_DONE(em, num_events)                  \
+    do                                                      \
+    {                                                       \
+        EM_PROBE2(wait__done, (em), (num_events));          \
+        EM_HOOK((em), after_wait, (num_events));            \
+    } while (0)
+
+#define EM_TRACE_DISPATCH_START(em, fd, events)             \
+    do                                                      \
+    {                                                       \
+        EM_PROBE3(dispatch__start, (em), (fd), (events));   \
+        EM_HOOK((em), before_dispatch, (fd), (events));     \
+    } while (0)
+
+#define EM_TRACE_DISPATCH_DONE(em, fd, events)              \
+    do                                                      \
+    {                                                       \
+        EM_PROBE3(dispatch__done, (em), (fd), (events));    \
+        EM_HOOK((em), after_dispatch, (fd), (events));      \
+    } while (0)
+
+#define EM_TRACE_CTL(em, fd, operation)                     \
+    do                                                      \
+    {                                                       \
+        EM_PROBE3(ctl, (em), (fd), (operation));            \
+        EM_HOOK((em), ctl, (fd), (operation));              \
+    } while (0)
+
+#define EM_TRACE_TIMER_EXPIRE(em, timer, overruns)          \
+    do                                                      \
+    {                                                       \
+        EM_PROBE3(timer__expire, (em), (timer), (overruns)); \
+        EM_HOOK((em), timer_expire, (timer), (overruns));   \
+    } while (0)
+
+#endif
+/* EVENT_MACHINE_PROBES_INTERNAL_H_16873509135318170263380475299628133 */
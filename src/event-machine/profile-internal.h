@@ -0,0 +1,77 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-machine/profile-internal.h
+ * Recording of event handler durations used by event machine loop when
+ * profiling is enabled using event_profile_enable().
+ *
+ * @warning
+ *   This header file is not meant to be used outside of this library.
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_MACHINE_PROFILE_INTERNAL_H_4073317063285719520931683418862057
+#define EVENT_MACHINE_PROFILE_INTERNAL_H_4073317063285719520931683418862057
+
+#include "event-profile.h"
+
+struct EM_profile_s
+{
+    /* Open addressing hash table keyed by handler function pointer, number of
+     * its entries is a power of two.
+     */
+    EM_handler_profile *table;
+    size_t size;
+    size_t count;
+
+    uint64_t slow_nsec;
+    EM_slow_handler slow_handler;
+    void *data;
+};
+
+/** Record one invocation of event handler that took <tt>nsec</tt>
+ * nanoseconds and invoke slow handler callback if it reached the threshold.
+ *
+ * @return
+ *   True if slow handler callback was invoked.
+ */
+bool em_profile_record(EM *event_machine, EM_event_handler handler, int fd,
+    uint64_t nsec);
+
+/** Free profiling state, <tt>NULL</tt> is ignored.
+ */
+void em_profile_free(struct EM_profile_s *profile);
+
+#endif
+/* EVENT_MACHINE_PROFILE_INTERNAL_H_4073317063285719520931683418862057 */
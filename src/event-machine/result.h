@@ -81,7 +81,8 @@ enum EM_result {
      */
     EM_ERROR_CALLBACK_NULL = 8 + 5,
 
-    /** Calling <tt>pipe()</tt> or <tt>pipe2()</tt> failed.
+    /** Calling <tt>pipe()</tt>, <tt>pipe2()</tt> or <tt>eventfd()</tt>
+     * failed.
      *
      * See value of <tt>errno</tt> for details.
      */
@@ -142,6 +143,45 @@ enum EM_result {
      */
     EM_ERROR_FCNTL = 32 + 10,
 
+    /** Memory allocation failed.
+     *
+     * See value of <tt>errno</tt> for details.
+     */
+    EM_ERROR_MALLOC = 32 + 11,
+
+    /** Calling <tt>socket()</tt>, <tt>setsockopt()</tt>, <tt>bind()</tt> or
+     * <tt>listen()</tt> failed.
+     *
+     * See value of <tt>errno</tt> for details.
+     */
+    EM_ERROR_SOCKET = 32 + 12,
+
+    /** Calling <tt>pthread_create()</tt> or <tt>pthread_join()</tt> failed.
+     *
+     * Value of <tt>errno</tt> is set to error number returned by failed
+     * function.
+     */
+    EM_ERROR_THREAD = 32 + 13,
+
+    /** Calling <tt>ioctl()</tt> failed.
+     *
+     * See value of <tt>errno</tt> for details.
+     */
+    EM_ERROR_IOCTL = 32 + 14,
+
+    /** Calling <tt>open()</tt>, <tt>ftruncate()</tt> or <tt>mmap()</tt>
+     * failed.
+     *
+     * See value of <tt>errno</tt> for details.
+     */
+    EM_ERROR_MMAP = 32 + 15,
+
+    /** Calling <tt>splice()</tt> failed.
+     *
+     * See value of <tt>errno</tt> for details.
+     */
+    EM_ERROR_SPLICE = 32 + 16,
+
     /** Trying to store duplicate event descriptor.
      */
     EM_ERROR_STORAGE_DUPLICATE_ENTRY = 64,
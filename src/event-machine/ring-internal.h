@@ -0,0 +1,101 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-machine/ring-internal.h
+ * Internal interface of <tt>io_uring</tt> backend used when library is
+ * compiled with <tt>USE_IO_URING</tt>.
+ *
+ * Registration changes are only queued in to the submission ring and they are
+ * submitted together with waiting for completions, i.e. one
+ * <tt>io_uring_enter()</tt> call per event loop iteration. Completions of
+ * poll requests are translated in to <tt>struct epoll_event</tt> entries so
+ * that the rest of the event machine and all event handlers stay the same as
+ * with <tt>epoll</tt> backend.
+ *
+ * @warning
+ *   This header file is not meant to be used outside of this library.
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_MACHINE_RING_INTERNAL_H_113829370442185290071725146362839001587
+#define EVENT_MACHINE_RING_INTERNAL_H_113829370442185290071725146362839001587
+
+#include "event-machine.h"
+
+#ifdef USE_IO_URING
+
+/** Create submission and completion rings with at least <tt>entries</tt>
+ * submission entries.
+ *
+ * @return
+ *   Ring file descriptor on success, or -1 on failure in which case
+ *   <tt>errno</tt> is set and <tt>(*ring)</tt> is left <tt>NULL</tt>.
+ */
+int em_ring_create(struct EM_ring_s **ring, unsigned int entries);
+
+/** Unmap rings and free all memory associated with them. Ring file descriptor
+ * is not closed, that is left to the caller.
+ */
+void em_ring_destroy(struct EM_ring_s *ring);
+
+/** Queue registration change. Arguments have the same meaning as for
+ * <tt>event_ctl()</tt>, i.e. <tt>ed</tt> is <tt>NULL</tt> for
+ * <tt>EPOLL_CTL_DEL</tt> and <tt>fd</tt> is used only in such case.
+ *
+ * @return
+ *   Zero on success and -1 on failure, in which case <tt>errno</tt> is set.
+ */
+int em_ring_ctl(struct EM_ring_s *ring, EM_event_descriptor *ed, int fd,
+    int operation);
+
+/** Submit all queued changes and wait for at least one completion. Results
+ * are stored in <tt>events</tt> the same way <tt>epoll_wait()</tt> does it.
+ *
+ * Argument <tt>timeout</tt> is in miliseconds. If <tt>timeout = 0</tt> then
+ * function doesn't block and returns only completions that are already
+ * available, negative value means wait indefinitely. Positive timeout limits
+ * only a single wait, therefore function may return zero before it expires if
+ * all completions it got were stale.
+ *
+ * @return
+ *   Number of events stored in <tt>events</tt> array or -1 on failure, in
+ *   which case <tt>errno</tt> is set.
+ */
+int em_ring_wait(struct EM_ring_s *ring, event_t events[], int max_events,
+    int timeout);
+
+#endif /* USE_IO_URING */
+
+#endif
+/* EVENT_MACHINE_RING_INTERNAL_H_113829370442185290071725146362839001587 */
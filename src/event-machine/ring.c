@@ -0,0 +1,613 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Implementation of io_uring backend. See event-machine/ring-internal.h for
+ * overview.
+ *
+ * Library liburing isn't used, communication with kernel is done directly
+ * using io_uring_setup() and io_uring_enter() system calls and memory mapped
+ * submission and completion rings.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-machine/ring-internal.h"
+
+#ifdef USE_IO_URING
+
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Each poll request carries in its user_data file descriptor (lower 32 bits)
+ * and generation of its registration (upper 32 bits). Generation changes on
+ * every registration change, therefore completions of requests that were
+ * already removed or replaced are easily recognized and dropped.
+ *
+ * Generation zero is reserved for requests whose completions are always
+ * ignored, e.g. IORING_OP_POLL_REMOVE.
+ */
+#define USER_DATA(generation, fd)   \
+    (((uint64_t)(generation) << 32) | (uint32_t)(fd))
+#define USER_DATA_GENERATION(ud)    ((uint32_t)((ud) >> 32))
+#define USER_DATA_FD(ud)            ((int)((ud) & 0xffffffffu))
+#define USER_DATA_IGNORE            ((uint64_t)0)
+
+/* Flags that have meaning only for epoll_ctl(). Poll requests would reject
+ * them or interpret them differently. EPOLLET and EPOLLONESHOT are
+ * implemented by choice of poll request, see IS_MULTISHOT(), and EPOLLWAKEUP
+ * is only a hint. EPOLLEXCLUSIVE can't be emulated, poll requests of all
+ * rings are completed, hence it's rejected by em_ring_ctl().
+ */
+#define POLL_MASK(events)   \
+    ((events) & ~(EPOLLET | EPOLLONESHOT | EPOLLWAKEUP))
+
+/* Edge-triggered registrations are mapped to multishot poll requests that
+ * stay armed until removed. Such request completes on every wakeup of the
+ * file, e.g. each arriving packet, which is what epoll reports for EPOLLET as
+ * well, but there may be more completions per batch than epoll would merge
+ * in to one event. Level-triggered registrations use one-shot poll requests
+ * that are re-armed after each completion. New request is submitted only
+ * after handlers of current batch were executed, therefore if handler
+ * doesn't consume all data it will be notified again, same as with epoll.
+ */
+#define IS_MULTISHOT(events)    \
+    (((events) & (EPOLLET | EPOLLONESHOT)) == EPOLLET)
+
+#define SLOTS_MIN_SIZE  64
+
+struct EM_ring_slot_s
+{
+    EM_event_descriptor *ed;
+    uint32_t generation;
+    bool armed;
+};
+
+struct EM_ring_s
+{
+    int fd;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    struct io_uring_sqe *sqes;
+
+    /* Number of entries queued in submission ring, but not yet passed to
+     * kernel via io_uring_enter().
+     */
+    unsigned int to_submit;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    uint32_t generation;
+
+    /* Registered event descriptors indexed by file descriptor.
+     */
+    struct EM_ring_slot_s *slots;
+    size_t slots_size;
+};
+
+
+static inline int ring_setup(const unsigned int entries,
+    struct io_uring_params *const params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int ring_enter(const int fd, const unsigned int to_submit,
+    const unsigned int min_complete, const unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+        flags, NULL, 0);
+}
+
+/* Same as ring_enter(), but waiting for completions is limited by timeout,
+ * which requires Linux 5.11 or newer. Expired timeout is reported as ETIME.
+ */
+static inline int ring_enter_timeout(const int fd,
+    const unsigned int to_submit, const unsigned int min_complete,
+    const unsigned int flags, const int timeout)
+{
+    struct __kernel_timespec ts =
+    {
+        .tv_sec = timeout / 1000,
+        .tv_nsec = (long long)(timeout % 1000) * 1000000
+    };
+    struct io_uring_getevents_arg arg =
+    {
+        .ts = (uint64_t)(uintptr_t)&ts
+    };
+
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+        flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static inline void *ring_mmap(const int fd, const size_t size,
+    const off_t offset)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, offset);
+
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+void em_ring_destroy(struct EM_ring_s *const ring)
+{
+    if_null (ring)
+    {
+        return;
+    }
+
+    if_not_null (ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (not_null(ring->cq_ring) && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if_not_null (ring->sq_ring)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+
+    free(ring->slots);
+    free(ring);
+}
+
+int em_ring_create(struct EM_ring_s **const ring_ptr,
+    const unsigned int entries)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+
+    struct EM_ring_s *ring = calloc(1, sizeof(struct EM_ring_s));
+    if_null (ring)
+    {
+        return -1;
+    }
+
+    const int fd = ring_setup(entries, &params);
+    if_invalid_fd (fd)
+    {
+        free(ring);
+
+        return -1;
+    }
+    ring->fd = fd;
+
+    ring->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Since Linux 5.4 both rings can be mapped using one mmap() call.
+     */
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+        {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = ring_mmap(fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    if_null (ring->sq_ring)
+    {
+        goto failure;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = ring_mmap(fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+        if_null (ring->cq_ring)
+        {
+            goto failure;
+        }
+    }
+
+    ring->sqes = ring_mmap(fd, ring->sqes_size, IORING_OFF_SQES);
+    if_null (ring->sqes)
+    {
+        goto failure;
+    }
+
+    char *const sq = ring->sq_ring;
+    char *const cq = ring->cq_ring;
+
+    ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+
+    ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    (*ring_ptr) = ring;
+
+    return fd;
+
+failure:
+    {
+        const int saved_errno = errno;
+
+        em_ring_destroy(ring);
+        close(fd);
+        errno = saved_errno;
+    }
+
+    return -1;
+}
+
+/* Pass all queued submission entries to kernel without waiting for any
+ * completions.
+ */
+static int ring_submit(struct EM_ring_s *const ring)
+{
+    while (ring->to_submit > 0)
+    {
+        const int ret = ring_enter(ring->fd, ring->to_submit, 0, 0);
+        if_negative (ret)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+        ring->to_submit -= ret;
+    }
+
+    return 0;
+}
+
+static struct io_uring_sqe *ring_next_sqe(struct EM_ring_s *const ring)
+{
+    const unsigned int tail = *ring->sq_tail;
+
+    /* Submission ring is full, flush it to make some room. This happens only
+     * if there were more registration changes in one batch than there are
+     * submission entries.
+     */
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)
+        >= ring->sq_entries)
+    {
+        if_negative (ring_submit(ring))
+        {
+            return NULL;
+        }
+    }
+
+    const unsigned int index = tail & *ring->sq_mask;
+    struct io_uring_sqe *const sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+
+    return sqe;
+}
+
+static inline void ring_commit_sqe(struct EM_ring_s *const ring)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+static int ring_arm(struct EM_ring_s *const ring, const int fd,
+    struct EM_ring_slot_s *const slot)
+{
+    struct io_uring_sqe *const sqe = ring_next_sqe(ring);
+    if_null (sqe)
+    {
+        return -1;
+    }
+
+    uint32_t mask = POLL_MASK(slot->ed->events);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    /* Kernel expects poll32_events with swapped half-words on big-endian
+     * platforms.
+     */
+    mask = (mask << 16) | (mask >> 16);
+#endif
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = mask;
+    sqe->len = IS_MULTISHOT(slot->ed->events) ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = USER_DATA(slot->generation, fd);
+    ring_commit_sqe(ring);
+
+    slot->armed = true;
+
+    return 0;
+}
+
+static int ring_disarm(struct EM_ring_s *const ring, const int fd,
+    struct EM_ring_slot_s *const slot)
+{
+    struct io_uring_sqe *const sqe = ring_next_sqe(ring);
+    if_null (sqe)
+    {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = USER_DATA(slot->generation, fd);
+    sqe->user_data = USER_DATA_IGNORE;
+    ring_commit_sqe(ring);
+
+    slot->armed = false;
+
+    return 0;
+}
+
+static int ring_reserve_slot(struct EM_ring_s *const ring, const int fd)
+{
+    if ((size_t)fd < ring->slots_size)
+    {
+        return 0;
+    }
+
+    size_t size = ring->slots_size < SLOTS_MIN_SIZE
+        ? SLOTS_MIN_SIZE : ring->slots_size;
+    while (size <= (size_t)fd)
+    {
+        size *= 2;
+    }
+
+    struct EM_ring_slot_s *const slots =
+        realloc(ring->slots, size * sizeof(struct EM_ring_slot_s));
+    if_null (slots)
+    {
+        return -1;
+    }
+    memset(slots + ring->slots_size, 0,
+        (size - ring->slots_size) * sizeof(struct EM_ring_slot_s));
+
+    ring->slots = slots;
+    ring->slots_size = size;
+
+    return 0;
+}
+
+int em_ring_ctl(struct EM_ring_s *const ring, EM_event_descriptor *const ed,
+    const int fd, const int operation)
+{
+    const int event_fd = ed == NULL ? fd : ed->fd;
+
+    if_invalid_fd (event_fd)
+    {
+        errno = EBADF;
+
+        return -1;
+    }
+    if (not_null(ed) && (ed->events & EPOLLEXCLUSIVE))
+    {
+        errno = EINVAL;
+
+        return -1;
+    }
+
+    /* Same errors as epoll_ctl() reports. Unlike epoll, poll requests aren't
+     * removed when file descriptor is closed, they keep the file open, hence
+     * file descriptor closed without being deleted first stays registered
+     * and adding its reused number fails with EEXIST.
+     */
+    if (operation == EPOLL_CTL_ADD)
+    {
+        if_negative (ring_reserve_slot(ring, event_fd))
+        {
+            return -1;
+        }
+        if_not_null (ring->slots[event_fd].ed)
+        {
+            errno = EEXIST;
+
+            return -1;
+        }
+    }
+    else if ((size_t)event_fd >= ring->slots_size
+        || null(ring->slots[event_fd].ed))
+    {
+        errno = ENOENT;
+
+        return -1;
+    }
+
+    struct EM_ring_slot_s *const slot = &ring->slots[event_fd];
+    if (slot->armed)
+    {
+        if_negative (ring_disarm(ring, event_fd, slot))
+        {
+            return -1;
+        }
+    }
+
+    if_zero (++ring->generation)
+    {
+        ring->generation++;
+    }
+    slot->generation = ring->generation;
+    slot->ed = ed;
+
+    if_null (ed)
+    {
+        return 0;
+    }
+
+    return ring_arm(ring, event_fd, slot);
+}
+
+/* Translate one completion in to epoll_event.
+ *
+ * Returns 1 if event was stored, 0 if completion was ignored and -1 on
+ * failure.
+ */
+static int ring_reap(struct EM_ring_s *const ring,
+    const struct io_uring_cqe *const cqe, event_t *const event)
+{
+    const uint32_t generation = USER_DATA_GENERATION(cqe->user_data);
+    const int fd = USER_DATA_FD(cqe->user_data);
+
+    if (generation == 0 || (size_t)fd >= ring->slots_size)
+    {
+        return 0;
+    }
+
+    struct EM_ring_slot_s *const slot = &ring->slots[fd];
+    if (slot->generation != generation || null(slot->ed))
+    {
+        /* Completion of a request that was already removed or replaced.
+         */
+        return 0;
+    }
+
+    if (not(cqe->flags & IORING_CQE_F_MORE))
+    {
+        slot->armed = false;
+
+        /* Failed requests (e.g. file descriptor was closed) aren't re-armed,
+         * otherwise they would be failing over and over again.
+         */
+        if (is_not_negative(cqe->res)
+            && not(slot->ed->events & EPOLLONESHOT))
+        {
+            if_negative (ring_arm(ring, fd, slot))
+            {
+                return -1;
+            }
+        }
+    }
+
+    if (cqe->res == -ECANCELED)
+    {
+        return 0;
+    }
+
+    event->events = is_negative(cqe->res) ? EPOLLERR : (uint32_t)cqe->res;
+    event->data.ptr = slot->ed;
+
+    return 1;
+}
+
+int em_ring_wait(struct EM_ring_s *const ring, event_t events[],
+    const int max_events, const int timeout)
+{
+    int num_events = 0;
+
+    do
+    {
+        unsigned int head = *ring->cq_head;
+        unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        const bool do_wait = head == tail && timeout != 0;
+
+        /* Queued registration changes are submitted in the same system call
+         * that waits for completions. When polling, kernel is entered even if
+         * there is nothing to submit so that it has a chance to post
+         * completions.
+         */
+        if (ring->to_submit > 0 || head == tail)
+        {
+            const unsigned int flags =
+                head == tail ? IORING_ENTER_GETEVENTS : 0;
+            const int ret = do_wait && timeout > 0
+                ? ring_enter_timeout(ring->fd, ring->to_submit, 1, flags,
+                    timeout)
+                : ring_enter(ring->fd, ring->to_submit, do_wait ? 1 : 0,
+                    flags);
+            if_negative (ret)
+            {
+                /* Kernel reports expired timeout only if there was nothing
+                 * to submit, otherwise it returns number of submissions.
+                 */
+                if (errno != ETIME)
+                {
+                    return -1;
+                }
+            }
+            else
+            {
+                ring->to_submit -= ret;
+            }
+
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        }
+
+        for (; head != tail && num_events < max_events; head++)
+        {
+            const int ret = ring_reap(ring,
+                &ring->cqes[head & *ring->cq_mask], &events[num_events]);
+            if_negative (ret)
+            {
+                __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+                return -1;
+            }
+            num_events += ret;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    } while (num_events == 0 && timeout < 0);
+
+    return num_events;
+}
+
+#endif /* USE_IO_URING */
@@ -0,0 +1,455 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event-output.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/output-internal.h"
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/* Platforms without MSG_NOSIGNAL (e.g. Darwin) have to rely on SO_NOSIGPIPE
+ * being set on the socket, or on SIGPIPE being ignored.
+ */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS      (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+#define SEND_FLAGS      MSG_DONTWAIT
+#endif
+
+struct EM_output_chunk_s
+{
+    struct EM_output_chunk_s *next;
+
+    /* Data between begin and end weren't written yet, space after end is
+     * available for following writes.
+     */
+    size_t begin;
+    size_t end;
+    size_t size;
+    char data[];
+};
+
+
+static void pending_link(EM_output *const output)
+{
+    EM *const em = output->event_machine;
+
+    if_not_null (output->pending_pprev)
+    {
+        return;
+    }
+
+    output->pending_next = em->output_pending;
+    if_not_null (em->output_pending)
+    {
+        em->output_pending->pending_pprev = &(output->pending_next);
+    }
+    em->output_pending = output;
+    output->pending_pprev = &(em->output_pending);
+}
+
+static void pending_unlink(EM_output *const output)
+{
+    if_null (output->pending_pprev)
+    {
+        return;
+    }
+
+    (*output->pending_pprev) = output->pending_next;
+    if_not_null (output->pending_next)
+    {
+        output->pending_next->pending_pprev = output->pending_pprev;
+    }
+    output->pending_next = NULL;
+    output->pending_pprev = NULL;
+}
+
+static void discard_chunks(EM_output *const output)
+{
+    struct EM_output_chunk_s *chunk = output->head;
+
+    while (not_null(chunk))
+    {
+        struct EM_output_chunk_s *const next = chunk->next;
+
+        free(chunk);
+        chunk = next;
+    }
+    output->head = NULL;
+    output->tail = NULL;
+    output->queued = 0;
+}
+
+static inline void report(EM_output *const output,
+    const EM_output_event event)
+{
+    if_not_null (output->handler)
+    {
+        output->handler(output->event_machine, output, event, output->data);
+    }
+}
+
+/* Add or remove EVENT_WRITE from events of event descriptor.
+ */
+static uint32_t set_write_enabled(EM_output *const output, const bool enable)
+{
+    if (output->write_enabled == enable)
+    {
+        return EM_SUCCESS;
+    }
+
+#if defined(USE_EPOLL) || defined(USE_IO_URING)
+    EM_event_descriptor *const ed = output->event_descriptor;
+
+    if (enable)
+    {
+        ed->events |= EVENT_WRITE;
+    }
+    else
+    {
+        ed->events &= ~(event_filter_t)EVENT_WRITE;
+    }
+    ret_em_failure(event_machine_modify(output->event_machine, ed->fd, ed,
+        NULL));
+#endif
+    output->write_enabled = enable;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_output_init(EM_output *const output, EM *const em,
+    EM_event_descriptor *const ed)
+{
+    if (null(output) || null(em))
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (ed)
+    {
+        return EM_ERROR_DESCRIPTOR_NULL;
+    }
+
+    memset(output, 0, sizeof(EM_output));
+    output->event_machine = em;
+    output->event_descriptor = ed;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_output_destroy(EM_output *const output)
+{
+    if_null (output)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    pending_unlink(output);
+    discard_chunks(output);
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_output_set_watermarks(EM_output *const output,
+    const size_t low_water, const size_t high_water,
+    const EM_output_handler handler, void *const data)
+{
+    if_null (output)
+    {
+        return EM_ERROR_NULL;
+    }
+    if (high_water > 0 && low_water > high_water)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    output->low_water = low_water;
+    output->high_water = high_water;
+    output->handler = handler;
+    output->data = data;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_output_write(EM_output *const output, const void *const buffer,
+    const size_t length)
+{
+    if_null (output)
+    {
+        return EM_ERROR_NULL;
+    }
+    if (null(buffer) && length > 0)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if_not_zero (output->error)
+    {
+        errno = output->error;
+
+        return EM_ERROR_WRITE;
+    }
+
+    const char *data = buffer;
+    size_t left = length;
+    struct EM_output_chunk_s *tail = output->tail;
+    const size_t available = null(tail) ? 0 : tail->size - tail->end;
+    struct EM_output_chunk_s *chunk = NULL;
+
+    /* Fill the last chunk first, then allocate one chunk for the rest.
+     * Chunk is allocated before anything is copied, therefore failed
+     * allocation leaves the queue as it was. Chunks are freed as soon as they
+     * are written, reusing memory is left to malloc(), which handles small
+     * sizes well.
+     */
+    if (left > available)
+    {
+        size_t size = null(tail) ? EM_OUTPUT_MIN_CHUNK_SIZE : tail->size * 2;
+
+        if (size > EM_OUTPUT_CHUNK_SIZE)
+        {
+            size = EM_OUTPUT_CHUNK_SIZE;
+        }
+        if (size < left - available)
+        {
+            size = left - available;
+        }
+        chunk = malloc(sizeof(struct EM_output_chunk_s) + size);
+        if_null (chunk)
+        {
+            return EM_ERROR_MALLOC;
+        }
+        chunk->next = NULL;
+        chunk->begin = 0;
+        chunk->end = 0;
+        chunk->size = size;
+    }
+    if (available > 0)
+    {
+        const size_t n = left < available ? left : available;
+
+        memcpy(tail->data + tail->end, data, n);
+        tail->end += n;
+        data += n;
+        left -= n;
+    }
+    if_not_null (chunk)
+    {
+        memcpy(chunk->data, data, left);
+        chunk->end = left;
+
+        if_null (tail)
+        {
+            output->head = chunk;
+        }
+        else
+        {
+            tail->next = chunk;
+        }
+        output->tail = chunk;
+    }
+    output->queued += length;
+
+    /* If file descriptor isn't writable, then data are written when it
+     * becomes writable again.
+     */
+    if (not(output->write_enabled))
+    {
+        pending_link(output);
+    }
+
+    if (output->high_water > 0 && not(output->above_high_water)
+        && output->queued > output->high_water)
+    {
+        output->above_high_water = true;
+        report(output, EM_OUTPUT_HIGH_WATER);
+    }
+
+    return EM_SUCCESS;
+}
+
+/* Remove written bytes from the beginning of the queue. Chunks are freed as
+ * soon as they are written, therefore idle queue doesn't hold any memory.
+ */
+static void consume(EM_output *const output, size_t written)
+{
+    output->queued -= written;
+
+    while (written > 0)
+    {
+        struct EM_output_chunk_s *const chunk = output->head;
+        const size_t length = chunk->end - chunk->begin;
+
+        if (written < length)
+        {
+            chunk->begin += written;
+            return;
+        }
+        written -= length;
+
+        output->head = chunk->next;
+        if_null (output->head)
+        {
+            output->tail = NULL;
+        }
+        free(chunk);
+    }
+}
+
+uint32_t event_output_flush(EM_output *const output)
+{
+    if_null (output)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    EM *const em = output->event_machine;
+    const int fd = output->event_descriptor->fd;
+    bool would_block = false;
+
+    pending_unlink(output);
+
+    while (output->queued > 0)
+    {
+        struct iovec iov[EM_OUTPUT_MAX_IOV];
+        int iov_count = 0;
+        size_t requested = 0;
+
+        for (struct EM_output_chunk_s *chunk = output->head;
+            not_null(chunk) && iov_count < EM_OUTPUT_MAX_IOV;
+            chunk = chunk->next)
+        {
+            if (chunk->end > chunk->begin)
+            {
+                iov[iov_count].iov_base = chunk->data + chunk->begin;
+                iov[iov_count].iov_len = chunk->end - chunk->begin;
+                requested += iov[iov_count].iov_len;
+                iov_count++;
+            }
+        }
+
+        EM_METRICS_INC(em, io_write_calls);
+        ssize_t written;
+
+        if (output->not_socket)
+        {
+            written = writev(fd, iov, iov_count);
+        }
+        else
+        {
+            struct msghdr message =
+            {
+                .msg_iov = iov,
+                .msg_iovlen = iov_count
+            };
+
+            written = sendmsg(fd, &message, SEND_FLAGS);
+        }
+        if_negative (written)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == ENOTSOCK && not(output->not_socket))
+            {
+                /* Pipes and terminals, they are switched to writev() once.
+                 */
+                output->not_socket = true;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                would_block = true;
+                break;
+            }
+
+            const int error = errno;
+
+            /* Callback may destroy the queue, it's not touched afterwards.
+             */
+            output->error = error;
+            discard_chunks(output);
+            report(output, EM_OUTPUT_ERROR);
+            errno = error;
+
+            return EM_ERROR_WRITE;
+        }
+        consume(output, (size_t)written);
+
+        /* Short write means that there is no more space, another call would
+         * only fail with EAGAIN.
+         */
+        if ((size_t)written < requested)
+        {
+            would_block = true;
+            break;
+        }
+    }
+
+    /* Reported after writing, so that callback may queue more data, which
+     * then wait for the next flush.
+     */
+    if (output->above_high_water && output->queued <= output->low_water)
+    {
+        output->above_high_water = false;
+        report(output, EM_OUTPUT_LOW_WATER);
+    }
+
+    if (output->queued == 0)
+    {
+        return set_write_enabled(output, false);
+    }
+
+    return set_write_enabled(output, would_block || output->write_enabled);
+}
+
+void em_output_flush_pending(EM *const em)
+{
+    /* Flushing may report events whose callbacks write to other queues,
+     * those are flushed as well.
+     */
+    while (not_null(em->output_pending))
+    {
+        event_output_flush(em->output_pending);
+    }
+}
+
+void em_output_forget_pending(EM *const em)
+{
+    while (not_null(em->output_pending))
+    {
+        pending_unlink(em->output_pending);
+    }
+}
@@ -0,0 +1,329 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-output.h
+ * Buffered output queue of a file descriptor.
+ *
+ * Data written using event_output_write() are copied in to a queue of chunks
+ * and nothing is written to the file descriptor immediately. At the end of
+ * each main loop iteration, after all event handlers and posted tasks were
+ * executed, event machine flushes every queue that received data using one
+ * <tt>sendmsg()</tt> call (<tt>writev()</tt> if file descriptor isn't a
+ * socket), therefore many small writes done while handling a batch of events
+ * cost one system call per file descriptor.
+ *
+ * If file descriptor doesn't accept all data, then <tt>EVENT_WRITE</tt> is
+ * added to events of its event descriptor and it's removed again when the
+ * queue drains. Event handler has to call event_output_flush() when it's
+ * invoked with <tt>EVENT_WRITE</tt>. Backpressure is implemented by
+ * high-water and low-water marks, see event_output_set_watermarks().
+ *
+ * Toggling of <tt>EVENT_WRITE</tt> is done only by <tt>epoll</tt> and
+ * <tt>io_uring</tt> backends. With <tt>kqueue</tt> write filter has to be
+ * registered by the user.
+ *
+ * Output queue is tied to one event machine and there is no locking. It has
+ * to be used only by the thread that runs that event machine.
+ *
+ * Usage example can be found here: @link example/tcp-echo-server.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_OUTPUT_H_265870941760399523917464035146282095027
+#define EVENT_OUTPUT_H_265870941760399523917464035146282095027
+
+#include "event-machine.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of data part of the first chunk allocated for an empty queue. Each
+ * following chunk is twice as big as the previous one, up to
+ * #EM_OUTPUT_CHUNK_SIZE, so that short replies need only small allocations.
+ * Writes that are bigger get a chunk of their own size.
+ */
+#ifndef EM_OUTPUT_MIN_CHUNK_SIZE
+#define EM_OUTPUT_MIN_CHUNK_SIZE    256
+#endif
+
+/** Maximum size of data part of chunks allocated for queued data.
+ */
+#ifndef EM_OUTPUT_CHUNK_SIZE
+#define EM_OUTPUT_CHUNK_SIZE        16384
+#endif
+
+/** Maximum number of chunks passed to one <tt>sendmsg()</tt> or
+ * <tt>writev()</tt> call.
+ */
+#define EM_OUTPUT_MAX_IOV           64
+
+struct EM_output_s;         /* Forward declaration */
+struct EM_output_chunk_s;   /* Forward declaration, private. */
+
+/** Events reported to #EM_output_handler.
+ */
+typedef enum
+{
+    /** Number of queued bytes exceeded high-water mark. Producer should stop,
+     * e.g. by removing <tt>EVENT_READ</tt> from a connection whose data are
+     * being forwarded.
+     */
+    EM_OUTPUT_HIGH_WATER = 1,
+
+    /** Number of queued bytes dropped to low-water mark after
+     * #EM_OUTPUT_HIGH_WATER was reported.
+     */
+    EM_OUTPUT_LOW_WATER = 2,
+
+    /** Writing failed, queued data were discarded. Value of <tt>error</tt>
+     * field of #EM_output is <tt>errno</tt> of failed <tt>sendmsg()</tt> or
+     * <tt>writev()</tt>. Writing to a closed socket doesn't raise
+     * <tt>SIGPIPE</tt>, it's reported with <tt>EPIPE</tt>.
+     */
+    EM_OUTPUT_ERROR = 3
+} EM_output_event;
+
+/** Type of callbacks that receive #EM_output_event.
+ *
+ * Callback may write to the queue, but it may not call
+ * event_output_destroy() on it, unless it's invoked with #EM_OUTPUT_ERROR.
+ *
+ * @param[in] event_machine
+ *   Event machine of output queue.
+ *
+ * @param[in] output
+ *   Output queue that reported the event.
+ *
+ * @param[in] event
+ *   What happened.
+ *
+ * @param[in] data
+ *   Pointer passed to event_output_set_watermarks().
+ */
+typedef void (*EM_output_handler)(EM *event_machine,
+    struct EM_output_s *output, EM_output_event event, void *data);
+
+/** Output queue. Its fields are private, use functions declared below.
+ */
+typedef struct EM_output_s
+{
+    /** Event machine that flushes this queue.
+     */
+    EM *event_machine;
+
+    /** Event descriptor of the file descriptor data are written to. Its
+     * <tt>events</tt> are modified when <tt>EVENT_WRITE</tt> is toggled.
+     */
+    EM_event_descriptor *event_descriptor;
+
+    /** Queued data, oldest first.
+     */
+    struct EM_output_chunk_s *head;
+    struct EM_output_chunk_s *tail;
+
+    /** Number of queued bytes.
+     */
+    size_t queued;
+
+    /** Watermarks in bytes, high-water mark 0 means that they are disabled.
+     *
+     * @see event_output_set_watermarks()
+     */
+    size_t high_water;
+    size_t low_water;
+
+    /** Callback for #EM_output_event or <tt>NULL</tt>.
+     */
+    EM_output_handler handler;
+    void *data;
+
+    /** Value of <tt>errno</tt> of failed write, or 0.
+     */
+    int error;
+
+    /** True after #EM_OUTPUT_HIGH_WATER was reported and until
+     * #EM_OUTPUT_LOW_WATER is.
+     */
+    bool above_high_water;
+
+    /** True while <tt>EVENT_WRITE</tt> is added to events of
+     * <tt>event_descriptor</tt>.
+     */
+    bool write_enabled;
+
+    /** True if file descriptor isn't a socket, data are then written using
+     * <tt>writev()</tt> instead of <tt>sendmsg()</tt>.
+     */
+    bool not_socket;
+
+    /** Next queue that will be flushed at the end of current main loop
+     * iteration.
+     */
+    struct EM_output_s *pending_next;
+
+    /** Pointer to the pointer that points to this queue in the list of queues
+     * that will be flushed, or <tt>NULL</tt> if it's not in that list.
+     */
+    struct EM_output_s **pending_pprev;
+} EM_output;
+
+/** Initialize output queue.
+ *
+ * @param[out] output
+ *   Output queue to initialize.
+ *
+ * @param[in] event_machine
+ *   Event machine that will flush this queue.
+ *
+ * @param[in] event_descriptor
+ *   Event descriptor of the file descriptor data are written to. It has to
+ *   be registered using event_machine_add() before the first flush, and
+ *   file descriptor has to be nonblocking. Its <tt>events</tt> should not
+ *   contain <tt>EVENT_WRITE</tt>, it's added only while there are data that
+ *   couldn't be written.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_output_init(EM_output *output, EM *event_machine,
+    EM_event_descriptor *event_descriptor);
+
+/** Discard queued data and release memory of the queue. Registration of
+ * event descriptor isn't changed.
+ *
+ * @param[in] output
+ *   Output queue initialized by event_output_init().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_output_destroy(EM_output *output);
+
+/** Set backpressure thresholds.
+ *
+ * @param[in] output
+ *   Output queue initialized by event_output_init().
+ *
+ * @param[in] low_water
+ *   When number of queued bytes drops to this value after high-water mark
+ *   was exceeded, then #EM_OUTPUT_LOW_WATER is reported.
+ *
+ * @param[in] high_water
+ *   When number of queued bytes exceeds this value, then
+ *   #EM_OUTPUT_HIGH_WATER is reported. Value 0 disables watermarks.
+ *
+ * @param[in] handler
+ *   Callback that receives #EM_output_event, or <tt>NULL</tt>.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>handler</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if <tt>low_water</tt> is greater
+ *   than <tt>high_water</tt>.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_output_set_watermarks(EM_output *output, size_t low_water,
+    size_t high_water, EM_output_handler handler, void *data);
+
+/** Queue data. They are written at the end of current main loop iteration
+ * or, if file descriptor isn't writable, when event_output_flush() is
+ * called from event handler invoked with <tt>EVENT_WRITE</tt>.
+ *
+ * @param[in] output
+ *   Output queue initialized by event_output_init().
+ *
+ * @param[in] buffer
+ *   Data to write, they are copied.
+ *
+ * @param[in] length
+ *   Number of bytes in <tt>buffer</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_WRITE if previous write failed, <tt>errno</tt> is set
+ *   to its error.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if memory allocation failed, nothing was queued
+ *   in such case.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_output_write(EM_output *output, const void *buffer,
+    size_t length);
+
+/** Write as much of queued data as file descriptor accepts. Function has to
+ * be called by event handler when it's invoked with <tt>EVENT_WRITE</tt>.
+ *
+ * @param[in] output
+ *   Output queue initialized by event_output_init().
+ *
+ * @return
+ *   Returns #EM_ERROR_WRITE if writing failed. Queued data are
+ *   discarded and #EM_OUTPUT_ERROR is reported before function returns.
+ *
+ * @return
+ *   Errors of event_machine_modify() when <tt>EVENT_WRITE</tt> couldn't be
+ *   toggled.
+ *
+ * @return
+ *   On success, including the case when not all data could be written,
+ *   function returns <tt>EM_SUCCESS</tt>.
+ */
+uint32_t event_output_flush(EM_output *output);
+
+/** Number of queued bytes.
+ */
+static inline size_t event_output_queued(const EM_output *output)
+{
+    return output->queued;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_OUTPUT_H_265870941760399523917464035146282095027 */
@@ -0,0 +1,401 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-pool.h"
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define POOL_EM(pool, i)        (&((pool)->loops[i].event_machine))
+
+
+static void *pool_thread(void *const data)
+{
+    EM_pool_loop *const loop = data;
+
+    loop->result = event_machine_run(&(loop->event_machine));
+
+    return NULL;
+}
+
+static size_t online_cpus(void)
+{
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (size_t)n : 1;
+}
+
+uint32_t event_pool_init(EM_pool *const pool, size_t size)
+{
+    uint32_t ret = EM_SUCCESS;
+
+    if_null (pool)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    if_zero (size)
+    {
+        size = online_cpus();
+    }
+
+    pool->running = false;
+    pool->size = 0;
+    pool->loops = calloc(size, sizeof(EM_pool_loop));
+    if_null (pool->loops)
+    {
+        return EM_ERROR_MALLOC;
+    }
+
+    for (; pool->size < size; pool->size++)
+    {
+        EM_pool_loop *const loop = &(pool->loops[pool->size]);
+
+        loop->event_machine = (EM)EM_STATIC_DEFAULT;
+        loop->result = EM_SUCCESS;
+
+        if_em_failure_of (ret, event_machine_init(&(loop->event_machine)))
+        {
+            const int saved_errno = errno;
+
+            /* Event machine that failed to initialize may still hold some
+             * resources.
+             */
+            event_machine_destroy(&(loop->event_machine));
+            event_pool_destroy(pool);
+            errno = saved_errno;
+
+            return ret;
+        }
+    }
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_pool_destroy(EM_pool *const pool)
+{
+    uint32_t ret = EM_SUCCESS;
+
+    if_null (pool)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    for (size_t i = 0; i < pool->size; i++)
+    {
+        const uint32_t r = event_machine_destroy(POOL_EM(pool, i));
+        if (is_em_failure(r) && is_em_success(ret))
+        {
+            ret = r;
+        }
+    }
+
+    free(pool->loops);
+    pool->loops = NULL;
+    pool->size = 0;
+
+    return ret;
+}
+
+static int listening_socket(const struct sockaddr *const address,
+    const socklen_t address_len, const int backlog, const bool reuse_port)
+{
+    const int one = 1;
+
+    const int fd = socket(address->sa_family,
+        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if_invalid_fd (fd)
+    {
+        return -1;
+    }
+
+    if (is_negative(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one,
+            sizeof(one)))
+        || (reuse_port && is_negative(setsockopt(fd, SOL_SOCKET,
+            SO_REUSEPORT, &one, sizeof(one))))
+        || is_negative(bind(fd, address, address_len))
+        || is_negative(listen(fd, backlog > 0 ? backlog : SOMAXCONN)))
+    {
+        const int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+
+        return -1;
+    }
+
+    return fd;
+}
+
+uint32_t event_pool_listen(EM_pool *const pool,
+    EM_pool_listener *const listener, const struct sockaddr *const address,
+    const socklen_t address_len)
+{
+    uint32_t ret = EM_SUCCESS;
+
+    if (null(pool) || null(listener))
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (listener->handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+    if_null (address)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if (pool->running
+        || (listener->shard_mode != EM_POOL_SHARD_REUSEPORT
+            && listener->shard_mode != EM_POOL_SHARD_EXCLUSIVE)
+        || (listener->accept_policy != EM_POOL_ACCEPT_ONE
+            && listener->accept_policy != EM_POOL_ACCEPT_DRAIN))
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    const bool reuse_port = listener->shard_mode == EM_POOL_SHARD_REUSEPORT;
+
+    listener->num_fds = 0;
+    listener->fds = malloc((reuse_port ? pool->size : 1) * sizeof(int));
+    listener->entries = calloc(pool->size, sizeof(EM_pool_listener_entry));
+    if (null(listener->fds) || null(listener->entries))
+    {
+        ret = EM_ERROR_MALLOC;
+        goto failure;
+    }
+
+    /* When binding to port 0 each socket would get different port, therefore
+     * address of the first socket is used for all the others.
+     */
+    struct sockaddr_storage bound_address;
+    socklen_t bound_address_len = sizeof(bound_address);
+
+    for (size_t i = 0; i < pool->size; i++)
+    {
+        EM_pool_listener_entry *const entry = &(listener->entries[i]);
+
+        if (reuse_port || i == 0)
+        {
+            const int fd = i == 0
+                ? listening_socket(address, address_len, listener->backlog,
+                    reuse_port)
+                : listening_socket((struct sockaddr *)&bound_address,
+                    bound_address_len, listener->backlog, reuse_port);
+            if_invalid_fd (fd)
+            {
+                ret = EM_ERROR_SOCKET;
+                goto failure;
+            }
+            listener->fds[listener->num_fds++] = fd;
+
+            if (i == 0 && is_negative(getsockname(fd,
+                (struct sockaddr *)&bound_address, &bound_address_len)))
+            {
+                ret = EM_ERROR_SOCKET;
+                goto failure;
+            }
+        }
+
+        entry->listener = listener;
+
+        if_em_failure_of (ret, event_listener_create(POOL_EM(pool, i),
+            &(entry->event_listener), listener->fds[listener->num_fds - 1],
+            listener->accept_policy == EM_POOL_ACCEPT_ONE ? 1 : 0,
+            reuse_port ? 0 : EM_LISTENER_EXCLUSIVE, listener->handler,
+            listener->data))
+        {
+            /* Entry is not registered, make sure that it's not removed.
+             */
+            entry->listener = NULL;
+            goto failure;
+        }
+    }
+
+    return EM_SUCCESS;
+
+failure:
+    {
+        const int saved_errno = errno;
+
+        event_pool_unlisten(pool, listener);
+        errno = saved_errno;
+    }
+
+    return ret;
+}
+
+uint32_t event_pool_unlisten(EM_pool *const pool,
+    EM_pool_listener *const listener)
+{
+    uint32_t ret = EM_SUCCESS;
+
+    if (null(pool) || null(listener))
+    {
+        return EM_ERROR_NULL;
+    }
+    if (pool->running)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    for (size_t i = 0; not_null(listener->entries) && i < pool->size; i++)
+    {
+        EM_pool_listener_entry *const entry = &(listener->entries[i]);
+
+        if_null (entry->listener)
+        {
+            continue;
+        }
+
+        const uint32_t r = event_listener_destroy(&(entry->event_listener));
+        if (is_em_failure(r) && is_em_success(ret))
+        {
+            ret = r;
+        }
+        entry->listener = NULL;
+    }
+
+    for (size_t i = 0; i < listener->num_fds; i++)
+    {
+        if (is_negative(close(listener->fds[i])) && is_em_success(ret))
+        {
+            ret = EM_ERROR_CLOSE;
+        }
+    }
+
+    free(listener->entries);
+    free(listener->fds);
+    listener->entries = NULL;
+    listener->fds = NULL;
+    listener->num_fds = 0;
+
+    return ret;
+}
+
+uint32_t event_pool_start(EM_pool *const pool, const bool pin_threads)
+{
+    if_null (pool)
+    {
+        return EM_ERROR_NULL;
+    }
+    if (pool->running)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    const size_t cpus = online_cpus();
+
+    for (size_t i = 0; i < pool->size; i++)
+    {
+        EM_pool_loop *const loop = &(pool->loops[i]);
+
+        loop->result = EM_SUCCESS;
+
+        const int err =
+            pthread_create(&(loop->thread), NULL, pool_thread, loop);
+        if_not_zero (err)
+        {
+            /* Stop only threads that were already started.
+             */
+            const size_t size = pool->size;
+
+            pool->size = i;
+            pool->running = true;
+            event_pool_stop(pool);
+            pool->size = size;
+            errno = err;
+
+            return EM_ERROR_THREAD;
+        }
+
+        if (pin_threads)
+        {
+            cpu_set_t cpu_set;
+
+            CPU_ZERO(&cpu_set);
+            CPU_SET(i % cpus, &cpu_set);
+            pthread_setaffinity_np(loop->thread, sizeof(cpu_set), &cpu_set);
+        }
+    }
+    pool->running = true;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_pool_stop(EM_pool *const pool)
+{
+    uint32_t ret = EM_SUCCESS;
+
+    if_null (pool)
+    {
+        return EM_ERROR_NULL;
+    }
+    if (not(pool->running))
+    {
+        return EM_SUCCESS;
+    }
+
+    for (size_t i = 0; i < pool->size; i++)
+    {
+        const uint32_t r = event_machine_terminate(POOL_EM(pool, i));
+        if (is_em_failure(r) && is_em_success(ret))
+        {
+            ret = r;
+        }
+    }
+
+    for (size_t i = 0; i < pool->size; i++)
+    {
+        EM_pool_loop *const loop = &(pool->loops[i]);
+
+        const int err = pthread_join(loop->thread, NULL);
+        if (err != 0 && is_em_success(ret))
+        {
+            errno = err;
+            ret = EM_ERROR_THREAD;
+        }
+        if (is_em_failure(loop->result) && is_em_success(ret))
+        {
+            ret = loop->result;
+        }
+    }
+    pool->running = false;
+
+    return ret;
+}
@@ -0,0 +1,316 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-pool.h
+ * Pool of event machines, each of them driven by its own thread.
+ *
+ * One #EM is processed by only one thread, therefore to use more CPU cores
+ * it's necessary to run more event machines. Pool starts N event machines on
+ * N threads and shards listening sockets among them so that each connection
+ * is accepted, and later handled, by exactly one of them.
+ *
+ * Usage example can be found here: @link example/tcp-server-pool.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ *
+ * @example example/tcp-server-pool.c
+ *   Variant of @link example/tcp-server.c @endlink that accepts and handles
+ *   connections on all CPU cores.
+ */
+
+#ifndef EVENT_POOL_H_301622945861934735618424604217432530192
+#define EVENT_POOL_H_301622945861934735618424604217432530192
+
+#include "event-listener.h"
+#include "event-machine.h"
+#include <pthread.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** How listening socket is shared among event machines in a pool.
+ */
+typedef enum
+{
+    /** Each event machine gets its own listening socket bound to the same
+     * address using <tt>SO_REUSEPORT</tt>. Kernel distributes incoming
+     * connections among them.
+     */
+    EM_POOL_SHARD_REUSEPORT = 0,
+
+    /** One listening socket is registered in all event machines. With
+     * <tt>epoll</tt> it is registered using <tt>EPOLLEXCLUSIVE</tt> so that
+     * only one of the waiting event machines is woken up per connection.
+     * With <tt>io_uring</tt> backend all of them are woken up, which wastes
+     * an <tt>accept4()</tt> call per event machine and connection, prefer
+     * #EM_POOL_SHARD_REUSEPORT there.
+     */
+    EM_POOL_SHARD_EXCLUSIVE = 1
+} EM_pool_shard_mode;
+
+/** How many connections are accepted when listening socket becomes
+ * readable.
+ */
+typedef enum
+{
+    /** Accept one connection per event. Remaining connections are accepted
+     * in following event loop iterations, possibly by other event machines.
+     * This spreads connections more evenly in #EM_POOL_SHARD_EXCLUSIVE mode.
+     */
+    EM_POOL_ACCEPT_ONE = 0,
+
+    /** Accept connections until <tt>accept4()</tt> reports that there are no
+     * more pending connections, but at most #EM_LISTENER_DEFAULT_BUDGET of
+     * them per event.
+     */
+    EM_POOL_ACCEPT_DRAIN = 1
+} EM_pool_accept_policy;
+
+/** Type of callbacks invoked for each accepted connection, same as for
+ * #EM_listener. Callback is invoked by a thread of the pool that accepted
+ * the connection, therefore it may register <tt>fd</tt> in
+ * <tt>event_machine</tt>. Its <tt>data</tt> argument is the private data of
+ * listener as passed to event_pool_listen().
+ */
+typedef EM_listener_handler EM_pool_accept_handler;
+
+/** One event machine of a pool together with thread that runs it.
+ */
+typedef struct
+{
+    EM event_machine;
+    pthread_t thread;
+
+    /** Value returned by event_machine_run() after thread finished.
+     */
+    uint32_t result;
+} EM_pool_loop;
+
+/** Pool of event machines.
+ *
+ * Has to be initialized using event_pool_init() and, after it's no longer
+ * needed, destroyed using event_pool_destroy().
+ */
+typedef struct
+{
+    /** Array of <tt>size</tt> event machines.
+     */
+    EM_pool_loop *loops;
+
+    /** Number of event machines in a pool.
+     */
+    size_t size;
+
+    /** True while threads started by event_pool_start() are running.
+     */
+    bool running;
+} EM_pool;
+
+struct EM_pool_listener_s;  /* Forward declaration */
+
+/** Registration of listening socket in one event machine of a pool.
+ */
+typedef struct
+{
+    EM_listener event_listener;
+    struct EM_pool_listener_s *listener;
+} EM_pool_listener_entry;
+
+/** Listening socket sharded among all event machines of a pool.
+ *
+ * Caller fills in configuration fields and passes it to
+ * event_pool_listen(). Rest of the fields is managed by the pool.
+ */
+typedef struct EM_pool_listener_s
+{
+    /** How is the listening socket shared among event machines.
+     */
+    EM_pool_shard_mode shard_mode;
+
+    /** How many connections are accepted per event.
+     */
+    EM_pool_accept_policy accept_policy;
+
+    /** Backlog passed to <tt>listen()</tt>. If it's zero or negative then
+     * <tt>SOMAXCONN</tt> is used.
+     */
+    int backlog;
+
+    /** Callback invoked for each accepted connection. It may not be
+     * <tt>NULL</tt>.
+     */
+    EM_pool_accept_handler handler;
+
+    /** Private data passed to <tt>handler</tt>. Value may be <tt>NULL</tt>.
+     */
+    void *data;
+
+    /** One entry per event machine in a pool.
+     *
+     * @default NULL
+     */
+    EM_pool_listener_entry *entries;
+
+    /** Listening sockets, one per event machine in
+     * #EM_POOL_SHARD_REUSEPORT mode and only one in
+     * #EM_POOL_SHARD_EXCLUSIVE mode.
+     *
+     * @default NULL
+     */
+    int *fds;
+
+    /** Number of entries in <tt>fds</tt> array.
+     */
+    size_t num_fds;
+} EM_pool_listener;
+
+/** Initialize pool and all its event machines.
+ *
+ * @param[in] pool
+ *   Pool to initialize. If <tt>pool = NULL</tt> then this function fails
+ *   with #EM_ERROR_NULL.
+ *
+ * @param[in] size
+ *   Number of event machines in a pool. If it's 0 then number of online CPUs
+ *   is used.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if allocation of event machines failed.
+ *
+ * @return
+ *   Errors returned by event_machine_init().
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_pool_init(EM_pool *pool, size_t size);
+
+/** Destroy all event machines and free memory associated with pool.
+ *
+ * Pool has to be stopped first, see event_pool_stop().
+ *
+ * @return
+ *   Errors returned by event_machine_destroy(). In such case rest of the
+ *   event machines is destroyed anyway.
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_pool_destroy(EM_pool *pool);
+
+/** Create listening socket(s) bound to <tt>address</tt> and register them in
+ * all event machines of a pool.
+ *
+ * Listeners can be added only while pool is not running.
+ *
+ * @param[in] pool
+ *   Initialized pool.
+ *
+ * @param[in] listener
+ *   Listener with configuration fields filled in. It has to stay allocated
+ *   until event_pool_unlisten() is called.
+ *
+ * @param[in] address
+ *   Address to bind to. If port is zero, then port selected by kernel for
+ *   first socket is used by all of them.
+ *
+ * @param[in] address_len
+ *   Length of <tt>address</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_NULL, #EM_ERROR_CALLBACK_NULL or #EM_ERROR_BUFFER_NULL
+ *   if <tt>pool</tt>, <tt>listener->handler</tt> or <tt>address</tt> are
+ *   <tt>NULL</tt>, respectively.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if pool is running or if
+ *   <tt>shard_mode</tt> or <tt>accept_policy</tt> has unknown value.
+ *
+ * @return
+ *   Returns #EM_ERROR_SOCKET if creating, binding or listening on socket
+ *   failed.
+ *
+ * @return
+ *   Errors returned by event_machine_add().
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_pool_listen(EM_pool *pool, EM_pool_listener *listener,
+    const struct sockaddr *address, socklen_t address_len);
+
+/** Unregister listener from all event machines and close its sockets.
+ *
+ * Pool may not be running while calling this function.
+ */
+uint32_t event_pool_unlisten(EM_pool *pool, EM_pool_listener *listener);
+
+/** Start one thread per event machine, each running event_machine_run().
+ *
+ * @param[in] pool
+ *   Initialized pool.
+ *
+ * @param[in] pin_threads
+ *   If true, then i-th thread is bound to i-th CPU (modulo number of
+ *   online CPUs). Failure to set affinity is ignored.
+ *
+ * @return
+ *   Returns #EM_ERROR_THREAD if thread could not be created. Threads that
+ *   were already started are stopped before returning.
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_pool_start(EM_pool *pool, bool pin_threads);
+
+/** Terminate all event machines and wait for their threads to finish.
+ *
+ * May be called from any thread except threads of the pool itself.
+ *
+ * @return
+ *   Returns first error returned by event_machine_terminate(),
+ *   event_machine_run() or #EM_ERROR_THREAD if joining thread failed.
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_pool_stop(EM_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_POOL_H_301622945861934735618424604217432530192 */
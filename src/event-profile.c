@@ -0,0 +1,328 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-profile.h"
+#include "event-machine/profile-internal.h"
+#include "event-machine/result-internal.h"
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_MIN_SIZE        16
+
+/* Fibonacci hashing of function pointer, size has to be a power of two.
+ */
+static inline size_t handler_hash(const EM_event_handler handler,
+    const size_t size)
+{
+    const uint64_t key = (uint64_t)(uintptr_t)handler;
+
+    return (size_t)((key * 11400714819323198485ull) >> 32) & (size - 1);
+}
+
+static EM_handler_profile *lookup(const struct EM_profile_s *const profile,
+    const EM_event_handler handler)
+{
+    size_t i = handler_hash(handler, profile->size);
+
+    while (not_null(profile->table[i].handler)
+        && profile->table[i].handler != handler)
+    {
+        i = (i + 1) & (profile->size - 1);
+    }
+
+    return &(profile->table[i]);
+}
+
+/* Double size of hash table, it's kept at most half full.
+ */
+static int grow(struct EM_profile_s *const profile)
+{
+    struct EM_profile_s grown = (*profile);
+
+    grown.size = profile->size * 2;
+    grown.table = calloc(grown.size, sizeof(EM_handler_profile));
+    if_null (grown.table)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < profile->size; i++)
+    {
+        if_not_null (profile->table[i].handler)
+        {
+            (*lookup(&grown, profile->table[i].handler)) = profile->table[i];
+        }
+    }
+    free(profile->table);
+    (*profile) = grown;
+
+    return 0;
+}
+
+static inline size_t bucket(const uint64_t nsec)
+{
+    if_zero (nsec)
+    {
+        return 0;
+    }
+
+    const size_t i = 64 - (size_t)__builtin_clzll(nsec);
+
+    return i < EM_PROFILE_BUCKETS ? i : EM_PROFILE_BUCKETS - 1;
+}
+
+bool em_profile_record(EM *const em, const EM_event_handler handler,
+    const int fd, const uint64_t nsec)
+{
+    struct EM_profile_s *const profile = em->profile;
+
+    EM_handler_profile *entry = lookup(profile, handler);
+    if_null (entry->handler)
+    {
+        /* Invocation is dropped if there is no memory for new handler.
+         */
+        if ((profile->count + 1) * 2 > profile->size)
+        {
+            if_negative (grow(profile))
+            {
+                return false;
+            }
+            entry = lookup(profile, handler);
+        }
+        entry->handler = handler;
+        profile->count++;
+    }
+
+    entry->calls++;
+    entry->total_nsec += nsec;
+    entry->buckets[bucket(nsec)]++;
+    if (nsec > entry->max_nsec)
+    {
+        entry->max_nsec = nsec;
+    }
+
+    if (profile->slow_nsec > 0 && nsec >= profile->slow_nsec)
+    {
+        entry->slow_calls++;
+        if_not_null (profile->slow_handler)
+        {
+            profile->slow_handler(em, fd, handler, nsec, profile->data);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void em_profile_free(struct EM_profile_s *const profile)
+{
+    if_not_null (profile)
+    {
+        free(profile->table);
+        free(profile);
+    }
+}
+
+uint32_t event_profile_enable(EM *const em, const uint64_t slow_nsec,
+    const EM_slow_handler slow_handler, void *const data)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    if_null (em->profile)
+    {
+        struct EM_profile_s *const profile =
+            calloc(1, sizeof(struct EM_profile_s));
+        if_null (profile)
+        {
+            return EM_ERROR_MALLOC;
+        }
+
+        profile->size = PROFILE_MIN_SIZE;
+        profile->table = calloc(profile->size, sizeof(EM_handler_profile));
+        if_null (profile->table)
+        {
+            free(profile);
+
+            return EM_ERROR_MALLOC;
+        }
+        em->profile = profile;
+    }
+
+    em->profile->slow_nsec = slow_nsec;
+    em->profile->slow_handler = slow_handler;
+    em->profile->data = data;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_profile_disable(EM *const em)
+{
+    if_null (em)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    em_profile_free(em->profile);
+    em->profile = NULL;
+
+    return EM_SUCCESS;
+}
+
+size_t event_profile_handlers(const EM *const em,
+    EM_handler_profile *const profiles, const size_t size)
+{
+    if (null(em) || null(em->profile))
+    {
+        return 0;
+    }
+
+    const struct EM_profile_s *const profile = em->profile;
+    size_t n = 0;
+
+    for (size_t i = 0; i < profile->size; i++)
+    {
+        if_not_null (profile->table[i].handler)
+        {
+            if (n < size)
+            {
+                profiles[n] = profile->table[i];
+            }
+            n++;
+        }
+    }
+
+    return n;
+}
+
+uint64_t event_profile_percentile(const EM_handler_profile *const profile,
+    const double percentile)
+{
+    if (null(profile) || profile->calls == 0)
+    {
+        return 0;
+    }
+
+    const double rank = (double)profile->calls * percentile / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < EM_PROFILE_BUCKETS; i++)
+    {
+        seen += profile->buckets[i];
+        if ((double)seen >= rank && seen > 0)
+        {
+            /* Last bucket is open, maximum is the best upper bound of it and
+             * it's also tighter bound of the bucket it falls into.
+             */
+            const uint64_t bound = (uint64_t)1 << i;
+
+            return i == EM_PROFILE_BUCKETS - 1 || bound > profile->max_nsec
+                ? profile->max_nsec
+                : bound;
+        }
+    }
+
+    return profile->max_nsec;
+}
+
+char *event_profile_symbol(const EM_event_handler handler, char *const buffer,
+    const size_t size)
+{
+    Dl_info info;
+    void *const address = (void *)(uintptr_t)handler;
+
+    if (null(buffer) || size == 0)
+    {
+        return buffer;
+    }
+
+    if (dladdr(address, &info) == 0)
+    {
+        snprintf(buffer, size, "%p", address);
+    }
+    else if (not_null(info.dli_sname) && info.dli_saddr == address)
+    {
+        snprintf(buffer, size, "%s", info.dli_sname);
+    }
+    else
+    {
+        /* Nearest symbol belongs to some other function, e.g. if handler is
+         * static, offset from start of object file is more useful.
+         */
+        snprintf(buffer, size, "%s+%#lx",
+            null(info.dli_fname) ? "?" : info.dli_fname,
+            (unsigned long)((uintptr_t)address - (uintptr_t)info.dli_fbase));
+    }
+
+    return buffer;
+}
+
+void event_profile_print(const EM *const em, FILE *const stream)
+{
+    if (null(em) || null(em->profile) || null(stream))
+    {
+        return;
+    }
+
+    const struct EM_profile_s *const profile = em->profile;
+    char name[256];
+
+    fprintf(stream, "%-40s %10s %10s %10s %10s %10s %10s %8s\n", "handler",
+        "calls", "avg_ns", "p50_ns", "p99_ns", "p999_ns", "max_ns", "slow");
+
+    for (size_t i = 0; i < profile->size; i++)
+    {
+        const EM_handler_profile *const entry = &(profile->table[i]);
+
+        if_null (entry->handler)
+        {
+            continue;
+        }
+
+        fprintf(stream,
+            "%-40s %10llu %10llu %10llu %10llu %10llu %10llu %8llu\n",
+            event_profile_symbol(entry->handler, name, sizeof(name)),
+            (unsigned long long)entry->calls,
+            (unsigned long long)(entry->total_nsec / entry->calls),
+            (unsigned long long)event_profile_percentile(entry, 50),
+            (unsigned long long)event_profile_percentile(entry, 99),
+            (unsigned long long)event_profile_percentile(entry, 99.9),
+            (unsigned long long)entry->max_nsec,
+            (unsigned long long)entry->slow_calls);
+    }
+}
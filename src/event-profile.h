@@ -0,0 +1,235 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-profile.h
+ * Per handler latency histograms and detection of slow event handlers.
+ *
+ * One slow event handler delays all other events of the same batch. When
+ * profiling is enabled using event_profile_enable(), event machine measures
+ * duration of each event handler invocation and records it in a histogram
+ * of that handler function. Histograms have logarithmic buckets, recording
+ * is one clock read, a lookup in a small hash table keyed by handler
+ * function pointer and few increments. Invocations that take at least
+ * configured threshold are also reported to a slow handler callback along
+ * with their file descriptor.
+ *
+ * Handler functions are symbolized using <tt>dladdr()</tt>, therefore only
+ * functions exported from shared objects, or from executables linked with
+ * <tt>-rdynamic</tt>, have names. Others are printed as object file and
+ * offset, which can be resolved using <tt>addr2line</tt>.
+ *
+ * Profiling isn't thread safe, it has to be used only by the thread that runs
+ * the event machine.
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_PROFILE_H_103858129375601626741873093924011576183
+#define EVENT_PROFILE_H_103858129375601626741873093924011576183
+
+#include "event-machine.h"
+#include <stdio.h>      /* FILE */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of histogram buckets. Bucket 0 counts invocations that took 0
+ * nanoseconds and bucket <tt>i > 0</tt> those that took from
+ * <tt>2^(i - 1)</tt> to <tt>2^i - 1</tt> nanoseconds, last bucket counts all
+ * longer invocations as well.
+ */
+#define EM_PROFILE_BUCKETS      40
+
+/** Type of callback invoked after event handler invocation that took at least
+ * the threshold passed to event_profile_enable().
+ *
+ * @param[in] event_machine
+ *   Event machine that dispatched the event.
+ *
+ * @param[in] fd
+ *   File descriptor of the event.
+ *
+ * @param[in] handler
+ *   Event handler that was slow.
+ *
+ * @param[in] nsec
+ *   Duration of handler invocation in nanoseconds.
+ *
+ * @param[in] data
+ *   Pointer passed to event_profile_enable().
+ */
+typedef void (*EM_slow_handler)(EM *event_machine, int fd,
+    EM_event_handler handler, uint64_t nsec, void *data);
+
+/** Statistics of one event handler function.
+ */
+typedef struct
+{
+    /** Event handler function.
+     */
+    EM_event_handler handler;
+
+    /** Number of invocations.
+     */
+    uint64_t calls;
+
+    /** Sum of durations of all invocations in nanoseconds.
+     */
+    uint64_t total_nsec;
+
+    /** Duration of the longest invocation in nanoseconds.
+     */
+    uint64_t max_nsec;
+
+    /** Number of invocations that reached slow handler threshold.
+     */
+    uint64_t slow_calls;
+
+    /** Histogram of durations, see #EM_PROFILE_BUCKETS.
+     */
+    uint64_t buckets[EM_PROFILE_BUCKETS];
+} EM_handler_profile;
+
+/** Start measuring event handlers of event machine. Calling it again only
+ * changes slow handler settings, collected histograms are kept.
+ *
+ * @param[in] event_machine
+ *   Event machine whose event handlers are measured.
+ *
+ * @param[in] slow_nsec
+ *   Threshold in nanoseconds for invoking <tt>slow_handler</tt>, zero
+ *   disables detection of slow handlers.
+ *
+ * @param[in] slow_handler
+ *   Callback invoked after each event handler invocation that took at least
+ *   <tt>slow_nsec</tt>, or <tt>NULL</tt>.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>slow_handler</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if memory allocation failed.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_profile_enable(EM *event_machine, uint64_t slow_nsec,
+    EM_slow_handler slow_handler, void *data);
+
+/** Stop measuring event handlers and discard collected histograms. It's also
+ * done by event_machine_destroy().
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_profile_disable(EM *event_machine);
+
+/** Copy statistics of event handlers.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[out] profiles
+ *   Array where statistics are copied, can be <tt>NULL</tt> if
+ *   <tt>size</tt> is 0.
+ *
+ * @param[in] size
+ *   Number of elements of <tt>profiles</tt> array.
+ *
+ * @return
+ *   Number of measured event handlers, which may be more than
+ *   <tt>size</tt>, in such case only first <tt>size</tt> of them were
+ *   copied. Zero if profiling isn't enabled.
+ */
+size_t event_profile_handlers(const EM *event_machine,
+    EM_handler_profile *profiles, size_t size);
+
+/** Upper bound of given percentile of event handler durations.
+ *
+ * @param[in] profile
+ *   Statistics of event handler.
+ *
+ * @param[in] percentile
+ *   Percentile between 0 and 100, e.g. 99.9.
+ *
+ * @return
+ *   Upper bound of histogram bucket in nanoseconds, capped by maximum
+ *   duration, i.e. at least <tt>percentile</tt> percent of invocations
+ *   weren't longer. Returns 0 if there were no invocations.
+ */
+uint64_t event_profile_percentile(const EM_handler_profile *profile,
+    double percentile);
+
+/** Name of event handler function.
+ *
+ * @param[in] handler
+ *   Event handler function.
+ *
+ * @param[out] buffer
+ *   Buffer where name is stored, it's always terminated by zero.
+ *
+ * @param[in] size
+ *   Size of <tt>buffer</tt> in bytes.
+ *
+ * @return
+ *   Returns <tt>buffer</tt>. It contains function name if
+ *   <tt>dladdr()</tt> found an exported symbol at exactly that address,
+ *   otherwise object file name and offset, or just address.
+ */
+char *event_profile_symbol(EM_event_handler handler, char *buffer,
+    size_t size);
+
+/** Print table of all measured event handlers with their number of
+ * invocations, average, 50th, 99th and 99.9th percentile and maximum
+ * duration.
+ *
+ * @param[in] event_machine
+ *   Event machine instance function operates on.
+ *
+ * @param[in] stream
+ *   Stream where table is printed.
+ */
+void event_profile_print(const EM *event_machine, FILE *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_PROFILE_H_103858129375601626741873093924011576183 */
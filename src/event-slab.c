@@ -0,0 +1,161 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event-slab.h"
+#include "event-machine/result-internal.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each chunk starts with one cache line that holds pointer to next chunk,
+ * slots follow it.
+ */
+#define CHUNK_HEADER_SIZE   EM_CACHE_LINE_SIZE
+
+
+uint32_t event_slab_init(EM_slab *const slab, EM *const em,
+    const size_t payload_size, const size_t refill)
+{
+    if (null(slab) || null(em))
+    {
+        return EM_ERROR_NULL;
+    }
+
+    slab->event_machine = em;
+    slab->slot_size = (EM_SLAB_PAYLOAD_OFFSET + payload_size
+        + EM_CACHE_LINE_SIZE - 1) & ~((size_t)EM_CACHE_LINE_SIZE - 1);
+    slab->refill = refill == 0 ? EM_SLAB_DEFAULT_REFILL : refill;
+    slab->free_list = NULL;
+    slab->unused = NULL;
+    slab->unused_end = NULL;
+    slab->chunks = NULL;
+    slab->in_use = 0;
+    slab->allocated = 0;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_slab_destroy(EM_slab *const slab)
+{
+    if_null (slab)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    while (not_null(slab->chunks))
+    {
+        void *const next = *(void **)slab->chunks;
+
+        free(slab->chunks);
+        slab->chunks = next;
+    }
+
+    slab->free_list = NULL;
+    slab->unused = NULL;
+    slab->unused_end = NULL;
+    slab->in_use = 0;
+    slab->allocated = 0;
+
+    return EM_SUCCESS;
+}
+
+/* Allocate new chunk of slots. They are handed out sequentially from
+ * unused..unused_end, therefore their memory isn't touched until needed.
+ */
+static int refill(EM_slab *const slab)
+{
+    const size_t size = CHUNK_HEADER_SIZE + slab->refill * slab->slot_size;
+    char *const chunk = aligned_alloc(EM_CACHE_LINE_SIZE, size);
+
+    if_null (chunk)
+    {
+        return -1;
+    }
+
+    *(void **)chunk = slab->chunks;
+    slab->chunks = chunk;
+    slab->unused = chunk + CHUNK_HEADER_SIZE;
+    slab->unused_end = chunk + size;
+    slab->allocated += size;
+
+    return 0;
+}
+
+EM_event_descriptor *event_slab_alloc(EM_slab *const slab)
+{
+    char *slot = NULL;
+
+    assert(slab != NULL);
+
+    if_not_null (slab->free_list)
+    {
+        slot = slab->free_list;
+        slab->free_list = *(void **)slot;
+    }
+    else
+    {
+        if (slab->unused == slab->unused_end && is_negative(refill(slab)))
+        {
+            errno = ENOMEM;
+
+            return NULL;
+        }
+        slot = slab->unused;
+        slab->unused += slab->slot_size;
+    }
+
+    memset(slot, 0, slab->slot_size);
+    slab->in_use++;
+
+    EM_event_descriptor *const ed = (EM_event_descriptor *)slot;
+    ed->fd = -1;
+    ed->data = slot + EM_SLAB_PAYLOAD_OFFSET;
+
+    return ed;
+}
+
+void event_slab_free(EM_slab *const slab, EM_event_descriptor *const ed)
+{
+    assert(slab != NULL);
+
+    if_null (ed)
+    {
+        return;
+    }
+
+    assert(slab->in_use > 0);
+
+    *(void **)ed = slab->free_list;
+    slab->free_list = ed;
+    slab->in_use--;
+}
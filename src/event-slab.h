@@ -0,0 +1,204 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-slab.h
+ * Allocator of event descriptors together with per-connection state.
+ *
+ * Slab hands out fixed-size slots, each holding an #EM_event_descriptor
+ * followed by user payload of size given to event_slab_init(). Slots are
+ * aligned to, and their size is a multiple of, #EM_CACHE_LINE_SIZE, so that
+ * state of two connections never shares a cache line.
+ *
+ * Memory is allocated in chunks of many slots at once and released slots are
+ * kept on a free list for reuse, therefore allocation and release are just a
+ * few pointer operations and general-purpose allocator is rarely involved.
+ * Memory is returned to the system only by event_slab_destroy().
+ *
+ * Slab is tied to one event machine and there is no locking. It has to be
+ * used only by the thread that runs that event machine. Each event machine in
+ * an #EM_pool needs its own slab.
+ *
+ * Usage example can be found here: @link example/tcp-server.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_SLAB_H_142751853270963018856542217603890148215
+#define EVENT_SLAB_H_142751853270963018856542217603890148215
+
+#include "event-machine.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Alignment of slots, and granularity of their size, in bytes.
+ */
+#ifndef EM_CACHE_LINE_SIZE
+#define EM_CACHE_LINE_SIZE          64
+#endif
+
+/** Offset of user payload from the beginning of a slot. Payload is aligned
+ * to 16 bytes, which is enough for any standard type.
+ */
+#define EM_SLAB_PAYLOAD_OFFSET  \
+    ((sizeof(EM_event_descriptor) + 15) & ~(size_t)15)
+
+/** Number of slots allocated at once if zero is passed to event_slab_init().
+ */
+#define EM_SLAB_DEFAULT_REFILL      256
+
+/** Slab allocator. Its fields are private, use functions declared below.
+ */
+typedef struct
+{
+    /** Event machine this slab is tied to.
+     */
+    EM *event_machine;
+
+    /** Size of one slot in bytes.
+     */
+    size_t slot_size;
+
+    /** Number of slots allocated at once when there are no free slots.
+     */
+    size_t refill;
+
+    /** Released slots linked through their first bytes.
+     */
+    void *free_list;
+
+    /** Part of the most recently allocated chunk that was never handed
+     * out.
+     */
+    char *unused;
+    char *unused_end;
+
+    /** List of allocated chunks linked through their first cache line.
+     */
+    void *chunks;
+
+    /** Number of slots that were allocated using event_slab_alloc() and
+     * weren't released, yet.
+     */
+    size_t in_use;
+
+    /** Number of bytes allocated by the slab.
+     */
+    size_t allocated;
+} EM_slab;
+
+/** Initialize slab.
+ *
+ * @param[out] slab
+ *   Slab to initialize.
+ *
+ * @param[in] event_machine
+ *   Event machine that is the only one using this slab.
+ *
+ * @param[in] payload_size
+ *   Size of user data stored after event descriptor in each slot. Can be
+ *   zero.
+ *
+ * @param[in] refill
+ *   Number of slots allocated at once when all slots are in use. Value 0
+ *   means #EM_SLAB_DEFAULT_REFILL.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_slab_init(EM_slab *slab, EM *event_machine,
+    size_t payload_size, size_t refill);
+
+/** Release all memory allocated by the slab, including slots that are still
+ * in use.
+ *
+ * @param[in] slab
+ *   Slab initialized by event_slab_init().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_slab_destroy(EM_slab *slab);
+
+/** Allocate one slot.
+ *
+ * Event descriptor in returned slot has <tt>fd</tt> set to -1 and
+ * <tt>data</tt> pointing to the payload, which is filled with zeros. Other
+ * fields are zero.
+ *
+ * @param[in] slab
+ *   Slab initialized by event_slab_init().
+ *
+ * @return
+ *   Event descriptor at the beginning of the slot or <tt>NULL</tt> if memory
+ *   allocation failed, in which case <tt>errno</tt> is set.
+ */
+EM_event_descriptor *event_slab_alloc(EM_slab *slab);
+
+/** Return slot to the slab. Event descriptor in it has to be unregistered
+ * from event machine first.
+ *
+ * @param[in] slab
+ *   Slab the slot was allocated from.
+ *
+ * @param[in] event_descriptor
+ *   Value returned by event_slab_alloc(). Value <tt>NULL</tt> is ignored.
+ */
+void event_slab_free(EM_slab *slab, EM_event_descriptor *event_descriptor);
+
+/** Payload of a slot allocated by event_slab_alloc().
+ */
+static inline void *event_slab_payload(EM_event_descriptor *event_descriptor)
+{
+    return (char *)event_descriptor + EM_SLAB_PAYLOAD_OFFSET;
+}
+
+/** Event descriptor of a slot given its payload. Inverse of
+ * event_slab_payload().
+ */
+static inline EM_event_descriptor *event_slab_descriptor(void *payload)
+{
+    return (EM_event_descriptor *)((char *)payload - EM_SLAB_PAYLOAD_OFFSET);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_SLAB_H_142751853270963018856542217603890148215 */
@@ -0,0 +1,240 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-splice.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPLICE_FLAGS    (SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+
+
+/* Add or remove event bit from events of event descriptor.
+ */
+static uint32_t set_event(EM *const em, EM_event_descriptor *const ed,
+    bool *const state, const event_filter_t event, const bool enable)
+{
+    if ((*state) == enable)
+    {
+        return EM_SUCCESS;
+    }
+
+    if (enable)
+    {
+        ed->events |= event;
+    }
+    else
+    {
+        ed->events &= ~event;
+    }
+    ret_em_failure(event_machine_modify(em, ed->fd, ed, NULL));
+    (*state) = enable;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_splice_init(EM_splice *const forward, EM *const em,
+    EM_event_descriptor *const source, EM_event_descriptor *const sink,
+    const size_t pipe_size, const EM_splice_handler handler, void *const data)
+{
+    if (null(forward) || null(em))
+    {
+        return EM_ERROR_NULL;
+    }
+    if (null(source) || null(sink))
+    {
+        return EM_ERROR_DESCRIPTOR_NULL;
+    }
+
+    memset(forward, 0, sizeof(EM_splice));
+    forward->pipe[0] = -1;
+    forward->pipe[1] = -1;
+    if_negative (pipe2(forward->pipe, O_NONBLOCK | O_CLOEXEC))
+    {
+        return EM_ERROR_PIPE;
+    }
+
+    /* Bigger pipe means fewer splice() calls per byte. Failure isn't fatal,
+     * pipe simply keeps its default size.
+     */
+    fcntl(forward->pipe[1], F_SETPIPE_SZ,
+        (int)(pipe_size == 0 ? EM_SPLICE_DEFAULT_PIPE_SIZE : pipe_size));
+    const int size = fcntl(forward->pipe[1], F_GETPIPE_SZ);
+    if_negative (size)
+    {
+        event_splice_destroy(forward);
+
+        return EM_ERROR_FCNTL;
+    }
+
+    forward->event_machine = em;
+    forward->source = source;
+    forward->sink = sink;
+    forward->pipe_size = (size_t)size;
+    forward->handler = handler;
+    forward->data = data;
+    forward->reading = (source->events & EVENT_READ) != 0;
+    forward->writing = (sink->events & EVENT_WRITE) != 0;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_splice_destroy(EM_splice *const forward)
+{
+    if_null (forward)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (valid_fd(forward->pipe[i]))
+        {
+            close(forward->pipe[i]);
+            forward->pipe[i] = -1;
+        }
+    }
+    forward->buffered = 0;
+
+    return EM_SUCCESS;
+}
+
+static uint32_t fail(EM_splice *const forward)
+{
+    const int error = errno;
+
+    /* Callback may destroy the forwarding, it's not touched afterwards.
+     */
+    forward->error = error;
+    if_not_null (forward->handler)
+    {
+        forward->handler(forward->event_machine, forward, EM_SPLICE_ERROR,
+            forward->data);
+    }
+    errno = error;
+
+    return EM_ERROR_SPLICE;
+}
+
+uint32_t event_splice_pump(EM_splice *const forward)
+{
+    if_null (forward)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    EM *const em = forward->event_machine;
+    const int source_fd = forward->source->fd;
+    const int sink_fd = forward->sink->fd;
+    bool sink_blocked = false;
+
+    for (;;)
+    {
+        /* Pipe is always drained before source is read again, so that the
+         * whole pipe is available for the next read.
+         */
+        while (forward->buffered > 0)
+        {
+            EM_METRICS_INC(em, io_write_calls);
+            const ssize_t n = splice(forward->pipe[0], NULL, sink_fd, NULL,
+                forward->buffered, SPLICE_FLAGS);
+
+            if_negative (n)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    return fail(forward);
+                }
+                sink_blocked = true;
+                break;
+            }
+            forward->buffered -= (size_t)n;
+            forward->transferred += (uint64_t)n;
+        }
+        if (sink_blocked || forward->source_eof)
+        {
+            break;
+        }
+
+        EM_METRICS_INC(em, io_read_calls);
+        const ssize_t n = splice(source_fd, NULL, forward->pipe[1], NULL,
+            forward->pipe_size, SPLICE_FLAGS);
+
+        if_zero (n)
+        {
+            forward->source_eof = true;
+            break;
+        }
+        if_negative (n)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return fail(forward);
+            }
+            break;
+        }
+        forward->buffered += (size_t)n;
+    }
+
+    /* Source isn't read while sink is blocked, which propagates
+     * backpressure to the peer of source.
+     */
+    ret_em_failure(set_event(em, forward->source, &(forward->reading),
+        EVENT_READ, not(forward->source_eof) && not(sink_blocked)));
+    ret_em_failure(set_event(em, forward->sink, &(forward->writing),
+        EVENT_WRITE, forward->buffered > 0));
+
+    if (forward->source_eof && forward->buffered == 0
+        && not(forward->eof_reported))
+    {
+        forward->eof_reported = true;
+        if_not_null (forward->handler)
+        {
+            forward->handler(em, forward, EM_SPLICE_EOF, forward->data);
+        }
+    }
+
+    return EM_SUCCESS;
+}
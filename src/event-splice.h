@@ -0,0 +1,242 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-splice.h
+ * Forwarding of data from one file descriptor to another using
+ * <tt>splice()</tt>.
+ *
+ * Data are moved from source to sink through a kernel pipe, therefore they
+ * never pass through user space buffers. At least one of the file
+ * descriptors has to be a socket or a pipe, both of them have to be
+ * nonblocking and registered in event machine.
+ *
+ * Forwarding is driven by event_splice_pump(), which has to be called by
+ * event handler of source when it's readable and by event handler of sink
+ * when it's writable. While data in the pipe can't be written to sink,
+ * <tt>EVENT_READ</tt> is removed from events of source, so that source
+ * isn't read until sink catches up, and <tt>EVENT_WRITE</tt> is added to
+ * events of sink. Both are reverted when the pipe is drained. Only the bits
+ * of <tt>events</tt> that belong to the direction are changed, therefore the
+ * same file descriptor can be source of one #EM_splice and sink of another,
+ * e.g. in a TCP proxy.
+ *
+ * Available only on Linux with <tt>epoll</tt> or <tt>io_uring</tt> backend.
+ *
+ * Usage example can be found here: @link example/tcp-proxy.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_SPLICE_H_110395786287351742358436712981207513469
+#define EVENT_SPLICE_H_110395786287351742358436712981207513469
+
+#include "event-machine.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Requested size of the pipe if zero is passed to event_splice_init().
+ * Unprivileged processes are limited by <tt>/proc/sys/fs/pipe-max-size</tt>,
+ * which is 1 MiB by default.
+ */
+#define EM_SPLICE_DEFAULT_PIPE_SIZE     (1024 * 1024)
+
+struct EM_splice_s;     /* Forward declaration */
+
+/** Events reported to #EM_splice_handler.
+ */
+typedef enum
+{
+    /** Source reached end of file and all data were written to sink. Usual
+     * reaction is <tt>shutdown(sink, SHUT_WR)</tt>.
+     */
+    EM_SPLICE_EOF = 1,
+
+    /** Reading from source or writing to sink failed. Value of
+     * <tt>error</tt> field of #EM_splice is <tt>errno</tt> of failed
+     * <tt>splice()</tt>.
+     */
+    EM_SPLICE_ERROR = 2
+} EM_splice_event;
+
+/** Type of callbacks that receive #EM_splice_event. Callback may call
+ * event_splice_destroy().
+ *
+ * @param[in] event_machine
+ *   Event machine passed to event_splice_init().
+ *
+ * @param[in] splice
+ *   Forwarding that reported the event.
+ *
+ * @param[in] event
+ *   What happened.
+ *
+ * @param[in] data
+ *   Pointer passed to event_splice_init().
+ */
+typedef void (*EM_splice_handler)(EM *event_machine,
+    struct EM_splice_s *splice, EM_splice_event event, void *data);
+
+/** Forwarding from source to sink. Its fields are private, use functions
+ * declared below.
+ */
+typedef struct EM_splice_s
+{
+    EM *event_machine;
+
+    /** Event descriptors of source and sink.
+     */
+    EM_event_descriptor *source;
+    EM_event_descriptor *sink;
+
+    /** Read and write end of the intermediate pipe.
+     */
+    int pipe[2];
+
+    /** Capacity of the pipe in bytes.
+     */
+    size_t pipe_size;
+
+    /** Number of bytes in the pipe that weren't written to sink, yet.
+     */
+    size_t buffered;
+
+    /** Number of bytes written to sink.
+     */
+    uint64_t transferred;
+
+    /** Callback for #EM_splice_event or <tt>NULL</tt>.
+     */
+    EM_splice_handler handler;
+    void *data;
+
+    /** Value of <tt>errno</tt> of failed <tt>splice()</tt>, or 0.
+     */
+    int error;
+
+    /** True after source reached end of file.
+     */
+    bool source_eof;
+
+    /** True after #EM_SPLICE_EOF was reported.
+     */
+    bool eof_reported;
+
+    /** True while <tt>EVENT_READ</tt> is in events of source.
+     */
+    bool reading;
+
+    /** True while <tt>EVENT_WRITE</tt> is in events of sink.
+     */
+    bool writing;
+} EM_splice;
+
+/** Create the pipe and initialize forwarding.
+ *
+ * @param[out] splice
+ *   Forwarding to initialize.
+ *
+ * @param[in] event_machine
+ *   Event machine in which source and sink are registered.
+ *
+ * @param[in] source
+ *   Event descriptor of file descriptor data are read from. It should be
+ *   registered with <tt>EVENT_READ</tt>.
+ *
+ * @param[in] sink
+ *   Event descriptor of file descriptor data are written to. It may be the
+ *   same as <tt>source</tt>.
+ *
+ * @param[in] pipe_size
+ *   Requested capacity of the pipe, i.e. how much data are read from source
+ *   at once, or 0 for #EM_SPLICE_DEFAULT_PIPE_SIZE. If it can't be set, then
+ *   pipe keeps its default size.
+ *
+ * @param[in] handler
+ *   Callback that receives #EM_splice_event, or <tt>NULL</tt>.
+ *
+ * @param[in] data
+ *   Pointer passed to <tt>handler</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_PIPE if pipe couldn't be created.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_splice_init(EM_splice *splice, EM *event_machine,
+    EM_event_descriptor *source, EM_event_descriptor *sink, size_t pipe_size,
+    EM_splice_handler handler, void *data);
+
+/** Close the pipe, data that weren't written to sink are lost. Registration
+ * of source and sink isn't changed.
+ *
+ * @param[in] splice
+ *   Forwarding initialized by event_splice_init().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_splice_destroy(EM_splice *splice);
+
+/** Move as much data from source to sink as possible without blocking.
+ *
+ * @param[in] splice
+ *   Forwarding initialized by event_splice_init().
+ *
+ * @return
+ *   Returns #EM_ERROR_SPLICE if <tt>splice()</tt> failed. In such case
+ *   #EM_SPLICE_ERROR was already reported and forwarding may have been
+ *   destroyed by the callback.
+ *
+ * @return
+ *   Errors of event_machine_modify() when events couldn't be changed.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt>. If #EM_SPLICE_EOF was
+ *   reported, then forwarding may have been destroyed by the callback.
+ */
+uint32_t event_splice_pump(EM_splice *splice);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_SPLICE_H_110395786287351742358436712981207513469 */
@@ -0,0 +1,553 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event-storage.h"
+#include "event-machine/result-internal.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Smallest number of entries allocated by array and hash storage. */
+#define MIN_CAPACITY        64
+
+/* Radix table leaf covers 2^RADIX_LEAF_BITS consecutive file descriptors. */
+#define RADIX_LEAF_BITS     8
+#define RADIX_LEAF_SIZE     (1 << RADIX_LEAF_BITS)
+#define RADIX_LEAF_MASK     (RADIX_LEAF_SIZE - 1)
+
+/* Hash table is grown when it's more than 70% full. */
+#define HASH_OVERLOADED(count, capacity)    ((count) * 10 > (capacity) * 7)
+
+/* All storages start with their type, so that it can be found out from
+ * private data of EM_descriptor_storage.
+ */
+typedef struct
+{
+    EM_storage_type type;
+    EM_event_descriptor **entries;
+    size_t capacity;
+} array_storage;
+
+typedef struct
+{
+    uint32_t count;
+    EM_event_descriptor *entries[RADIX_LEAF_SIZE];
+} radix_leaf;
+
+typedef struct
+{
+    EM_storage_type type;
+    radix_leaf **leaves;
+    size_t capacity;
+    size_t num_leaves;
+} radix_storage;
+
+/* Entry with NULL event descriptor is empty. */
+typedef struct
+{
+    int fd;
+    EM_event_descriptor *ed;
+} hash_entry;
+
+typedef struct
+{
+    EM_storage_type type;
+    hash_entry *entries;
+    size_t capacity;
+    size_t count;
+
+    /* 32 - log2(capacity) */
+    unsigned int shift;
+} hash_storage;
+
+
+/* Smallest power of two that is at least MIN_CAPACITY and greater than
+ * index.
+ */
+static inline size_t capacity_for(const size_t index)
+{
+    size_t capacity = MIN_CAPACITY;
+
+    while (capacity <= index)
+    {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+/* Resize array of pointers and fill new entries with NULL. */
+static int grow_pointers(void ***const array, size_t *const capacity,
+    const size_t new_capacity)
+{
+    void **const tmp = realloc(*array, new_capacity * sizeof(void *));
+
+    if_null (tmp)
+    {
+        return -1;
+    }
+
+    for (size_t i = *capacity; i < new_capacity; i++)
+    {
+        tmp[i] = NULL;
+    }
+    (*array) = tmp;
+    (*capacity) = new_capacity;
+
+    return 0;
+}
+
+/* {{{ Dense array ########################################################## */
+
+static uint32_t array_insert(void *const data, const int fd,
+    EM_event_descriptor *const ed)
+{
+    array_storage *const storage = data;
+    const size_t index = (size_t)fd;
+
+    if (index >= storage->capacity
+        && is_negative(grow_pointers((void ***)&(storage->entries),
+            &(storage->capacity), capacity_for(index))))
+    {
+        return EM_ERROR_MALLOC;
+    }
+    if_not_null (storage->entries[index])
+    {
+        return EM_ERROR_STORAGE_DUPLICATE_ENTRY;
+    }
+
+    storage->entries[index] = ed;
+
+    return EM_SUCCESS;
+}
+
+static uint32_t array_remove(void *const data, const int fd,
+    EM_event_descriptor **const ed)
+{
+    array_storage *const storage = data;
+    const size_t index = (size_t)fd;
+
+    if (index >= storage->capacity || null(storage->entries[index]))
+    {
+        return EM_ERROR_STORAGE_NO_SUCH_ENTRY;
+    }
+
+    (*ed) = storage->entries[index];
+    storage->entries[index] = NULL;
+
+    return EM_SUCCESS;
+}
+
+static EM_event_descriptor *array_lookup(void *const data, const int fd)
+{
+    const array_storage *const storage = data;
+    const size_t index = (size_t)fd;
+
+    return index < storage->capacity ? storage->entries[index] : NULL;
+}
+
+static size_t array_memory_usage(const array_storage *const storage)
+{
+    return sizeof(array_storage)
+        + storage->capacity * sizeof(EM_event_descriptor *);
+}
+
+static void array_free(array_storage *const storage)
+{
+    free(storage->entries);
+}
+
+/* }}} Dense array ########################################################## */
+
+/* {{{ Radix table ########################################################## */
+
+static uint32_t radix_insert(void *const data, const int fd,
+    EM_event_descriptor *const ed)
+{
+    radix_storage *const storage = data;
+    const size_t index = (size_t)fd >> RADIX_LEAF_BITS;
+    radix_leaf *leaf = NULL;
+
+    if (index >= storage->capacity
+        && is_negative(grow_pointers((void ***)&(storage->leaves),
+            &(storage->capacity), capacity_for(index))))
+    {
+        return EM_ERROR_MALLOC;
+    }
+
+    leaf = storage->leaves[index];
+    if_null (leaf)
+    {
+        leaf = calloc(1, sizeof(radix_leaf));
+        if_null (leaf)
+        {
+            return EM_ERROR_MALLOC;
+        }
+        storage->leaves[index] = leaf;
+        storage->num_leaves++;
+    }
+    if_not_null (leaf->entries[fd & RADIX_LEAF_MASK])
+    {
+        return EM_ERROR_STORAGE_DUPLICATE_ENTRY;
+    }
+
+    leaf->entries[fd & RADIX_LEAF_MASK] = ed;
+    leaf->count++;
+
+    return EM_SUCCESS;
+}
+
+static uint32_t radix_remove(void *const data, const int fd,
+    EM_event_descriptor **const ed)
+{
+    radix_storage *const storage = data;
+    const size_t index = (size_t)fd >> RADIX_LEAF_BITS;
+    radix_leaf *leaf = NULL;
+
+    if (index >= storage->capacity
+        || null(leaf = storage->leaves[index])
+        || null(leaf->entries[fd & RADIX_LEAF_MASK]))
+    {
+        return EM_ERROR_STORAGE_NO_SUCH_ENTRY;
+    }
+
+    (*ed) = leaf->entries[fd & RADIX_LEAF_MASK];
+    leaf->entries[fd & RADIX_LEAF_MASK] = NULL;
+
+    /* Empty leaves are freed so that memory usage follows number of ranges
+     * of file descriptors that are in use.
+     */
+    if (--(leaf->count) == 0)
+    {
+        free(leaf);
+        storage->leaves[index] = NULL;
+        storage->num_leaves--;
+    }
+
+    return EM_SUCCESS;
+}
+
+static EM_event_descriptor *radix_lookup(void *const data, const int fd)
+{
+    const radix_storage *const storage = data;
+    const size_t index = (size_t)fd >> RADIX_LEAF_BITS;
+
+    if (index >= storage->capacity || null(storage->leaves[index]))
+    {
+        return NULL;
+    }
+
+    return storage->leaves[index]->entries[fd & RADIX_LEAF_MASK];
+}
+
+static size_t radix_memory_usage(const radix_storage *const storage)
+{
+    return sizeof(radix_storage)
+        + storage->capacity * sizeof(radix_leaf *)
+        + storage->num_leaves * sizeof(radix_leaf);
+}
+
+static void radix_free(radix_storage *const storage)
+{
+    for (size_t i = 0; i < storage->capacity; i++)
+    {
+        free(storage->leaves[i]);
+    }
+    free(storage->leaves);
+}
+
+/* }}} Radix table ########################################################## */
+
+/* {{{ Hash table ########################################################### */
+
+/* Fibonacci hashing, i.e. top bits of fd multiplied by 2^32 divided by golden
+ * ratio. Capacity is always a power of two.
+ */
+static inline size_t hash_slot(const hash_storage *const storage,
+    const int fd)
+{
+    return ((uint32_t)fd * UINT32_C(2654435769)) >> storage->shift;
+}
+
+/* Index of entry for fd, or of empty slot where it should be inserted. */
+static inline size_t hash_find(const hash_storage *const storage,
+    const int fd)
+{
+    const size_t mask = storage->capacity - 1;
+    size_t i = hash_slot(storage, fd);
+
+    while (not_null(storage->entries[i].ed) && storage->entries[i].fd != fd)
+    {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+static int hash_resize(hash_storage *const storage, const size_t new_capacity)
+{
+    hash_entry *const old_entries = storage->entries;
+    const size_t old_capacity = storage->capacity;
+    unsigned int shift = 32;
+
+    storage->entries = calloc(new_capacity, sizeof(hash_entry));
+    if_null (storage->entries)
+    {
+        storage->entries = old_entries;
+
+        return -1;
+    }
+    for (size_t capacity = 1; capacity < new_capacity; capacity *= 2)
+    {
+        shift--;
+    }
+    storage->capacity = new_capacity;
+    storage->shift = shift;
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if_not_null (old_entries[i].ed)
+        {
+            storage->entries[hash_find(storage, old_entries[i].fd)] =
+                old_entries[i];
+        }
+    }
+    free(old_entries);
+
+    return 0;
+}
+
+static uint32_t hash_insert(void *const data, const int fd,
+    EM_event_descriptor *const ed)
+{
+    hash_storage *const storage = data;
+    size_t i = 0;
+
+    if (HASH_OVERLOADED(storage->count + 1, storage->capacity)
+        && is_negative(hash_resize(storage, storage->capacity * 2)))
+    {
+        return EM_ERROR_MALLOC;
+    }
+
+    i = hash_find(storage, fd);
+    if_not_null (storage->entries[i].ed)
+    {
+        return EM_ERROR_STORAGE_DUPLICATE_ENTRY;
+    }
+
+    storage->entries[i].fd = fd;
+    storage->entries[i].ed = ed;
+    storage->count++;
+
+    return EM_SUCCESS;
+}
+
+static uint32_t hash_remove(void *const data, const int fd,
+    EM_event_descriptor **const ed)
+{
+    hash_storage *const storage = data;
+    const size_t mask = storage->capacity - 1;
+    size_t i = hash_find(storage, fd);
+
+    if_null (storage->entries[i].ed)
+    {
+        return EM_ERROR_STORAGE_NO_SUCH_ENTRY;
+    }
+
+    (*ed) = storage->entries[i].ed;
+    storage->count--;
+
+    /* Backward shift deletion, i.e. entries following removed one are moved
+     * closer to their home slot, so that no tombstones are needed.
+     */
+    for (size_t j = (i + 1) & mask; not_null(storage->entries[j].ed);
+        j = (j + 1) & mask)
+    {
+        const size_t home = hash_slot(storage, storage->entries[j].fd);
+
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            storage->entries[i] = storage->entries[j];
+            i = j;
+        }
+    }
+    storage->entries[i].ed = NULL;
+
+    return EM_SUCCESS;
+}
+
+static EM_event_descriptor *hash_lookup(void *const data, const int fd)
+{
+    const hash_storage *const storage = data;
+
+    return storage->entries[hash_find(storage, fd)].ed;
+}
+
+static size_t hash_memory_usage(const hash_storage *const storage)
+{
+    return sizeof(hash_storage) + storage->capacity * sizeof(hash_entry);
+}
+
+static void hash_free(hash_storage *const storage)
+{
+    free(storage->entries);
+}
+
+/* }}} Hash table ########################################################### */
+
+uint32_t event_storage_init(EM_descriptor_storage *const storage,
+    const EM_storage_type type)
+{
+    size_t data_size = 0;
+
+    if_null (storage)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    switch (type)
+    {
+        case EM_STORAGE_ARRAY:
+            data_size = sizeof(array_storage);
+            storage->insert = array_insert;
+            storage->remove = array_remove;
+            storage->lookup = array_lookup;
+            break;
+
+        case EM_STORAGE_RADIX:
+            data_size = sizeof(radix_storage);
+            storage->insert = radix_insert;
+            storage->remove = radix_remove;
+            storage->lookup = radix_lookup;
+            break;
+
+        case EM_STORAGE_HASH:
+            data_size = sizeof(hash_storage);
+            storage->insert = hash_insert;
+            storage->remove = hash_remove;
+            storage->lookup = hash_lookup;
+            break;
+
+        default:
+            return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    storage->data = calloc(1, data_size);
+    if_null (storage->data)
+    {
+        storage->insert = NULL;
+        storage->remove = NULL;
+        storage->lookup = NULL;
+
+        return EM_ERROR_MALLOC;
+    }
+    storage->data_size = data_size;
+    (*(EM_storage_type *)storage->data) = type;
+
+    /* Hash table is never empty, that way lookup doesn't have to check for
+     * it.
+     */
+    if (type == EM_STORAGE_HASH
+        && is_negative(hash_resize(storage->data, MIN_CAPACITY)))
+    {
+        free(storage->data);
+        storage->data = NULL;
+        storage->data_size = 0;
+        storage->insert = NULL;
+        storage->remove = NULL;
+        storage->lookup = NULL;
+
+        return EM_ERROR_MALLOC;
+    }
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_storage_destroy(EM_descriptor_storage *const storage)
+{
+    if_null (storage)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (storage->data)
+    {
+        return EM_SUCCESS;
+    }
+
+    switch (*(EM_storage_type *)storage->data)
+    {
+        case EM_STORAGE_ARRAY:
+            array_free(storage->data);
+            break;
+
+        case EM_STORAGE_RADIX:
+            radix_free(storage->data);
+            break;
+
+        case EM_STORAGE_HASH:
+            hash_free(storage->data);
+            break;
+    }
+
+    free(storage->data);
+    storage->data = NULL;
+    storage->data_size = 0;
+    storage->insert = NULL;
+    storage->remove = NULL;
+    storage->lookup = NULL;
+
+    return EM_SUCCESS;
+}
+
+size_t event_storage_memory_usage(const EM_descriptor_storage *const storage)
+{
+    if (null(storage) || null(storage->data))
+    {
+        return 0;
+    }
+
+    switch (*(const EM_storage_type *)storage->data)
+    {
+        case EM_STORAGE_ARRAY:
+            return array_memory_usage(storage->data);
+
+        case EM_STORAGE_RADIX:
+            return radix_memory_usage(storage->data);
+
+        case EM_STORAGE_HASH:
+            return hash_memory_usage(storage->data);
+    }
+
+    return 0;
+}
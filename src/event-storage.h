@@ -0,0 +1,160 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-storage.h
+ * Descriptor storages, i.e. implementations of #EM_descriptor_storage
+ * callbacks, shipped with the library.
+ *
+ * All of them provide O(1) insert, remove and lookup, they differ in how much
+ * memory they need for a given set of file descriptors:
+ *
+ * - #EM_STORAGE_ARRAY is one array indexed by file descriptor. Fastest, but
+ *   its size is given by the highest file descriptor ever stored.
+ *
+ * - #EM_STORAGE_RADIX is two-level table that allocates blocks of entries
+ *   only for ranges of file descriptors that are in use, and frees them
+ *   when they become empty. Suitable for processes with millions of file
+ *   descriptors.
+ *
+ * - #EM_STORAGE_HASH is open addressing hash table. Its size is given by
+ *   number of stored entries, which makes it suitable for very sparse sets
+ *   of file descriptors.
+ *
+ * Usage example:
+ *
+ * @code{.c}
+ * EM em = EM_STATIC_DEFAULT;
+ *
+ * if_em_failure (event_storage_init(&em.descriptor_storage, EM_STORAGE_ARRAY))
+ * {
+ *     // Error handling.
+ * }
+ * if_em_failure (event_machine_init(&em))
+ * {
+ *     // Error handling.
+ * }
+ * // ...
+ * event_machine_destroy(&em);
+ * event_storage_destroy(&em.descriptor_storage);
+ * @endcode
+ *
+ * Storage can be used by only one event machine at a time and its functions
+ * aren't thread safe.
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_STORAGE_H_178322094761128339503462155802113659981
+#define EVENT_STORAGE_H_178322094761128339503462155802113659981
+
+#include "event-machine.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Descriptor storage implementation.
+ */
+typedef enum
+{
+    /** Dense array indexed by file descriptor that grows on demand.
+     */
+    EM_STORAGE_ARRAY = 0,
+
+    /** Two-level sparse radix table indexed by file descriptor.
+     */
+    EM_STORAGE_RADIX = 1,
+
+    /** Open addressing hash table with linear probing.
+     */
+    EM_STORAGE_HASH = 2
+} EM_storage_type;
+
+/** Initialize descriptor storage of given type.
+ *
+ * Callbacks and private data of <tt>storage</tt> are overwritten. Do it
+ * before first file descriptor is registered in event machine that uses
+ * it.
+ *
+ * @param[out] storage
+ *   Descriptor storage, usually <tt>descriptor_storage</tt> field of #EM.
+ *
+ * @param[in] type
+ *   Which implementation to use.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if <tt>type</tt> is unknown.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if memory allocation failed.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_storage_init(EM_descriptor_storage *storage,
+    EM_storage_type type);
+
+/** Free all memory used by descriptor storage initialized by
+ * event_storage_init().
+ *
+ * Event descriptors that are still stored aren't freed, they are owned by
+ * the caller.
+ *
+ * @param[in] storage
+ *   Descriptor storage initialized by event_storage_init().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_storage_destroy(EM_descriptor_storage *storage);
+
+/** Number of bytes currently allocated by descriptor storage initialized by
+ * event_storage_init().
+ *
+ * @param[in] storage
+ *   Descriptor storage initialized by event_storage_init().
+ *
+ * @return
+ *   Number of allocated bytes, or 0 if <tt>storage</tt> wasn't initialized.
+ */
+size_t event_storage_memory_usage(const EM_descriptor_storage *storage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_STORAGE_H_178322094761128339503462155802113659981 */
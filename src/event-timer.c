@@ -36,12 +36,16 @@
 #endif
 
 #include "event-timer.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/probes-internal.h"
 #include "event-machine/result-internal.h"
+#include "event-machine/wheel-internal.h"
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 
 #define CAST_TIMER(data)        ((Event_timer*)data)
@@ -54,6 +58,7 @@
 #define TIMER_ED(timer)         (timer->event_descriptor)
 #define TIMER_DATA(timer)       (timer->data)
 #define TIMER_CALLBACK(timer)   (timer->callback)
+#define TIMER_WHEEL(timer)      (timer->wheel)
 
 
 static void internal_timeout_handler(EM *const em, const uint32_t events,
@@ -64,6 +69,7 @@ static void internal_timeout_handler(EM *const em, const uint32_t events,
     assert(em != NULL);
     assert(valid_fd(fd));
 
+    EM_METRICS_INC(em, read_calls);
     ssize_t readed = read(fd, &number_of_timeouts, sizeof(uint64_t));
     if (readed != sizeof(uint64_t) && errno == EAGAIN)
     {
@@ -74,10 +80,21 @@ static void internal_timeout_handler(EM *const em, const uint32_t events,
     }
     assert(readed == sizeof(uint64_t));
 
-    for(; number_of_timeouts > 0; number_of_timeouts--)
+    Event_timer *timer = CAST_TIMER(data);
+
+    EM_TRACE_TIMER_EXPIRE(em, timer, number_of_timeouts);
+
+    if (timer->overrun_policy == EM_TIMER_OVERRUN_ONCE)
     {
-        Event_timer *timer = CAST_TIMER(data);
+        timer->overruns = number_of_timeouts;
+        TIMER_CALLBACK(timer)(timer, TIMER_DATA(timer));
 
+        return;
+    }
+
+    timer->overruns = 1;
+    for(; number_of_timeouts > 0; number_of_timeouts--)
+    {
         TIMER_CALLBACK(timer)(timer, TIMER_DATA(timer));
     }
 }
@@ -110,6 +127,7 @@ uint32_t event_timer_create(EM *const event_machine, Event_timer *const timer,
         return EM_ERROR_CALLBACK_NULL;
     }
 
+    shred(timer);
     TIMER_EM(timer) = event_machine;
     TIMER_DATA(timer) = data;
     TIMER_CALLBACK(timer) = callback;
@@ -155,27 +173,89 @@ uint32_t event_timer_create(EM *const event_machine, Event_timer *const timer,
     return ret;
 }
 
-uint32_t event_timer_start(Event_timer *const timer, const int32_t msec,
-    const bool is_one_shot)
+static inline bool invalid_timespec(const struct timespec *const ts)
+{
+    return ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000;
+}
+
+static inline uint64_t timespec_to_nsec(const struct timespec *const ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000 + (uint64_t)ts->tv_nsec;
+}
+
+static inline struct timespec nsec_to_timespec(const uint64_t nsec)
+{
+    const struct timespec ts =
+    {
+        .tv_sec = (time_t)(nsec / 1000000000),
+        .tv_nsec = (long)(nsec % 1000000000)
+    };
+
+    return ts;
+}
+
+uint32_t event_timer_start_timespec(Event_timer *const timer,
+    const struct timespec *const value, const struct timespec *const interval,
+    const bool is_absolute)
 {
+    struct timespec now;
+    uint64_t deadline;
+
     if_null (timer)
     {
         return EM_ERROR_TIMER_NULL;
     }
+    if_null (value)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+    if (invalid_timespec(value)
+        || (not_null(interval) && invalid_timespec(interval)))
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    timer->interval_nsec = null(interval) ? 0 : timespec_to_nsec(interval);
 
-    struct timespec expiration_time =
+    /* Relative expiration is converted in to absolute one, that way value
+     * zero doesn't disarm timerfd and it's the same for timing wheel.
+     */
+    deadline = timespec_to_nsec(value);
+    if (not(is_absolute))
     {
-        .tv_sec = msec / 1000,
-        .tv_nsec = (msec % 1000) * 1000
-    };
-    struct timespec expiration_time_zero = {0, 0};
-    struct itimerspec expiration =
+        if_negative (clock_gettime(CLOCK_MONOTONIC, &now))
+        {
+            return EM_ERROR_TIMERFD_SETTIME;
+        }
+        deadline += timespec_to_nsec(&now);
+    }
+    if (deadline == 0)
+    {
+        deadline = 1;
+    }
+
+    if_not_null (TIMER_WHEEL(timer))
+    {
+        return em_wheel_timer_start(timer, deadline);
+    }
+
+    /* First expiration is aligned to multiple of slack on absolute time
+     * scale, so that timers with the same slack fire together.
+     */
+    if_not_zero (timer->slack_nsec)
+    {
+        deadline = (deadline + timer->slack_nsec - 1)
+            / timer->slack_nsec * timer->slack_nsec;
+    }
+
+    const struct itimerspec expiration =
     {
-        .it_interval = is_one_shot ? expiration_time_zero : expiration_time,
-        .it_value = expiration_time
+        .it_interval = nsec_to_timespec(timer->interval_nsec),
+        .it_value = nsec_to_timespec(deadline)
     };
 
-    if_negative (timerfd_settime(TIMER_FD(timer), 0, &expiration, NULL))
+    if_negative (timerfd_settime(TIMER_FD(timer), TFD_TIMER_ABSTIME,
+        &expiration, NULL))
     {
         return EM_ERROR_TIMERFD_SETTIME;
     }
@@ -183,6 +263,48 @@ uint32_t event_timer_start(Event_timer *const timer, const int32_t msec,
     return EM_SUCCESS;
 }
 
+uint32_t event_timer_start(Event_timer *const timer, const int32_t msec,
+    const bool is_one_shot)
+{
+    const struct timespec expiration_time =
+    {
+        .tv_sec = msec < 0 ? 0 : msec / 1000,
+        .tv_nsec = msec < 0 ? 0 : (msec % 1000) * 1000000
+    };
+
+    return event_timer_start_timespec(timer, &expiration_time,
+        is_one_shot ? NULL : &expiration_time, false);
+}
+
+uint32_t event_timer_set_overrun_policy(Event_timer *const timer,
+    const Event_timer_overrun_policy policy)
+{
+    if_null (timer)
+    {
+        return EM_ERROR_TIMER_NULL;
+    }
+    if (policy != EM_TIMER_OVERRUN_REPEAT && policy != EM_TIMER_OVERRUN_ONCE)
+    {
+        return EM_ERROR_VALUE_OUT_OF_BOUNDS;
+    }
+
+    timer->overrun_policy = policy;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_timer_set_slack(Event_timer *const timer, const uint32_t msec)
+{
+    if_null (timer)
+    {
+        return EM_ERROR_TIMER_NULL;
+    }
+
+    timer->slack_nsec = (uint64_t)msec * 1000000;
+
+    return EM_SUCCESS;
+}
+
 uint32_t event_timer_stop(Event_timer *const timer)
 {
     struct itimerspec expiration = {{0, 0}, {0, 0}};
@@ -192,6 +314,13 @@ uint32_t event_timer_stop(Event_timer *const timer)
         return EM_ERROR_TIMER_NULL;
     }
 
+    if_not_null (TIMER_WHEEL(timer))
+    {
+        em_wheel_timer_stop(timer);
+
+        return EM_SUCCESS;
+    }
+
     if_negative (timerfd_settime(TIMER_FD(timer), 0, &expiration, NULL))
     {
         return EM_ERROR_TIMERFD_SETTIME;
@@ -207,6 +336,16 @@ uint32_t event_timer_destroy(Event_timer *const timer)
         return EM_ERROR_TIMER_NULL;
     }
 
+    /* Timer driven by timing wheel doesn't have its own timerfd.
+     */
+    if_not_null (TIMER_WHEEL(timer))
+    {
+        em_wheel_timer_stop(timer);
+        shred(timer);
+
+        return EM_SUCCESS;
+    }
+
     /* Last argument to event_machine_delete() is NULL since Event_descriptor
      * is part of Event_timer data structure it doesn't make sense to request
      * pointer to it.
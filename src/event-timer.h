@@ -51,12 +51,14 @@
 #define EVENT_TIMER_H_37644463622302162596821921420243050348
 
 #include "event-machine.h"
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct Event_timer_s;   /* Forward declaration */
+struct EM_wheel_s;      /* Forward declaration, see event-wheel.h */
 
 /** Type of callbacks triggered by timer expiration.
  *
@@ -70,6 +72,23 @@ struct Event_timer_s;   /* Forward declaration */
  */
 typedef void (*Event_timer_handler)(struct Event_timer_s *timer, void *data);
 
+/** What to do when periodic timer expired more than once before its callback
+ * could be invoked, e.g. because event machine was busy.
+ *
+ * @see event_timer_set_overrun_policy()
+ */
+typedef enum
+{
+    /** Invoke callback once for each expiration.
+     */
+    EM_TIMER_OVERRUN_REPEAT = 0,
+
+    /** Invoke callback only once and store number of expirations in
+     * <tt>overruns</tt> field of #Event_timer.
+     */
+    EM_TIMER_OVERRUN_ONCE = 1
+} Event_timer_overrun_policy;
+
 /** Structure that describes event timer.
  *
  * This structure behaves as timer handle and it has to be first initialized
@@ -100,6 +119,57 @@ typedef struct Event_timer_s
     /** Callback which is invoked when timer fires.
      */
     Event_timer_handler callback;
+
+    /** How expirations missed by callback are handled.
+     *
+     * @default EM_TIMER_OVERRUN_REPEAT
+     *
+     * @see event_timer_set_overrun_policy()
+     */
+    Event_timer_overrun_policy overrun_policy;
+
+    /** Number of expirations handled by current callback invocation. It's
+     * always 1 unless <tt>overrun_policy</tt> is #EM_TIMER_OVERRUN_ONCE.
+     */
+    uint64_t overruns;
+
+    /** Period of timer in nanoseconds, or 0 for one shot timer.
+     */
+    uint64_t interval_nsec;
+
+    /** Timing wheel that drives this timer or <tt>NULL</tt> if timer has its
+     * own <tt>timerfd</tt>.
+     *
+     * @see event_wheel_timer_create()
+     */
+    struct EM_wheel_s *wheel;
+
+    /** Next timer in the same timing wheel slot. Used only if
+     * <tt>wheel</tt> isn't <tt>NULL</tt>.
+     */
+    struct Event_timer_s *wheel_next;
+
+    /** Pointer to the pointer that points to this timer, or <tt>NULL</tt> if
+     * timer isn't running. Used only if <tt>wheel</tt> isn't <tt>NULL</tt>.
+     */
+    struct Event_timer_s **wheel_pprev;
+
+    /** How much later than requested timer may fire, in nanoseconds, so that
+     * its expiration can be coalesced with other timers.
+     *
+     * @see event_timer_set_slack()
+     */
+    uint64_t slack_nsec;
+
+    /** Next expiration of timer driven by timing wheel as absolute
+     * <tt>CLOCK_MONOTONIC</tt> time in nanoseconds.
+     */
+    uint64_t wheel_deadline;
+
+    /** Tick of timing wheel in which timer expires, before it's adjusted by
+     * slack.
+     */
+    uint64_t wheel_expires;
 } Event_timer;
 
 /** Create and register event timer in event machine.
@@ -182,6 +252,126 @@ uint32_t event_timer_create(EM *event_machine, Event_timer *timer,
 uint32_t event_timer_start(Event_timer *timer, int32_t msec,
     const bool is_one_shot);
 
+/** Start timer with nanosecond precision.
+ *
+ * Unlike event_timer_start() expiration can be specified as an absolute
+ * <tt>CLOCK_MONOTONIC</tt> time. Periodic timers are scheduled from their
+ * previous deadline and not from time when callback was invoked, therefore
+ * their schedule doesn't drift.
+ *
+ * Usage example:
+ *
+ * @code{.c}
+ * struct timespec deadline;
+ * const struct timespec period = {.tv_sec = 0, .tv_nsec = 250000};
+ *
+ * clock_gettime(CLOCK_MONOTONIC, &deadline);
+ * deadline.tv_sec++;
+ *
+ * // Fire each 250 microseconds starting one second from now.
+ * if_em_failure (event_timer_start_timespec(timer, &deadline, &period, true))
+ * {
+ *     // Error handling.
+ * }
+ * @endcode
+ *
+ * @param[in] timer
+ *   Event timer to start. This value has to be initialized by
+ *   event_timer_create() or event_wheel_timer_create(). If
+ *   <tt>timer = NULL</tt> then this function will return
+ *   #EM_ERROR_TIMER_NULL.
+ *
+ * @param[in] value
+ *   First expiration of the timer, either relative to current time or, if
+ *   <tt>is_absolute</tt> is true, as absolute <tt>CLOCK_MONOTONIC</tt> time.
+ *   Deadlines that already passed expire immediately.
+ *
+ * @param[in] interval
+ *   Period of timer. If it is <tt>NULL</tt> or zero, then timer is one shot.
+ *
+ * @param[in] is_absolute
+ *   Indicates that <tt>value</tt> is absolute time.
+ *
+ * @return
+ *   Returns #EM_ERROR_TIMER_NULL when timer passed to function is
+ *   <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_BUFFER_NULL when <tt>value</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if <tt>value</tt> or
+ *   <tt>interval</tt> is negative or its <tt>tv_nsec</tt> isn't less than
+ *   one second.
+ *
+ * @return
+ *   Returns #EM_ERROR_TIMERFD_SETTIME if timerfd_settime() fails. Read value
+ *   of <tt>errno</tt> for details.
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_timer_start_timespec(Event_timer *timer,
+    const struct timespec *value, const struct timespec *interval,
+    bool is_absolute);
+
+/** Set how expirations of periodic timer that were missed by its callback
+ * are handled.
+ *
+ * @param[in] timer
+ *   Event timer initialized by event_timer_create() or
+ *   event_wheel_timer_create(). If <tt>timer = NULL</tt> then this function
+ *   will return #EM_ERROR_TIMER_NULL.
+ *
+ * @param[in] policy
+ *   Either #EM_TIMER_OVERRUN_REPEAT or #EM_TIMER_OVERRUN_ONCE.
+ *
+ * @return
+ *   Returns #EM_ERROR_TIMER_NULL when timer passed to function is
+ *   <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_VALUE_OUT_OF_BOUNDS if <tt>policy</tt> isn't one of the
+ *   above values.
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_timer_set_overrun_policy(Event_timer *timer,
+    Event_timer_overrun_policy policy);
+
+/** Allow timer to fire up to <tt>msec</tt> miliseconds later than requested.
+ *
+ * Expiration of timer with slack is rounded up to the nearest multiple of
+ * slack, measured on <tt>CLOCK_MONOTONIC</tt> clock. Timers with the same
+ * slack that would otherwise expire at slightly different times therefore
+ * expire together and event machine is woken up only once for all of them.
+ *
+ * Timers created by event_wheel_timer_create() align each expiration, while
+ * periodic schedule is kept without drift. Timers with their own
+ * <tt>timerfd</tt> align only first expiration, following ones stay aligned
+ * if period is a multiple of slack.
+ *
+ * Slack is applied by following event_timer_start(). Default value is 0, i.e.
+ * no coalescing.
+ *
+ * @param[in] timer
+ *   Event timer initialized by event_timer_create() or
+ *   event_wheel_timer_create(). If <tt>timer = NULL</tt> then this function
+ *   will return #EM_ERROR_TIMER_NULL.
+ *
+ * @param[in] msec
+ *   Slack in miliseconds.
+ *
+ * @return
+ *   Returns #EM_ERROR_TIMER_NULL when timer passed to function is
+ *   <tt>NULL</tt>.
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_timer_set_slack(Event_timer *timer, uint32_t msec);
+
 /** Stop timer.
  *
  * @param[in] timer
@@ -0,0 +1,573 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199901L
+#define _POSIX_C_SOURCE 199901L
+#endif
+
+#include "event-wheel.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/probes-internal.h"
+#include "event-machine/result-internal.h"
+#include "event-machine/wheel-internal.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLOT_MASK               (EM_WHEEL_SLOTS - 1)
+#define BITMAP_WORDS            (EM_WHEEL_SLOTS / 64)
+
+/* Timers that expire this many ticks from now, or later, are put in to the
+ * last slot of the highest level and rescheduled when they get there.
+ */
+#define MAX_DELTA               \
+    (UINT64_C(1) << (EM_WHEEL_LEVELS * EM_WHEEL_SLOT_BITS))
+
+#define LEVEL_SHIFT(level)      ((level) * EM_WHEEL_SLOT_BITS)
+#define SLOT_OF(tick, level)    (((tick) >> LEVEL_SHIFT(level)) & SLOT_MASK)
+
+#define WHEEL_FD(wheel)         ((wheel)->event_descriptor.fd)
+
+
+static inline uint64_t monotonic_nsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/* Tick that is in progress according to the clock. */
+static inline uint64_t clock_tick(const EM_wheel *const wheel)
+{
+    return (monotonic_nsec() - wheel->origin_nsec) / wheel->tick_nsec;
+}
+
+/* First tick that starts at or after deadline, which is absolute time in
+ * nanoseconds. Timers never fire early.
+ */
+static inline uint64_t deadline_tick(const EM_wheel *const wheel,
+    const uint64_t deadline)
+{
+    if (deadline <= wheel->origin_nsec)
+    {
+        return 0;
+    }
+
+    return (deadline - wheel->origin_nsec + wheel->tick_nsec - 1)
+        / wheel->tick_nsec;
+}
+
+/* Tick in which timer fires, i.e. its expiration rounded up to multiple of
+ * its slack, so that timers with the same slack fire together.
+ */
+static inline uint64_t fire_tick(const EM_wheel *const wheel,
+    const Event_timer *const timer)
+{
+    const uint64_t slack = timer->slack_nsec / wheel->tick_nsec;
+
+    if (slack <= 1)
+    {
+        return timer->wheel_expires;
+    }
+
+    return (timer->wheel_expires + slack - 1) / slack * slack;
+}
+
+/* Put timer in to slot according to its expiration. Timers that are already
+ * due are put in to slot of wheel->now.
+ */
+static void link_timer(EM_wheel *const wheel, Event_timer *const timer)
+{
+    uint64_t expires = fire_tick(wheel, timer);
+    uint64_t delta;
+    unsigned int level = 0;
+
+    if (expires < wheel->now)
+    {
+        expires = wheel->now;
+    }
+    delta = expires - wheel->now;
+    if (delta >= MAX_DELTA)
+    {
+        expires = wheel->now + MAX_DELTA - 1;
+        delta = MAX_DELTA - 1;
+    }
+    while (delta >= (UINT64_C(1) << LEVEL_SHIFT(level + 1)))
+    {
+        level++;
+    }
+
+    const unsigned int slot = SLOT_OF(expires, level);
+    Event_timer **const head = &(wheel->slots[level][slot]);
+
+    timer->wheel_next = (*head);
+    if_not_null (*head)
+    {
+        (*head)->wheel_pprev = &(timer->wheel_next);
+    }
+    (*head) = timer;
+    timer->wheel_pprev = head;
+    wheel->bitmap[level][slot / 64] |= UINT64_C(1) << (slot % 64);
+}
+
+/* Remove timer from list it's on. Bit of a slot that becomes empty is left
+ * set and it's cleared lazily by next_tick().
+ */
+static inline void unlink_timer(Event_timer *const timer)
+{
+    (*timer->wheel_pprev) = timer->wheel_next;
+    if_not_null (timer->wheel_next)
+    {
+        timer->wheel_next->wheel_pprev = timer->wheel_pprev;
+    }
+    timer->wheel_next = NULL;
+    timer->wheel_pprev = NULL;
+}
+
+/* Distance from start to the first slot, on given level, with its bit set
+ * and that really contains timers, or -1 if there is none. Searching wraps
+ * around.
+ */
+static int find_slot(EM_wheel *const wheel, const unsigned int level,
+    const unsigned int start)
+{
+    uint64_t *const bitmap = wheel->bitmap[level];
+
+    for (unsigned int distance = 0; distance < EM_WHEEL_SLOTS; )
+    {
+        const unsigned int slot = (start + distance) & SLOT_MASK;
+        const uint64_t word = bitmap[slot / 64] >> (slot % 64);
+
+        if (word == 0)
+        {
+            distance += 64 - slot % 64;
+            continue;
+        }
+
+        const unsigned int found = slot + (unsigned int)__builtin_ctzll(word);
+        distance += found - slot;
+        if (distance >= EM_WHEEL_SLOTS)
+        {
+            break;
+        }
+        if_null (wheel->slots[level][found])
+        {
+            bitmap[found / 64] &= ~(UINT64_C(1) << (found % 64));
+            continue;
+        }
+
+        return (int)distance;
+    }
+
+    return -1;
+}
+
+/* Earliest tick in which there is something to do, i.e. either timers in
+ * level 0 slot expire or higher level slot has to be moved to lower levels.
+ * Returns UINT64_MAX if there are no timers.
+ */
+static uint64_t next_tick(EM_wheel *const wheel)
+{
+    uint64_t next = UINT64_MAX;
+
+    if (wheel->count == 0)
+    {
+        return next;
+    }
+
+    const int distance = find_slot(wheel, 0, SLOT_OF(wheel->now, 0));
+    if (distance >= 0)
+    {
+        next = wheel->now + (uint64_t)distance;
+    }
+
+    for (unsigned int level = 1; level < EM_WHEEL_LEVELS; level++)
+    {
+        /* Slot of current position on this level is moved to lower levels
+         * when wheel->now is at its beginning. Otherwise it was already
+         * moved and timers in it belong to next revolution.
+         */
+        const uint64_t mask = (UINT64_C(1) << LEVEL_SHIFT(level)) - 1;
+        const unsigned int skip = (wheel->now & mask) == 0 ? 0 : 1;
+        const int d =
+            find_slot(wheel, level, SLOT_OF(wheel->now, level) + skip);
+
+        if (d >= 0)
+        {
+            const uint64_t tick =
+                ((wheel->now >> LEVEL_SHIFT(level)) + (uint64_t)d + skip)
+                    << LEVEL_SHIFT(level);
+
+            if (tick < next)
+            {
+                next = tick;
+            }
+        }
+    }
+
+    return next;
+}
+
+/* Move timers from a slot of higher level in to lower levels. */
+static void cascade(EM_wheel *const wheel, const unsigned int level,
+    const unsigned int slot)
+{
+    Event_timer *timer = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+    wheel->bitmap[level][slot / 64] &= ~(UINT64_C(1) << (slot % 64));
+
+    while (not_null(timer))
+    {
+        Event_timer *const next = timer->wheel_next;
+
+        link_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+/* Process tick wheel->now and move to the following one. Target is the tick
+ * that is in progress according to the clock.
+ */
+static void process_tick(EM_wheel *const wheel, const uint64_t target)
+{
+    const uint64_t tick = wheel->now;
+    const unsigned int slot = SLOT_OF(tick, 0);
+    Event_timer *expired = NULL;
+
+    for (unsigned int level = EM_WHEEL_LEVELS - 1; level > 0; level--)
+    {
+        if ((tick & ((UINT64_C(1) << LEVEL_SHIFT(level)) - 1)) == 0)
+        {
+            cascade(wheel, level, SLOT_OF(tick, level));
+        }
+    }
+
+    /* Expired timers are moved to a local list, so that callbacks can stop
+     * or destroy any timer, and start timers that are due immediately.
+     */
+    expired = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    wheel->bitmap[0][slot / 64] &= ~(UINT64_C(1) << (slot % 64));
+    if_not_null (expired)
+    {
+        expired->wheel_pprev = &expired;
+    }
+    wheel->now = tick + 1;
+
+    while (not_null(expired))
+    {
+        Event_timer *const timer = expired;
+
+        unlink_timer(timer);
+        timer->overruns = 1;
+        if (timer->interval_nsec > 0)
+        {
+            /* Next deadline is computed from the previous one, so that
+             * periodic timer doesn't drift. Expirations that were already
+             * missed either fire in following ticks one by one, or they are
+             * skipped and reported in overruns.
+             */
+            const uint64_t now_nsec =
+                wheel->origin_nsec + target * wheel->tick_nsec;
+
+            timer->wheel_deadline += timer->interval_nsec;
+            if (timer->overrun_policy == EM_TIMER_OVERRUN_ONCE
+                && timer->wheel_deadline <= now_nsec)
+            {
+                const uint64_t missed =
+                    (now_nsec - timer->wheel_deadline) / timer->interval_nsec
+                        + 1;
+
+                timer->wheel_deadline += missed * timer->interval_nsec;
+                timer->overruns += missed;
+            }
+            timer->wheel_expires = deadline_tick(wheel, timer->wheel_deadline);
+            link_timer(wheel, timer);
+        }
+        else
+        {
+            wheel->count--;
+        }
+
+        wheel->expirations++;
+        EM_TRACE_TIMER_EXPIRE(wheel->event_machine, timer, timer->overruns);
+        timer->callback(timer, timer->data);
+    }
+}
+
+/* Arm timerfd for the earliest tick that needs processing, if it's not
+ * armed for it already.
+ */
+static uint32_t rearm(EM_wheel *const wheel)
+{
+    const uint64_t next = next_tick(wheel);
+    struct itimerspec expiration = {{0, 0}, {0, 0}};
+
+    if (next == wheel->armed)
+    {
+        return EM_SUCCESS;
+    }
+    if (next != UINT64_MAX)
+    {
+        const uint64_t nsec = wheel->origin_nsec + next * wheel->tick_nsec;
+
+        expiration.it_value.tv_sec = (time_t)(nsec / 1000000000);
+        expiration.it_value.tv_nsec = (long)(nsec % 1000000000);
+    }
+
+    if_negative (timerfd_settime(WHEEL_FD(wheel), TFD_TIMER_ABSTIME,
+        &expiration, NULL))
+    {
+        wheel->armed = UINT64_MAX;
+
+        return EM_ERROR_TIMERFD_SETTIME;
+    }
+    wheel->armed = next;
+
+    return EM_SUCCESS;
+}
+
+static void internal_wheel_handler(EM *const em, const uint32_t events,
+    const int fd, void *const data)
+{
+    EM_wheel *const wheel = data;
+    uint64_t number_of_timeouts;
+
+    assert(em != NULL);
+    assert(valid_fd(fd));
+
+    EM_METRICS_INC(em, read_calls);
+    if (read(fd, &number_of_timeouts, sizeof(uint64_t)) != sizeof(uint64_t)
+        && errno == EAGAIN)
+    {
+        /* Since timer file descriptor is registered as level triggered, then
+         * we can safely retry later.
+         */
+        return;
+    }
+
+    /* Expired timerfd is no longer armed. */
+    wheel->armed = UINT64_MAX;
+
+    const uint64_t expirations = wheel->expirations;
+
+    const uint64_t target = clock_tick(wheel);
+    for (uint64_t next = next_tick(wheel); next <= target;
+        next = next_tick(wheel))
+    {
+        wheel->now = next;
+        process_tick(wheel, target);
+    }
+    if (wheel->now <= target)
+    {
+        wheel->now = target + 1;
+    }
+    if (wheel->expirations != expirations)
+    {
+        wheel->wakeups++;
+    }
+
+    /* If arming fails, then there is no way how to report it. Timers will
+     * fire when next timer is started.
+     */
+    rearm(wheel);
+}
+
+uint32_t event_wheel_init(EM *const event_machine, EM_wheel *const wheel,
+    const uint32_t tick_usec)
+{
+    if (null(event_machine) || null(wheel))
+    {
+        return EM_ERROR_NULL;
+    }
+
+    memset(wheel, 0, sizeof(EM_wheel));
+    wheel->event_machine = event_machine;
+    wheel->tick_nsec =
+        (uint64_t)(tick_usec == 0 ? EM_WHEEL_DEFAULT_TICK_USEC : tick_usec)
+            * 1000;
+    wheel->armed = UINT64_MAX;
+
+    const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if_invalid_fd (fd)
+    {
+        return EM_ERROR_TIMERFD_CREATE;
+    }
+
+    /* Tick 0 starts one tick in the past, that way timerfd is never armed
+     * for time 0, which would disarm it.
+     */
+    wheel->origin_nsec = monotonic_nsec() - wheel->tick_nsec;
+    wheel->now = 1;
+
+    wheel->event_descriptor.fd = fd;
+    wheel->event_descriptor.events = EPOLLIN;
+    wheel->event_descriptor.data = wheel;
+    wheel->event_descriptor.handler = internal_wheel_handler;
+
+    const uint32_t ret =
+        event_machine_add(event_machine, &(wheel->event_descriptor));
+    if_em_failure (ret)
+    {
+        const int saved_errno = errno;
+
+        close(fd);
+        wheel->event_descriptor.fd = -1;
+        errno = saved_errno;
+    }
+
+    return ret;
+}
+
+uint32_t event_wheel_destroy(EM_wheel *const wheel)
+{
+    if_null (wheel)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    /* Stop all running timers. */
+    for (unsigned int level = 0; level < EM_WHEEL_LEVELS; level++)
+    {
+        for (unsigned int slot = 0; slot < EM_WHEEL_SLOTS; slot++)
+        {
+            while (not_null(wheel->slots[level][slot]))
+            {
+                unlink_timer(wheel->slots[level][slot]);
+            }
+        }
+    }
+    memset(wheel->bitmap, 0, sizeof(wheel->bitmap));
+    wheel->count = 0;
+
+    uint32_t ret = event_machine_delete(wheel->event_machine,
+        WHEEL_FD(wheel), NULL);
+    if_em_failure (ret)
+    {
+        const int saved_errno = errno;
+
+        close(WHEEL_FD(wheel));
+        WHEEL_FD(wheel) = -1;
+        errno = saved_errno;
+
+        return ret;
+    }
+
+    if_negative (close(WHEEL_FD(wheel)))
+    {
+        WHEEL_FD(wheel) = -1;
+
+        return EM_ERROR_CLOSE;
+    }
+    WHEEL_FD(wheel) = -1;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_wheel_timer_create(EM_wheel *const wheel,
+    Event_timer *const timer, const Event_timer_handler callback,
+    void *const data)
+{
+    if_null (wheel)
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (timer)
+    {
+        return EM_ERROR_TIMER_NULL;
+    }
+    if_null (callback)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    memset(timer, 0, sizeof(Event_timer));
+    timer->event_descriptor.fd = -1;
+    timer->event_machine = wheel->event_machine;
+    timer->data = data;
+    timer->callback = callback;
+    timer->wheel = wheel;
+
+    return EM_SUCCESS;
+}
+
+uint32_t em_wheel_timer_start(Event_timer *const timer,
+    const uint64_t deadline)
+{
+    EM_wheel *const wheel = timer->wheel;
+
+    assert(wheel != NULL);
+
+    em_wheel_timer_stop(timer);
+
+    timer->wheel_deadline = deadline;
+    timer->wheel_expires = deadline_tick(wheel, deadline);
+
+    link_timer(wheel, timer);
+    wheel->count++;
+
+    /* Most timers expire after the one timerfd is armed for, for them there
+     * is no system call.
+     */
+    if (fire_tick(wheel, timer) < wheel->armed)
+    {
+        return rearm(wheel);
+    }
+
+    return EM_SUCCESS;
+}
+
+void em_wheel_timer_stop(Event_timer *const timer)
+{
+    if_not_null (timer->wheel_pprev)
+    {
+        unlink_timer(timer);
+        timer->wheel->count--;
+    }
+}
+
+uint64_t event_wheel_saved_wakeups(const EM_wheel *const wheel)
+{
+    if_null (wheel)
+    {
+        return 0;
+    }
+
+    return wheel->expirations - wheel->wakeups;
+}
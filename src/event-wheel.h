@@ -0,0 +1,248 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-wheel.h
+ * Hierarchical timing wheel that drives many #Event_timer instances using
+ * one <tt>timerfd</tt>.
+ *
+ * Timer created by event_timer_create() has its own <tt>timerfd</tt>
+ * registered in event machine, which is too expensive when there are
+ * hundreds of thousands of timers, e.g. one idle timeout per connection.
+ * Timers created by event_wheel_timer_create() instead live in a timing
+ * wheel and only one <tt>timerfd</tt>, armed for the earliest of them, is
+ * registered in event machine. Once created they are used through the same
+ * event_timer_start(), event_timer_stop() and event_timer_destroy() functions
+ * and their callbacks are invoked from event machine loop as well.
+ *
+ * Wheel has #EM_WHEEL_LEVELS levels of #EM_WHEEL_SLOTS slots. Level 0 slots
+ * are one tick wide, each following level has slots #EM_WHEEL_SLOTS times
+ * wider. Timer is put in to a slot of the lowest level that covers its
+ * expiration, and it's moved to lower levels as time passes. Starting and
+ * stopping timer is O(1). Expiration is rounded up to whole ticks, timers
+ * never fire early.
+ *
+ * Wheel isn't thread safe, it has to be used only by the thread that runs its
+ * event machine.
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_WHEEL_H_262015379912348817455069837016237811090
+#define EVENT_WHEEL_H_262015379912348817455069837016237811090
+
+#include "event-machine.h"
+#include "event-timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of levels of timing wheel.
+ */
+#define EM_WHEEL_LEVELS         4
+
+/** Base 2 logarithm of number of slots on each level of timing wheel.
+ */
+#define EM_WHEEL_SLOT_BITS      8
+
+/** Number of slots on each level of timing wheel.
+ */
+#define EM_WHEEL_SLOTS          (1 << EM_WHEEL_SLOT_BITS)
+
+/** Tick length used if zero is passed to event_wheel_init(), in
+ * microseconds.
+ */
+#define EM_WHEEL_DEFAULT_TICK_USEC  1000
+
+/** Timing wheel. Its fields are private, use functions declared below.
+ */
+typedef struct EM_wheel_s
+{
+    /** Event machine in which <tt>timerfd</tt> of this wheel is registered.
+     */
+    EM *event_machine;
+
+    /** Registration of <tt>timerfd</tt>.
+     */
+    EM_event_descriptor event_descriptor;
+
+    /** Length of one tick in nanoseconds.
+     */
+    uint64_t tick_nsec;
+
+    /** Value of <tt>CLOCK_MONOTONIC</tt>, in nanoseconds, at tick 0.
+     */
+    uint64_t origin_nsec;
+
+    /** Next tick that wasn't processed, yet.
+     */
+    uint64_t now;
+
+    /** Tick for which <tt>timerfd</tt> is armed or <tt>UINT64_MAX</tt> if
+     * it isn't armed.
+     */
+    uint64_t armed;
+
+    /** Number of running timers.
+     */
+    size_t count;
+
+    /** Number of timer expirations, i.e. callback invocations.
+     *
+     * @see event_wheel_saved_wakeups()
+     */
+    uint64_t expirations;
+
+    /** Number of times <tt>timerfd</tt> woke up event machine and at least
+     * one timer expired.
+     *
+     * @see event_wheel_saved_wakeups()
+     */
+    uint64_t wakeups;
+
+    /** Bit is set for each slot that isn't empty.
+     */
+    uint64_t bitmap[EM_WHEEL_LEVELS][EM_WHEEL_SLOTS / 64];
+
+    /** Lists of timers linked through <tt>wheel_next</tt>.
+     */
+    Event_timer *slots[EM_WHEEL_LEVELS][EM_WHEEL_SLOTS];
+} EM_wheel;
+
+/** Initialize timing wheel and register its <tt>timerfd</tt> in event
+ * machine.
+ *
+ * @param[in] event_machine
+ *   Initialized event machine.
+ *
+ * @param[out] wheel
+ *   Wheel to initialize.
+ *
+ * @param[in] tick_usec
+ *   Length of one tick in microseconds, i.e. resolution of timers. With
+ *   default value of 1 millisecond the longest timer that doesn't need to be
+ *   rescheduled internally is about 49 days. Value 0 means
+ *   #EM_WHEEL_DEFAULT_TICK_USEC.
+ *
+ * @return
+ *   Returns #EM_ERROR_TIMERFD_CREATE if timerfd_create() fails. Read value of
+ *   <tt>errno</tt> for details.
+ *
+ * @return
+ *   Errors returned by event_machine_add().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_wheel_init(EM *event_machine, EM_wheel *wheel,
+    uint32_t tick_usec);
+
+/** Unregister and close <tt>timerfd</tt> of timing wheel. Timers that are
+ * still running are stopped, but they still have to be destroyed using
+ * event_timer_destroy().
+ *
+ * @param[in] wheel
+ *   Wheel initialized by event_wheel_init().
+ *
+ * @return
+ *   Returns #EM_ERROR_CLOSE if <tt>close()</tt> call on timerfd file
+ *   descriptor fails. Read value of <tt>errno</tt> for details.
+ *
+ * @return
+ *   Errors returned by event_machine_delete().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_wheel_destroy(EM_wheel *wheel);
+
+/** Create timer driven by timing wheel.
+ *
+ * Same as event_timer_create(), but timer doesn't create its own
+ * <tt>timerfd</tt>, therefore it can't fail because of exhausted file
+ * descriptors. Timer is then used through event_timer_start(),
+ * event_timer_stop() and event_timer_destroy().
+ *
+ * @param[in] wheel
+ *   Wheel initialized by event_wheel_init().
+ *
+ * @param[in] timer
+ *   Already allocated buffer where Event_timer structure will be stored.
+ *
+ * @param[in] callback
+ *   Callback function that is invoked when timer expires.
+ *
+ * @param[in] data
+ *   Pointer to timer private state/data passed to callback.
+ *
+ * @return
+ *   Returns #EM_ERROR_NULL if <tt>wheel</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_TIMER_NULL when timer passed to function is
+ *   <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL when argument with callback function
+ *   pointer is <tt>NULL</tt>.
+ *
+ * @return
+ *   On success function returns #EM_SUCCESS.
+ */
+uint32_t event_wheel_timer_create(EM_wheel *wheel, Event_timer *timer,
+    Event_timer_handler callback, void *data);
+
+/** Number of event machine wakeups saved by firing more timers at once,
+ * i.e. number of timer expirations minus number of <tt>timerfd</tt> wakeups
+ * in which they were processed.
+ *
+ * Timers expire together if they fall in to the same tick, and more of them
+ * do so when they have slack set using event_timer_set_slack().
+ *
+ * @param[in] wheel
+ *   Wheel initialized by event_wheel_init().
+ *
+ * @return
+ *   Number of saved wakeups since event_wheel_init(), or 0 if
+ *   <tt>wheel</tt> is <tt>NULL</tt>.
+ */
+uint64_t event_wheel_saved_wakeups(const EM_wheel *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_WHEEL_H_262015379912348817455069837016237811090 */
@@ -0,0 +1,459 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "event-zerocopy.h"
+#include "event-machine/metrics-internal.h"
+#include "event-machine/result-internal.h"
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY     60
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+#endif
+
+#define SEND_FLAGS      (MSG_DONTWAIT | MSG_NOSIGNAL)
+
+struct EM_zerocopy_buffer_s
+{
+    struct EM_zerocopy_buffer_s *next;
+    const char *buffer;
+    size_t length;
+
+    /* Number of bytes that were sent.
+     */
+    size_t offset;
+    void *data;
+
+    /* Kernel assigns consecutive identifiers to MSG_ZEROCOPY sends, buffer
+     * that needed more send calls covers range starting with first_id.
+     */
+    uint32_t first_id;
+    uint32_t calls;
+
+    /* Number of its MSG_ZEROCOPY sends that weren't completed, yet.
+     */
+    uint32_t uncompleted;
+
+    /* Whether following sends of this buffer use MSG_ZEROCOPY.
+     */
+    bool zerocopy;
+
+    /* Kernel copied at least part of the data.
+     */
+    bool copied;
+};
+
+
+static uint32_t set_write_enabled(EM_zerocopy *const zerocopy,
+    const bool enable)
+{
+    EM_event_descriptor *const ed = zerocopy->event_descriptor;
+
+    if (zerocopy->write_enabled == enable)
+    {
+        return EM_SUCCESS;
+    }
+
+    if (enable)
+    {
+        ed->events |= EVENT_WRITE;
+    }
+    else
+    {
+        ed->events &= ~(event_filter_t)EVENT_WRITE;
+    }
+    ret_em_failure(event_machine_modify(zerocopy->event_machine, ed->fd, ed,
+        NULL));
+    zerocopy->write_enabled = enable;
+
+    return EM_SUCCESS;
+}
+
+/* Invoke callback for buffers at the beginning of the queue that were sent
+ * and kernel doesn't use anymore. Callback may send again, therefore each
+ * buffer is unlinked before it's invoked, and nested calls leave the rest to
+ * the outer one.
+ */
+static void release(EM_zerocopy *const zerocopy)
+{
+    struct EM_zerocopy_buffer_s *buffer;
+
+    if (zerocopy->releasing)
+    {
+        return;
+    }
+    zerocopy->releasing = true;
+
+    while (not_null(buffer = zerocopy->head) && buffer != zerocopy->unsent
+        && buffer->uncompleted == 0)
+    {
+        zerocopy->head = buffer->next;
+        if_null (zerocopy->head)
+        {
+            zerocopy->tail = NULL;
+        }
+        zerocopy->pending--;
+
+        zerocopy->handler(zerocopy->event_machine, zerocopy, buffer->buffer,
+            buffer->length, buffer->copied || buffer->calls == 0,
+            buffer->data);
+        free(buffer);
+    }
+    zerocopy->releasing = false;
+}
+
+/* Send queued buffers until socket is full.
+ */
+static uint32_t flush(EM_zerocopy *const zerocopy)
+{
+    EM *const em = zerocopy->event_machine;
+    const int fd = zerocopy->event_descriptor->fd;
+
+    while (not_null(zerocopy->unsent))
+    {
+        struct EM_zerocopy_buffer_s *const buffer = zerocopy->unsent;
+        const int flags =
+            SEND_FLAGS | (buffer->zerocopy ? MSG_ZEROCOPY : 0);
+
+        EM_METRICS_INC(em, io_write_calls);
+        const ssize_t n = send(fd, buffer->buffer + buffer->offset,
+            buffer->length - buffer->offset, flags);
+        if_negative (n)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == ENOBUFS && buffer->zerocopy)
+            {
+                /* Pinned pages are limited by optmem_max, rest of the
+                 * buffer is copied.
+                 */
+                buffer->zerocopy = false;
+                buffer->copied = true;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+
+            return EM_ERROR_WRITE;
+        }
+
+        if ((flags & MSG_ZEROCOPY) != 0)
+        {
+            if_zero (buffer->calls)
+            {
+                buffer->first_id = zerocopy->next_id;
+            }
+            buffer->calls++;
+            buffer->uncompleted++;
+            zerocopy->next_id++;
+        }
+        buffer->offset += (size_t)n;
+        if (buffer->offset == buffer->length)
+        {
+            zerocopy->unsent = buffer->next;
+        }
+    }
+
+    return set_write_enabled(zerocopy, not_null(zerocopy->unsent));
+}
+
+/* Number of identifiers in [first, first + count) that are also in
+ * [low, high]. Identifiers wrap around, but all that are in flight fit in to
+ * a window much smaller than 2^31.
+ */
+static inline uint32_t overlap(const uint32_t first, const uint32_t count,
+    const uint32_t low, const uint32_t high)
+{
+    const int64_t begin = (int32_t)(first - low);
+    const int64_t end = begin + (int64_t)count - 1;
+    const int64_t from = begin > 0 ? begin : 0;
+    const int64_t to = end < (int64_t)(high - low) ? end : (int64_t)(high - low);
+
+    return to >= from ? (uint32_t)(to - from + 1) : 0;
+}
+
+static void complete(EM_zerocopy *const zerocopy, const uint32_t low,
+    const uint32_t high, const bool copied)
+{
+    /* Buffers that weren't sent at all have no identifiers and therefore no
+     * overlap.
+     */
+    for (struct EM_zerocopy_buffer_s *buffer = zerocopy->head;
+        not_null(buffer); buffer = buffer->next)
+    {
+        const uint32_t n =
+            overlap(buffer->first_id, buffer->calls, low, high);
+
+        if_zero (n)
+        {
+            continue;
+        }
+        buffer->uncompleted -=
+            n < buffer->uncompleted ? n : buffer->uncompleted;
+        if (copied && not(buffer->copied))
+        {
+            buffer->copied = true;
+            zerocopy->copied++;
+        }
+    }
+}
+
+/* Read all completions from error queue. Returns -1 on error, 0 if error
+ * queue was empty and 1 if something was read.
+ */
+static int read_completions(EM_zerocopy *const zerocopy)
+{
+    const int fd = zerocopy->event_descriptor->fd;
+    int ret = 0;
+
+    for (;;)
+    {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))
+            + CMSG_SPACE(sizeof(struct sockaddr_in6))];
+        struct msghdr message =
+            { .msg_control = control
+            , .msg_controllen = sizeof(control)
+            };
+
+        EM_METRICS_INC(zerocopy->event_machine, io_read_calls);
+        if_negative (recvmsg(fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT))
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return errno == EAGAIN || errno == EWOULDBLOCK ? ret : -1;
+        }
+        ret = 1;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); not_null(cmsg);
+            cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (not((cmsg->cmsg_level == SOL_IP
+                        && cmsg->cmsg_type == IP_RECVERR)
+                    || (cmsg->cmsg_level == SOL_IPV6
+                        && cmsg->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+
+            const struct sock_extended_err *const error =
+                (const struct sock_extended_err *)CMSG_DATA(cmsg);
+
+            if (error->ee_errno == 0
+                && error->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+            {
+                complete(zerocopy, error->ee_info, error->ee_data,
+                    (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+            }
+        }
+    }
+}
+
+uint32_t event_zerocopy_init(EM_zerocopy *const zerocopy, EM *const em,
+    EM_event_descriptor *const ed, const size_t threshold,
+    const EM_zerocopy_handler handler)
+{
+    if (null(zerocopy) || null(em))
+    {
+        return EM_ERROR_NULL;
+    }
+    if_null (ed)
+    {
+        return EM_ERROR_DESCRIPTOR_NULL;
+    }
+    if_null (handler)
+    {
+        return EM_ERROR_CALLBACK_NULL;
+    }
+
+    memset(zerocopy, 0, sizeof(EM_zerocopy));
+    zerocopy->event_machine = em;
+    zerocopy->event_descriptor = ed;
+    zerocopy->threshold =
+        threshold == 0 ? EM_ZEROCOPY_DEFAULT_THRESHOLD : threshold;
+    zerocopy->handler = handler;
+    zerocopy->write_enabled = (ed->events & EVENT_WRITE) != 0;
+
+    /* Kernels without zero copy support, and sockets of other types, refuse
+     * the option and everything is copied.
+     */
+    const int one = 1;
+    zerocopy->enabled =
+        setsockopt(ed->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_zerocopy_destroy(EM_zerocopy *const zerocopy)
+{
+    if_null (zerocopy)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    zerocopy->unsent = NULL;
+    for (struct EM_zerocopy_buffer_s *buffer = zerocopy->head;
+        not_null(buffer); buffer = buffer->next)
+    {
+        buffer->uncompleted = 0;
+    }
+    release(zerocopy);
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_zerocopy_send(EM_zerocopy *const zerocopy,
+    const void *const buffer, const size_t length, void *const data)
+{
+    if_null (zerocopy)
+    {
+        return EM_ERROR_NULL;
+    }
+    if (null(buffer) && length > 0)
+    {
+        return EM_ERROR_BUFFER_NULL;
+    }
+
+    struct EM_zerocopy_buffer_s *const entry =
+        calloc(1, sizeof(struct EM_zerocopy_buffer_s));
+    if_null (entry)
+    {
+        return EM_ERROR_MALLOC;
+    }
+    entry->buffer = buffer;
+    entry->length = length;
+    entry->data = data;
+    entry->zerocopy = zerocopy->enabled && length >= zerocopy->threshold;
+
+    if_null (zerocopy->tail)
+    {
+        zerocopy->head = entry;
+    }
+    else
+    {
+        zerocopy->tail->next = entry;
+    }
+    zerocopy->tail = entry;
+    if_null (zerocopy->unsent)
+    {
+        zerocopy->unsent = entry;
+    }
+    zerocopy->pending++;
+
+    /* Empty buffer is sent without calling send().
+     */
+    if_zero (length)
+    {
+        if (zerocopy->unsent == entry)
+        {
+            zerocopy->unsent = NULL;
+        }
+        release(zerocopy);
+
+        return EM_SUCCESS;
+    }
+
+    if (zerocopy->write_enabled)
+    {
+        return EM_SUCCESS;
+    }
+    ret_em_failure(flush(zerocopy));
+
+    /* Copied buffers are released right away.
+     */
+    release(zerocopy);
+
+    return EM_SUCCESS;
+}
+
+uint32_t event_zerocopy_handle(EM_zerocopy *const zerocopy,
+    const event_filter_t events)
+{
+    if_null (zerocopy)
+    {
+        return EM_ERROR_NULL;
+    }
+
+    if (events & EPOLLERR)
+    {
+        const int ret = read_completions(zerocopy);
+
+        if_negative (ret)
+        {
+            return EM_ERROR_READ;
+        }
+
+        /* No completion means that EPOLLERR was caused by socket error.
+         */
+        if_zero (ret)
+        {
+            int error = 0;
+            socklen_t length = sizeof(error);
+
+            if (getsockopt(zerocopy->event_descriptor->fd, SOL_SOCKET,
+                    SO_ERROR, &error, &length) == 0
+                && error != 0)
+            {
+                errno = error;
+
+                return EM_ERROR_READ;
+            }
+        }
+    }
+    if (events & EVENT_WRITE)
+    {
+        ret_em_failure(flush(zerocopy));
+    }
+    release(zerocopy);
+
+    return EM_SUCCESS;
+}
@@ -0,0 +1,264 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** @file event-zerocopy.h
+ * Sending of large buffers using <tt>MSG_ZEROCOPY</tt>.
+ *
+ * Buffers passed to event_zerocopy_send() aren't copied, kernel sends
+ * directly from their pages. Buffer may not be modified or released until
+ * kernel reports that it's done with it, which happens asynchronously
+ * through error queue of the socket. Socket then becomes ready with
+ * <tt>EPOLLERR</tt>, which is always reported by event machine, and event
+ * handler has to pass it to event_zerocopy_handle(). That drains
+ * completions from error queue and invokes #EM_zerocopy_handler for each
+ * buffer that can be reused, in the order in which buffers were sent.
+ *
+ * Buffers smaller than the threshold passed to event_zerocopy_init() are
+ * sent by ordinary copying <tt>send()</tt>, because page pinning and
+ * completion handling cost more than copying them. They are still released
+ * through #EM_zerocopy_handler, so that caller doesn't have to distinguish
+ * the two cases. Same happens if socket doesn't support
+ * <tt>SO_ZEROCOPY</tt>.
+ *
+ * Buffers that can't be sent immediately are queued and <tt>EVENT_WRITE</tt>
+ * is added to events of the socket until the queue is sent. Event handler
+ * passes <tt>EVENT_WRITE</tt> to event_zerocopy_handle() as well.
+ *
+ * Kernel may decide to copy data anyway, e.g. on loopback, in which case
+ * completion is reported with <tt>copied</tt> flag set. Zero copy sending
+ * pays off only for large transfers over real network devices.
+ *
+ * Available only on Linux with <tt>epoll</tt> or <tt>io_uring</tt> backend.
+ *
+ * Usage example can be found here: @link example/zerocopy-sender.c @endlink
+ *
+ * @author Peter Trško
+ * @date 2015
+ * @copyright BSD3
+ */
+
+#ifndef EVENT_ZEROCOPY_H_270531966457270312016592480370958106511
+#define EVENT_ZEROCOPY_H_270531966457270312016592480370958106511
+
+#include "event-machine.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Threshold used if zero is passed to event_zerocopy_init(). Smaller
+ * buffers are copied.
+ */
+#define EM_ZEROCOPY_DEFAULT_THRESHOLD   (16 * 1024)
+
+struct EM_zerocopy_s;           /* Forward declaration */
+struct EM_zerocopy_buffer_s;    /* Forward declaration, private. */
+
+/** Type of callbacks invoked when kernel doesn't need a buffer anymore.
+ *
+ * @param[in] event_machine
+ *   Event machine passed to event_zerocopy_init().
+ *
+ * @param[in] zerocopy
+ *   Sender that sent the buffer.
+ *
+ * @param[in] buffer
+ *   Buffer passed to event_zerocopy_send(), it can be reused or released.
+ *
+ * @param[in] length
+ *   Its length in bytes.
+ *
+ * @param[in] copied
+ *   True if data were copied after all, either because the buffer was
+ *   smaller than threshold, or because kernel decided so.
+ *
+ * @param[in] data
+ *   Pointer passed to event_zerocopy_send() together with the buffer.
+ */
+typedef void (*EM_zerocopy_handler)(EM *event_machine,
+    struct EM_zerocopy_s *zerocopy, const void *buffer, size_t length,
+    bool copied, void *data);
+
+/** Zero copy sender of one socket. Its fields are private, use functions
+ * declared below.
+ */
+typedef struct EM_zerocopy_s
+{
+    EM *event_machine;
+
+    /** Event descriptor of the socket.
+     */
+    EM_event_descriptor *event_descriptor;
+
+    /** Buffers in the order they were passed to event_zerocopy_send(). Those
+     * before <tt>unsent</tt> were sent, but kernel may still use them.
+     */
+    struct EM_zerocopy_buffer_s *head;
+    struct EM_zerocopy_buffer_s *tail;
+    struct EM_zerocopy_buffer_s *unsent;
+
+    /** Buffers smaller than this are copied.
+     */
+    size_t threshold;
+
+    /** Callback that releases buffers.
+     */
+    EM_zerocopy_handler handler;
+
+    /** Number of buffers that weren't released, yet.
+     */
+    size_t pending;
+
+    /** Identifier kernel assigns to the next <tt>MSG_ZEROCOPY</tt> send.
+     */
+    uint32_t next_id;
+
+    /** Number of buffers sent with <tt>MSG_ZEROCOPY</tt> whose data were
+     * copied by kernel anyway.
+     */
+    uint64_t copied;
+
+    /** False if socket doesn't support <tt>SO_ZEROCOPY</tt>.
+     */
+    bool enabled;
+
+    /** True while <tt>EVENT_WRITE</tt> is in events of the socket.
+     */
+    bool write_enabled;
+
+    /** True while buffers are being released.
+     */
+    bool releasing;
+} EM_zerocopy;
+
+/** Enable <tt>SO_ZEROCOPY</tt> on a socket and initialize sender.
+ *
+ * @param[out] zerocopy
+ *   Sender to initialize.
+ *
+ * @param[in] event_machine
+ *   Event machine in which the socket is registered.
+ *
+ * @param[in] event_descriptor
+ *   Event descriptor of nonblocking TCP or UDP socket.
+ *
+ * @param[in] threshold
+ *   Buffers smaller than this are copied, 0 means
+ *   #EM_ZEROCOPY_DEFAULT_THRESHOLD.
+ *
+ * @param[in] handler
+ *   Callback that releases buffers, it may not be <tt>NULL</tt>.
+ *
+ * @return
+ *   Returns #EM_ERROR_CALLBACK_NULL if <tt>handler</tt> is <tt>NULL</tt>.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>. Socket that doesn't
+ *   support <tt>SO_ZEROCOPY</tt> isn't a failure, all buffers are copied.
+ */
+uint32_t event_zerocopy_init(EM_zerocopy *zerocopy, EM *event_machine,
+    EM_event_descriptor *event_descriptor, size_t threshold,
+    EM_zerocopy_handler handler);
+
+/** Release all buffers by invoking #EM_zerocopy_handler. Socket should be
+ * closed first, otherwise kernel may still be sending from them.
+ *
+ * @param[in] zerocopy
+ *   Sender initialized by event_zerocopy_init().
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_zerocopy_destroy(EM_zerocopy *zerocopy);
+
+/** Send buffer, or queue it if socket isn't writable.
+ *
+ * @param[in] zerocopy
+ *   Sender initialized by event_zerocopy_init().
+ *
+ * @param[in] buffer
+ *   Data to send. Buffer may not be modified until it's passed to
+ *   #EM_zerocopy_handler.
+ *
+ * @param[in] length
+ *   Number of bytes to send.
+ *
+ * @param[in] data
+ *   Pointer passed to #EM_zerocopy_handler when buffer is released.
+ *
+ * @return
+ *   Returns #EM_ERROR_MALLOC if memory allocation failed, buffer isn't
+ *   queued in such case.
+ *
+ * @return
+ *   Returns #EM_ERROR_WRITE if sending failed, buffer stays queued.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_zerocopy_send(EM_zerocopy *zerocopy, const void *buffer,
+    size_t length, void *data);
+
+/** Process events of the socket. Event handler has to call it whenever it's
+ * invoked with <tt>EPOLLERR</tt> or <tt>EVENT_WRITE</tt>. Completions are
+ * read from error queue, buffers are released and queued buffers are sent.
+ *
+ * @param[in] zerocopy
+ *   Sender initialized by event_zerocopy_init().
+ *
+ * @param[in] events
+ *   Events passed to event handler.
+ *
+ * @return
+ *   Returns #EM_ERROR_READ if reading error queue failed, or if socket has
+ *   pending error, in which case <tt>errno</tt> is set to it.
+ *
+ * @return
+ *   Returns #EM_ERROR_WRITE if sending failed.
+ *
+ * @return
+ *   On success function returns <tt>EM_SUCCESS</tt> and on failure it returns
+ *   positive integer from <tt>enum EM_result</tt>.
+ */
+uint32_t event_zerocopy_handle(EM_zerocopy *zerocopy, event_filter_t events);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_ZEROCOPY_H_270531966457270312016592480370958106511 */
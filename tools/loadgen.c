@@ -0,0 +1,802 @@
+/* Copyright (c) 2015, Peter Trško <peter.trsko@gmail.com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *     * Neither the name of Peter Trško nor the names of other
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Loopback load generator for TCP servers built on event machine, see
+ * example/tcp-echo-server.c. It opens many connections, sends requests of
+ * fixed size and expects each of them to be echoed back.
+ *
+ * Modes:
+ *
+ * - closed: Each connection has exactly one request in flight and sends the
+ *   next one as soon as response arrives. Good for measuring maximal
+ *   throughput, but latency percentiles are optimistic, because stalled
+ *   server also stops requests that would have observed the stall
+ *   ("coordinated omission").
+ *
+ * - open: Requests are sent with fixed total rate, distributed round robin
+ *   among connections, regardless of responses. Latency is measured from the
+ *   time when request was supposed to be sent and not when it actually was
+ *   sent, therefore stalls of server or of load generator itself are fully
+ *   reflected in percentiles.
+ *
+ * - stream: Connections write as fast as they can and only throughput is
+ *   reported.
+ *
+ * Results are printed in human readable form on standard error and as one
+ * JSON line on standard output, in the same format as benchmarks in bench/.
+ *
+ * Usage: loadgen [-H HOST] [-p PORT] [-c CONNECTIONS] [-d SECONDS]
+ *                [-w WARMUP_SECONDS] [-s MESSAGE_SIZE]
+ *                [-m closed|open|stream] [-r REQUESTS_PER_SECOND]
+ */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "event-machine.h"
+#include "event-storage.h"
+#include "event-timer.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define IO_BUFFER_SIZE      65536
+
+// Period of timer that drives open loop and checks for end of the run.
+#define TICK_MSEC           1
+
+// Latency histogram is log-linear: values are split in to power of two
+// ranges and each of them in to 2^HISTOGRAM_SUB_BITS buckets, which gives
+// relative error bellow 1/2^HISTOGRAM_SUB_BITS.
+#define HISTOGRAM_SUB_BITS  4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS   ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+enum mode
+{
+    MODE_CLOSED,
+    MODE_OPEN,
+    MODE_STREAM
+};
+
+static const char *const mode_names[] = {"closed", "open", "stream"};
+
+struct options
+{
+    const char *host;
+    int port;
+    size_t connections;
+    double duration;
+    double warmup;
+    size_t message_size;
+    enum mode mode;
+    double rate;
+};
+
+struct histogram
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+struct loadgen;
+
+struct connection
+{
+    EM_event_descriptor ed;
+    struct loadgen *loadgen;
+    bool connected;
+    bool failed;
+
+    // Bytes of requests that weren't written yet.
+    uint64_t unsent;
+
+    // Bytes of the oldest response in flight that were already received.
+    size_t received;
+
+    // Ring buffer with start times of requests in flight, oldest first.
+    uint64_t *starts;
+    size_t head;
+    size_t count;
+    size_t size;
+};
+
+struct loadgen
+{
+    EM em;
+    Event_timer ticker;
+    struct options options;
+    struct connection *connections;
+    size_t connected;
+    size_t failed;
+
+    // Open loop: number of requests scheduled so far and connection that
+    // gets the next one.
+    uint64_t scheduled;
+    size_t next_connection;
+
+    uint64_t start;
+    uint64_t measure_start;
+    uint64_t measure_end;
+    uint64_t end;
+    bool measuring;
+
+    // Following values are updated only while measuring.
+    uint64_t completed;
+    uint64_t sent_bytes;
+    uint64_t received_bytes;
+    struct histogram latency;
+};
+
+static char payload[IO_BUFFER_SIZE];
+static char scratch[IO_BUFFER_SIZE];
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+// {{{ Histogram ##############################################################
+
+static size_t histogram_bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_COUNT)
+    {
+        return (size_t)value;
+    }
+
+    const unsigned int exponent = 63 - (unsigned int)__builtin_clzll(value);
+    const unsigned int shift = exponent - HISTOGRAM_SUB_BITS;
+
+    return (size_t)(exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT
+        + (size_t)((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+// Highest value that falls in to specified bucket.
+static uint64_t histogram_bucket_value(size_t bucket)
+{
+    if (bucket < HISTOGRAM_SUB_COUNT)
+    {
+        return (uint64_t)bucket;
+    }
+
+    const unsigned int shift =
+        (unsigned int)(bucket / HISTOGRAM_SUB_COUNT) - 1;
+    const uint64_t low =
+        (uint64_t)(HISTOGRAM_SUB_COUNT + bucket % HISTOGRAM_SUB_COUNT) << shift;
+
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void histogram_add(struct histogram *histogram, uint64_t value)
+{
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    if (value > histogram->max)
+    {
+        histogram->max = value;
+    }
+}
+
+static uint64_t histogram_percentile(const struct histogram *histogram,
+    double rank)
+{
+    uint64_t seen = 0;
+    const uint64_t target = (uint64_t)(rank * (double)histogram->count);
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen > target)
+        {
+            const uint64_t value = histogram_bucket_value(i);
+
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+// }}} Histogram ##############################################################
+
+// {{{ Connections ############################################################
+
+static void connection_fail(struct connection *connection)
+{
+    struct loadgen *const loadgen = connection->loadgen;
+
+    if (connection->failed)
+    {
+        return;
+    }
+    connection->failed = true;
+    loadgen->failed++;
+    event_machine_delete(&loadgen->em, connection->ed.fd, NULL);
+    close(connection->ed.fd);
+
+    if (loadgen->failed == loadgen->options.connections)
+    {
+        fprintf(stderr, "All connections failed.\n");
+        event_machine_terminate(&loadgen->em);
+    }
+}
+
+// Queue request that should have been sent at specified time.
+static int connection_push(struct connection *connection, uint64_t start)
+{
+    if (connection->count == connection->size)
+    {
+        const size_t size = connection->size == 0 ? 4 : connection->size * 2;
+        uint64_t *starts = malloc(size * sizeof(uint64_t));
+
+        if (starts == NULL)
+        {
+            return -1;
+        }
+        for (size_t i = 0; i < connection->count; i++)
+        {
+            starts[i] =
+                connection->starts[(connection->head + i) % connection->size];
+        }
+        free(connection->starts);
+        connection->starts = starts;
+        connection->head = 0;
+        connection->size = size;
+    }
+
+    connection->starts[(connection->head + connection->count)
+        % connection->size] = start;
+    connection->count++;
+    connection->unsent += connection->loadgen->options.message_size;
+
+    return 0;
+}
+
+// Write as much of unsent requests as socket accepts. Returns -1 on error.
+static int connection_flush(struct connection *connection)
+{
+    struct loadgen *const loadgen = connection->loadgen;
+
+    while (connection->unsent > 0)
+    {
+        const size_t length = connection->unsent < IO_BUFFER_SIZE
+            ? (size_t)connection->unsent
+            : IO_BUFFER_SIZE;
+        const ssize_t written = write(connection->ed.fd, payload, length);
+
+        if (written < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        connection->unsent -= (uint64_t)written;
+        if (loadgen->measuring)
+        {
+            loadgen->sent_bytes += (uint64_t)written;
+        }
+    }
+
+    return 0;
+}
+
+// Response to the oldest request in flight was received.
+static int connection_complete(struct connection *connection, uint64_t now)
+{
+    struct loadgen *const loadgen = connection->loadgen;
+
+    if (connection->count == 0)
+    {
+        fprintf(stderr, "Received response without a request.\n");
+        return -1;
+    }
+
+    const uint64_t start = connection->starts[connection->head];
+
+    connection->head = (connection->head + 1) % connection->size;
+    connection->count--;
+
+    if (loadgen->measuring)
+    {
+        loadgen->completed++;
+        histogram_add(&loadgen->latency, now > start ? now - start : 0);
+    }
+
+    if (loadgen->options.mode == MODE_CLOSED)
+    {
+        return connection_push(connection, now);
+    }
+
+    return 0;
+}
+
+// Read everything that is available. Returns -1 on error or end of file.
+static int connection_receive(struct connection *connection)
+{
+    struct loadgen *const loadgen = connection->loadgen;
+    const size_t message_size = loadgen->options.message_size;
+
+    for (;;)
+    {
+        const ssize_t length = read(connection->ed.fd, scratch, IO_BUFFER_SIZE);
+
+        if (length == 0)
+        {
+            return -1;
+        }
+        if (length < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        if (loadgen->measuring)
+        {
+            loadgen->received_bytes += (uint64_t)length;
+        }
+        if (loadgen->options.mode == MODE_STREAM)
+        {
+            continue;
+        }
+
+        const uint64_t now = now_ns();
+        size_t left = (size_t)length;
+
+        while (connection->received + left >= message_size)
+        {
+            left -= message_size - connection->received;
+            connection->received = 0;
+            if (connection_complete(connection, now) < 0)
+            {
+                return -1;
+            }
+        }
+        connection->received += left;
+    }
+}
+
+static void connection_handler(EM *em, event_filter_t events, int fd,
+    void *data)
+{
+    struct connection *const connection = data;
+    struct loadgen *const loadgen = connection->loadgen;
+
+    if (!connection->connected)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0
+            || error != 0)
+        {
+            connection_fail(connection);
+            return;
+        }
+        connection->connected = true;
+        loadgen->connected++;
+
+        if (loadgen->options.mode == MODE_CLOSED
+            && connection_push(connection, now_ns()) < 0)
+        {
+            connection_fail(connection);
+            return;
+        }
+        if (loadgen->options.mode == MODE_STREAM)
+        {
+            connection->unsent = UINT64_MAX;
+        }
+    }
+
+    if (((events & EPOLLIN) && connection_receive(connection) < 0)
+        || connection_flush(connection) < 0)
+    {
+        connection_fail(connection);
+    }
+}
+
+static int connection_open(struct loadgen *loadgen,
+    struct connection *connection, const struct sockaddr_in *address)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if (connect(fd, (const struct sockaddr *)address,
+            (socklen_t)sizeof(struct sockaddr_in)) < 0
+        && errno != EINPROGRESS)
+    {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+
+    // Edge triggered, therefore interest in writing doesn't have to be
+    // turned on and off. First EPOLLOUT signals that connection was
+    // established.
+    connection->loadgen = loadgen;
+    connection->ed.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    connection->ed.fd = fd;
+    connection->ed.data = connection;
+    connection->ed.handler = connection_handler;
+    if_em_failure (event_machine_add(&loadgen->em, &connection->ed))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+// }}} Connections ############################################################
+
+// Open loop: send requests that are due, each of them is assigned to the
+// next connection that didn't fail.
+static void schedule_requests(struct loadgen *loadgen, uint64_t now)
+{
+    const double rate = loadgen->options.rate;
+    const size_t count = loadgen->options.connections;
+    const uint64_t due =
+        (uint64_t)((double)(now - loadgen->start) * rate / 1e9);
+
+    for (; loadgen->scheduled < due; loadgen->scheduled++)
+    {
+        struct connection *connection = NULL;
+
+        for (size_t i = 0; i < count && connection == NULL; i++)
+        {
+            connection =
+                &loadgen->connections[loadgen->next_connection++ % count];
+            if (connection->failed)
+            {
+                connection = NULL;
+            }
+        }
+        if (connection == NULL)
+        {
+            return;
+        }
+
+        const uint64_t intended = loadgen->start
+            + (uint64_t)((double)loadgen->scheduled * 1e9 / rate);
+
+        if (connection_push(connection, intended) < 0
+            || (connection->connected && connection_flush(connection) < 0))
+        {
+            connection_fail(connection);
+        }
+    }
+}
+
+static void tick(Event_timer *timer, void *data)
+{
+    struct loadgen *const loadgen = data;
+    const uint64_t now = now_ns();
+
+    if (now >= loadgen->end)
+    {
+        loadgen->measuring = false;
+        loadgen->measure_end = now;
+        event_machine_terminate(&loadgen->em);
+        return;
+    }
+    if (!loadgen->measuring && now >= loadgen->measure_start)
+    {
+        loadgen->measuring = true;
+        loadgen->measure_start = now;
+    }
+    if (loadgen->options.mode == MODE_OPEN)
+    {
+        schedule_requests(loadgen, now);
+    }
+}
+
+static void raise_file_limit(size_t connections)
+{
+    struct rlimit limit;
+    const rlim_t needed = (rlim_t)connections + 64;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur >= needed)
+    {
+        return;
+    }
+    limit.rlim_cur = limit.rlim_max == RLIM_INFINITY || limit.rlim_max > needed
+        ? needed
+        : limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < needed)
+    {
+        fprintf(stderr, "Warning: Limit of open files is too low for %zu"
+            " connections.\n", connections);
+    }
+}
+
+static void report(const struct loadgen *loadgen)
+{
+    static const struct { const char *key; const char *label; double rank; }
+    percentiles[] =
+    {
+        {"p50_ns", "p50", 0.50}, {"p90_ns", "p90", 0.90},
+        {"p99_ns", "p99", 0.99}, {"p999_ns", "p99.9", 0.999}
+    };
+    const struct options *const options = &loadgen->options;
+    const uint64_t elapsed_ns = loadgen->measure_end - loadgen->measure_start;
+    const double seconds = elapsed_ns == 0 ? 1e-9 : (double)elapsed_ns / 1e9;
+    const uint64_t ops = options->mode == MODE_STREAM
+        ? loadgen->received_bytes / options->message_size
+        : loadgen->completed;
+    uint64_t in_flight = 0;
+
+    for (size_t i = 0; i < options->connections; i++)
+    {
+        in_flight += loadgen->connections[i].count;
+    }
+
+    fprintf(stderr, "%s mode, %zu of %zu connections, %zu byte messages,"
+        " %.2f s\n", mode_names[options->mode], loadgen->connected,
+        options->connections, options->message_size, seconds);
+    fprintf(stderr, "  %" PRIu64 " messages (%.0f/s), %.2f MB/s sent,"
+        " %.2f MB/s received\n", ops, (double)ops / seconds,
+        (double)loadgen->sent_bytes / seconds / 1e6,
+        (double)loadgen->received_bytes / seconds / 1e6);
+    fprintf(stderr, "  %zu connections failed, %" PRIu64
+        " requests in flight at the end\n", loadgen->failed, in_flight);
+    if (loadgen->latency.count > 0)
+    {
+        fprintf(stderr, "  latency:");
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]);
+            i++)
+        {
+            fprintf(stderr, " %s %.1f us", percentiles[i].label,
+                (double)histogram_percentile(&loadgen->latency,
+                    percentiles[i].rank) / 1e3);
+        }
+        fprintf(stderr, " max %.1f us\n",
+            (double)loadgen->latency.max / 1e3);
+    }
+
+    printf("{\"name\": \"loadgen-%s\", \"ops\": %" PRIu64
+        ", \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f"
+        ", \"connections\": %zu, \"failed\": %zu, \"message_size\": %zu"
+        ", \"bytes_per_sec\": %.0f, \"in_flight\": %" PRIu64,
+        mode_names[options->mode], ops,
+        ops == 0 ? 0.0 : (double)elapsed_ns / (double)ops,
+        (double)ops / seconds, loadgen->connected, loadgen->failed,
+        options->message_size, (double)loadgen->received_bytes / seconds,
+        in_flight);
+    if (options->mode == MODE_OPEN)
+    {
+        printf(", \"rate\": %.0f", options->rate);
+    }
+    if (loadgen->latency.count > 0)
+    {
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]);
+            i++)
+        {
+            printf(", \"%s\": %" PRIu64, percentiles[i].key,
+                histogram_percentile(&loadgen->latency, percentiles[i].rank));
+        }
+        printf(", \"max_ns\": %" PRIu64, loadgen->latency.max);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+        "Usage: %s [-H HOST] [-p PORT] [-c CONNECTIONS] [-d SECONDS]\n"
+        "       [-w WARMUP_SECONDS] [-s MESSAGE_SIZE]\n"
+        "       [-m closed|open|stream] [-r REQUESTS_PER_SECOND]\n",
+        program);
+}
+
+static void parse_options(int argc, char *argv[], struct options *options)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "H:p:c:d:w:s:m:r:h")) != -1)
+    {
+        switch (option)
+        {
+            case 'H': options->host = optarg; break;
+            case 'p': options->port = atoi(optarg); break;
+            case 'c': options->connections = strtoul(optarg, NULL, 10); break;
+            case 'd': options->duration = atof(optarg); break;
+            case 'w': options->warmup = atof(optarg); break;
+            case 's': options->message_size = strtoul(optarg, NULL, 10); break;
+            case 'r': options->rate = atof(optarg); break;
+            case 'm':
+                if (strcmp(optarg, "closed") == 0)
+                {
+                    options->mode = MODE_CLOSED;
+                }
+                else if (strcmp(optarg, "open") == 0)
+                {
+                    options->mode = MODE_OPEN;
+                }
+                else if (strcmp(optarg, "stream") == 0)
+                {
+                    options->mode = MODE_STREAM;
+                }
+                else
+                {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (options->connections == 0 || options->message_size == 0
+        || options->duration <= 0 || options->warmup < 0
+        || (options->mode == MODE_OPEN && options->rate <= 0))
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static struct loadgen loadgen =
+        { .em = EM_STATIC_DEFAULT
+        , .options =
+            { .host = "127.0.0.1"
+            , .port = 4041
+            , .connections = 1000
+            , .duration = 10
+            , .warmup = 1
+            , .message_size = 64
+            , .mode = MODE_CLOSED
+            , .rate = 10000
+            }
+        };
+    struct sockaddr_in address =
+        { .sin_family = AF_INET
+        };
+
+    parse_options(argc, argv, &loadgen.options);
+    address.sin_port = htons((uint16_t)loadgen.options.port);
+    if (inet_pton(AF_INET, loadgen.options.host, &address.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid IPv4 address: %s\n", loadgen.options.host);
+        exit(EXIT_FAILURE);
+    }
+
+    // Write to a connection closed by peer is reported as EPIPE.
+    signal(SIGPIPE, SIG_IGN);
+    raise_file_limit(loadgen.options.connections);
+    memset(payload, 'x', sizeof(payload));
+
+    loadgen.connections =
+        calloc(loadgen.options.connections, sizeof(struct connection));
+    if (loadgen.connections == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if_em_failure (event_storage_init(&loadgen.em.descriptor_storage,
+        EM_STORAGE_ARRAY))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (is_em_failure(event_machine_init(&loadgen.em))
+        || is_em_failure(event_machine_set_validation(&loadgen.em,
+            EM_VALIDATE_TRUSTED))
+        || is_em_failure(event_timer_create(&loadgen.em, &loadgen.ticker,
+            tick, &loadgen))
+        || is_em_failure(event_timer_set_overrun_policy(&loadgen.ticker,
+            EM_TIMER_OVERRUN_ONCE)))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < loadgen.options.connections; i++)
+    {
+        if (connection_open(&loadgen, &loadgen.connections[i], &address) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    loadgen.start = now_ns();
+    loadgen.measure_start =
+        loadgen.start + (uint64_t)(loadgen.options.warmup * 1e9);
+    loadgen.end =
+        loadgen.measure_start + (uint64_t)(loadgen.options.duration * 1e9);
+    loadgen.measuring = loadgen.options.warmup == 0;
+
+    if (is_em_failure(event_timer_start(&loadgen.ticker, TICK_MSEC, false))
+        || is_em_failure(event_machine_run(&loadgen.em)))
+    {
+        exit(EXIT_FAILURE);
+    }
+    if (loadgen.measure_end == 0)
+    {
+        // Terminated before the end of the run, e.g. all connections failed.
+        loadgen.measure_end = now_ns();
+        if (loadgen.measure_end < loadgen.measure_start)
+        {
+            loadgen.measure_start = loadgen.measure_end;
+        }
+    }
+
+    report(&loadgen);
+
+    for (size_t i = 0; i < loadgen.options.connections; i++)
+    {
+        struct connection *const connection = &loadgen.connections[i];
+
+        if (!connection->failed)
+        {
+            event_machine_delete(&loadgen.em, connection->ed.fd, NULL);
+            close(connection->ed.fd);
+        }
+        free(connection->starts);
+    }
+    event_timer_destroy(&loadgen.ticker);
+    event_machine_destroy(&loadgen.em);
+    event_storage_destroy(&loadgen.em.descriptor_storage);
+    free(loadgen.connections);
+
+    exit(loadgen.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}